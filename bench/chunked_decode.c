@@ -0,0 +1,72 @@
+// throughput of chunked_decode over a request body arriving in reads of READ_SIZE.
+// usage: bench_chunked_decode [chunk size, 4096] [MiB of chunk data, 256]
+
+#include <avuna/chunked.h>
+#include <avuna/pmem.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define READ_SIZE 16384 // what a worker hands over per read
+
+int main(int argc, char* argv[]) {
+    size_t chunk_size = argc > 1 ? strtoull(argv[1], NULL, 10) : 4096;
+    size_t total = (argc > 2 ? strtoull(argv[2], NULL, 10) : 256) * 1024 * 1024;
+    if (chunk_size == 0) {
+        fprintf(stderr, "chunk size has to be at least 1\n");
+        return 1;
+    }
+    struct mempool* pool = mempool_new();
+    // one chunk's framing and data, repeated until total is reached
+    char size_line[32];
+    int size_line_length = snprintf(size_line, sizeof(size_line), "%zx;ext=1\r\n", chunk_size);
+    size_t encoded_chunk = (size_t) size_line_length + chunk_size + 2;
+    size_t chunks = total / chunk_size;
+    size_t body_size = chunks * encoded_chunk + 5;
+    uint8_t* body = pmalloc(pool, body_size);
+    for (size_t i = 0; i < chunks; ++i) {
+        uint8_t* chunk = body + i * encoded_chunk;
+        memcpy(chunk, size_line, (size_t) size_line_length);
+        memset(chunk + size_line_length, 'a' + (int) (i % 26), chunk_size);
+        memcpy(chunk + size_line_length + chunk_size, "\r\n", 2);
+    }
+    memcpy(body + chunks * encoded_chunk, "0\r\n\r\n", 5);
+
+    struct mempool* in_pool = mempool_new();
+    struct mempool* out_pool = mempool_new();
+    struct buffer in;
+    struct buffer out;
+    buffer_init(&in, in_pool);
+    buffer_init(&out, out_pool);
+    struct chunked_decoder decoder;
+    memset(&decoder, 0, sizeof(decoder));
+
+    struct timespec start;
+    struct timespec end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    int status = 0;
+    size_t decoded = 0;
+    for (size_t offset = 0; offset < body_size && status == 0; offset += READ_SIZE) {
+        size_t size = body_size - offset < READ_SIZE ? body_size - offset : READ_SIZE;
+        // the copy a handler makes of what it keeps, see sub_conn_keep
+        uint8_t* read = pmalloc(in_pool, size);
+        memcpy(read, body + offset, size);
+        buffer_push(&in, read, size);
+        status = chunked_decode(&decoder, &in, &out);
+        decoded += out.size;
+        buffer_skip(&out, out.size);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    if (status != 1 || decoded != chunks * chunk_size) {
+        fprintf(stderr, "decode ended with %d after %zu of %zu bytes\n", status, decoded, chunks * chunk_size);
+        return 1;
+    }
+    double seconds = (double) (end.tv_sec - start.tv_sec) + (double) (end.tv_nsec - start.tv_nsec) / 1e9;
+    printf("chunk size %zu: %zu MiB of chunk data in %.3f s, %.1f MiB/s\n", chunk_size, decoded / (1024 * 1024), seconds,
+           (double) decoded / (1024 * 1024) / seconds);
+    pfree(in_pool);
+    pfree(out_pool);
+    pfree(pool);
+    return 0;
+}
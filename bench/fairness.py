@@ -0,0 +1,117 @@
+#!/usr/bin/env python3
+# how much heavy pipelining clients slow down light ones on the same workers, against a running server.
+# light clients fetch --light one request at a time and time each, first alone, then while heavy clients keep --pipeline requests
+# for --heavy in flight on each of their connections. with one worker (threads = 1) this shows what read-budget buys.
+# usage: fairness.py <host> <port> [--heavy /big.bin] [--light /] [--heavy-clients 4] [--light-clients 4] [--pipeline 16] [--seconds 10]
+
+import argparse
+import http.client
+import multiprocessing
+import socket
+import sys
+import threading
+import time
+
+
+def heavy_client(host, port, path, pipeline, seconds, received):
+    # requests go out in batches from one thread while another drains the responses, so neither side's buffers fill up for good
+    sock = socket.create_connection((host, port))
+    request = ("GET %s HTTP/1.1\r\nHost: %s\r\n\r\n" % (path, host)).encode() * pipeline
+    end = time.monotonic() + seconds
+
+    def drain():
+        while True:
+            try:
+                data = sock.recv(1 << 20)
+            except OSError:
+                return
+            if not data:
+                return
+            with received.get_lock():
+                received.value += len(data)
+
+    reader = threading.Thread(target=drain, daemon=True)
+    reader.start()
+    try:
+        while time.monotonic() < end:
+            sock.sendall(request)
+    except OSError:
+        pass
+    sock.shutdown(socket.SHUT_RDWR)
+    reader.join()
+    sock.close()
+
+
+def light_client(host, port, path, end, latencies, errors):
+    conn = http.client.HTTPConnection(host, port, timeout=30)
+    try:
+        while time.monotonic() < end:
+            start = time.monotonic()
+            conn.request("GET", path)
+            response = conn.getresponse()
+            response.read()
+            latencies.append(time.monotonic() - start)
+            if response.status != 200:
+                errors.append(response.status)
+                return
+    except (OSError, http.client.HTTPException) as e:
+        errors.append(repr(e))
+    finally:
+        conn.close()
+
+
+def measure_light(args, seconds):
+    latencies = []
+    errors = []
+    end = time.monotonic() + seconds
+    clients = [threading.Thread(target=light_client, args=(args.host, args.port, args.light, end, latencies, errors))
+               for _ in range(args.light_clients)]
+    for client in clients:
+        client.start()
+    for client in clients:
+        client.join()
+    if errors:
+        print("%d light clients failed, the first with %s" % (len(errors), errors[0]))
+        sys.exit(1)
+    return sorted(latency * 1000 for latency in latencies)
+
+
+def percentile(values, p):
+    return values[min(len(values) - 1, int(len(values) * p / 100))]
+
+
+def report(name, latencies):
+    print("%-6s %6d requests, p50 %7.2f ms, p90 %7.2f ms, p99 %7.2f ms, max %7.2f ms" % (
+        name, len(latencies), percentile(latencies, 50), percentile(latencies, 90), percentile(latencies, 99), latencies[-1]))
+
+
+def main():
+    parser = argparse.ArgumentParser()
+    parser.add_argument("host")
+    parser.add_argument("port", type=int)
+    parser.add_argument("--heavy", default="/big.bin", help="path the heavy clients pipeline, something large")
+    parser.add_argument("--light", default="/", help="path the light clients time, something small")
+    parser.add_argument("--heavy-clients", type=int, default=4)
+    parser.add_argument("--light-clients", type=int, default=4)
+    parser.add_argument("--pipeline", type=int, default=16)
+    parser.add_argument("--seconds", type=float, default=10)
+    args = parser.parse_args()
+
+    report("alone", measure_light(args, args.seconds))
+    # processes, so the heavy clients' reads don't hold the light clients' threads up
+    received = multiprocessing.Value("Q", 0)
+    heavy = [multiprocessing.Process(target=heavy_client, args=(args.host, args.port, args.heavy, args.pipeline, args.seconds + 1, received))
+             for _ in range(args.heavy_clients)]
+    for process in heavy:
+        process.start()
+    time.sleep(0.5)
+    loaded = measure_light(args, args.seconds)
+    for process in heavy:
+        process.join()
+    report("loaded", loaded)
+    print("heavy clients received %.1f MiB/s" % (received.value / (1024 * 1024) / (args.seconds + 1)))
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
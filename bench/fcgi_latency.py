@@ -0,0 +1,217 @@
+#!/usr/bin/env python3
+# latency of php requests through the fcgi provider against a local stub that answers each request after --delay ms.
+# the time on top of the stub's delay is what the server adds, the test fails if its p99 goes over --slack ms.
+# usage: fcgi_latency.py <avuna-httpd> <modules dir> [--delay 20] [--slack 50] [--clients 8] [--requests 50]
+# exits 77 (skipped for ctest) when a build without DEBUG isn't run as root
+
+import argparse
+import http.client
+import os
+import shutil
+import socket
+import struct
+import subprocess
+import sys
+import tempfile
+import threading
+import time
+
+FCGI_BEGIN_REQUEST = 1
+FCGI_END_REQUEST = 3
+FCGI_PARAMS = 4
+FCGI_STDIN = 5
+FCGI_STDOUT = 6
+
+MAIN_CFG = """[daemon]
+uid         = 0
+gid         = 0
+pid-file    = {dir}/httpd.pid
+error-log   = {dir}/error.log
+mime-types  = {mime_types}
+modules     = {modules}
+
+[server main]
+threads     = 2
+bindings    = plaintext
+vhosts      = mainv
+access-log  = {dir}/access.log
+error-log   = {dir}/error.log
+max-post    = 65536
+
+[binding plaintext]
+bind-mode   = tcp
+bind-ip     = 127.0.0.1
+bind-port   = {port}
+max-conn    = 0
+
+[vhost mainv]
+type        = htdocs
+host        = *
+htdocs      = {dir}/htdocs/
+index       = index.php
+scache      = false
+providers   = stub
+
+[provider stub]
+type        = fcgi
+mode        = tcp
+ip          = 127.0.0.1
+port        = {fcgi_port}
+mime-types  = application/x-php
+"""
+
+
+def free_port():
+    with socket.socket() as s:
+        s.bind(("127.0.0.1", 0))
+        return s.getsockname()[1]
+
+
+def read_exactly(conn, size):
+    data = b""
+    while len(data) < size:
+        got = conn.recv(size - len(data))
+        if not got:
+            return None
+        data += got
+    return data
+
+
+def record(type, request_id, content):
+    return struct.pack(">BBHHBB", 1, type, request_id, len(content), 0, 0) + content
+
+
+def serve_fcgi(conn, delay):
+    # each request is answered once its stdin ends, on the connection it came in on
+    with conn:
+        while True:
+            header = read_exactly(conn, 8)
+            if header is None:
+                return
+            _, type, request_id, length, padding, _ = struct.unpack(">BBHHBB", header)
+            if read_exactly(conn, length + padding) is None:
+                return
+            if type != FCGI_STDIN or length != 0:
+                continue
+            time.sleep(delay)
+            body = b"Content-Type: text/plain\r\n\r\nok\n"
+            conn.sendall(record(FCGI_STDOUT, request_id, body) + record(FCGI_STDOUT, request_id, b"") +
+                         record(FCGI_END_REQUEST, request_id, struct.pack(">IB3x", 0, 0)))
+
+
+def run_fcgi_stub(listener, delay):
+    while True:
+        try:
+            conn, _ = listener.accept()
+        except OSError:
+            return
+        threading.Thread(target=serve_fcgi, args=(conn, delay), daemon=True).start()
+
+
+def run_client(port, requests, latencies, errors):
+    conn = http.client.HTTPConnection("127.0.0.1", port, timeout=10)
+    try:
+        for _ in range(requests):
+            start = time.monotonic()
+            conn.request("GET", "/index.php")
+            response = conn.getresponse()
+            body = response.read()
+            latencies.append(time.monotonic() - start)
+            if response.status != 200 or body != b"ok\n":
+                errors.append("%d %r" % (response.status, body[:64]))
+                return
+    except (OSError, http.client.HTTPException) as e:
+        errors.append(repr(e))
+    finally:
+        conn.close()
+
+
+def wait_for(port, server, timeout):
+    end = time.monotonic() + timeout
+    while time.monotonic() < end:
+        try:
+            socket.create_connection(("127.0.0.1", port), timeout=1).close()
+            return True
+        except OSError:
+            # a build without DEBUG forks, its parent exiting 0 is fine
+            if server.poll() not in (None, 0):
+                return False
+            time.sleep(0.05)
+    return False
+
+
+def percentile(values, p):
+    return values[min(len(values) - 1, int(len(values) * p / 100))]
+
+
+def main():
+    parser = argparse.ArgumentParser()
+    parser.add_argument("httpd")
+    parser.add_argument("modules")
+    parser.add_argument("--delay", type=float, default=20, help="ms the stub takes per request")
+    parser.add_argument("--slack", type=float, default=50, help="ms over the delay the p99 may take")
+    parser.add_argument("--clients", type=int, default=8)
+    parser.add_argument("--requests", type=int, default=50, help="per client, on one keep-alive connection")
+    args = parser.parse_args()
+
+    source = os.path.dirname(os.path.dirname(os.path.abspath(__file__)))
+    dir = tempfile.mkdtemp(prefix="avuna-fcgi-latency-")
+    listener = socket.socket()
+    listener.bind(("127.0.0.1", 0))
+    listener.listen(128)
+    threading.Thread(target=run_fcgi_stub, args=(listener, args.delay / 1000), daemon=True).start()
+    port = free_port()
+    os.mkdir(os.path.join(dir, "htdocs"))
+    with open(os.path.join(dir, "htdocs", "index.php"), "w") as f:
+        f.write("<?php echo \"ok\\n\";\n")
+    with open(os.path.join(dir, "main.cfg"), "w") as f:
+        f.write(MAIN_CFG.format(dir=dir, mime_types=os.path.join(source, "cfg-example", "mime.txt"), modules=os.path.abspath(args.modules),
+                                port=port, fcgi_port=listener.getsockname()[1]))
+
+    output = open(os.path.join(dir, "output.log"), "w+")
+    server = subprocess.Popen([args.httpd, dir], stdout=output, stderr=subprocess.STDOUT)
+    pid = server.pid
+    try:
+        if not wait_for(port, server, 10):
+            output.seek(0)
+            log = output.read()
+            if "Must run as root" in log:
+                print("skipped, avuna-httpd was built without DEBUG and this isn't root")
+                return 77
+            print("avuna-httpd didn't come up on port %d:\n%s" % (port, log))
+            return 1
+        if server.poll() is not None:
+            with open(os.path.join(dir, "httpd.pid")) as f:
+                pid = int(f.read())
+
+        latencies = []
+        errors = []
+        clients = [threading.Thread(target=run_client, args=(port, args.requests, latencies, errors)) for _ in range(args.clients)]
+        for client in clients:
+            client.start()
+        for client in clients:
+            client.join()
+        if errors:
+            print("%d clients failed, the first with %s" % (len(errors), errors[0]))
+            return 1
+
+        added = sorted((latency * 1000 - args.delay) for latency in latencies)
+        print("%d requests, %d clients, stub delay %.0f ms. added by the server: p50 %.2f ms, p90 %.2f ms, p99 %.2f ms, max %.2f ms" % (
+            len(added), args.clients, args.delay, percentile(added, 50), percentile(added, 90), percentile(added, 99), added[-1]))
+        if percentile(added, 99) > args.slack:
+            print("p99 is over the %.0f ms allowed" % args.slack)
+            return 1
+        return 0
+    finally:
+        try:
+            os.kill(pid, 15)
+        except OSError:
+            pass
+        server.wait()
+        listener.close()
+        output.close()
+        shutil.rmtree(dir, ignore_errors=True)
+
+
+if __name__ == "__main__":
+    sys.exit(main())
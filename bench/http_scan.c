@@ -0,0 +1,132 @@
+// time http_scan_headers_end takes to find the end of a small and a large header block, against the state machine it replaced.
+// usage: bench_http_scan [iterations, 1000000]
+//        bench_http_scan --check, compares it with that state machine on random input split at random points, for ctest
+
+#include <avuna/http_scan.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define CHECK_ROUNDS 200000
+
+// the state machine handle_http_server_read ran over every byte before
+static ssize_t scan_bytes(const uint8_t* data, size_t size) {
+    static const uint8_t newlines[4] = {'\r', '\n', '\r', '\n'};
+    size_t match_length = 0;
+    for (size_t i = 0; i < size; ++i) {
+        if (data[i] == newlines[match_length]) {
+            if (++match_length == 4) {
+                return (ssize_t) (i + 1);
+            }
+        } else if (data[i] == newlines[0]) {
+            match_length = 1;
+        } else {
+            match_length = 0;
+        }
+    }
+    return -1;
+}
+
+static int check() {
+    // mostly CR and LF, so partial matches straddle the split points often
+    static const uint8_t alphabet[4] = {'\r', '\n', 'a', '\r'};
+    uint8_t data[256];
+    srand(1);
+    for (int round = 0; round < CHECK_ROUNDS; ++round) {
+        size_t size = (size_t) (rand() % (int) sizeof(data));
+        for (size_t i = 0; i < size; ++i) {
+            data[i] = alphabet[rand() % 4];
+        }
+        ssize_t expected = scan_bytes(data, size);
+        ssize_t found = -1;
+        int state = 0;
+        size_t offset = 0;
+        while (offset < size) {
+            size_t piece = (size_t) (rand() % 40) + 1;
+            if (piece > size - offset) {
+                piece = size - offset;
+            }
+            ssize_t end = http_scan_headers_end(data + offset, piece, &state);
+            if (end >= 0) {
+                found = (ssize_t) offset + end;
+                break;
+            }
+            offset += piece;
+        }
+        if (found != expected) {
+            fprintf(stderr, "round %d: %zu bytes, found the end at %zd instead of %zd\n", round, size, found, expected);
+            return 1;
+        }
+    }
+    printf("%d random inputs agree with the state machine\n", CHECK_ROUNDS);
+    return 0;
+}
+
+static size_t build_block(uint8_t* block, size_t target) {
+    static const char* lines[] = {
+        "Host: example.com\r\n",
+        "User-Agent: Mozilla/5.0 (X11; Linux x86_64; rv:120.0) Gecko/20100101 Firefox/120.0\r\n",
+        "Accept: text/html,application/xhtml+xml,application/xml;q=0.9,*/*;q=0.8\r\n",
+        "Accept-Encoding: gzip, deflate, br\r\n",
+        "Cookie: session=5f2b8c1e9a7d4e3f8b6a0c2d1e4f7a9b; theme=dark; lang=en-US\r\n",
+    };
+    size_t size = 0;
+    memcpy(block, "GET /index.html HTTP/1.1\r\n", 26);
+    size += 26;
+    for (int i = 0; size < target; ++i) {
+        const char* line = lines[i % 5];
+        size_t length = strlen(line);
+        memcpy(block + size, line, length);
+        size += length;
+    }
+    memcpy(block + size, "\r\n", 2);
+    return size + 2;
+}
+
+static double elapsed(struct timespec* start, struct timespec* end) {
+    return (double) (end->tv_sec - start->tv_sec) * 1e9 + (double) (end->tv_nsec - start->tv_nsec);
+}
+
+static int time_block(const char* name, size_t target, long iterations) {
+    uint8_t block[16384];
+    size_t size = build_block(block, target);
+    struct timespec start;
+    struct timespec end;
+    // the sums keep the loops from being optimized out
+    ssize_t sum = 0;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (long i = 0; i < iterations; ++i) {
+        int state = 0;
+        sum += http_scan_headers_end(block, size, &state);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double scan = elapsed(&start, &end) / (double) iterations;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (long i = 0; i < iterations; ++i) {
+        sum -= scan_bytes(block, size);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double machine = elapsed(&start, &end) / (double) iterations;
+    if (sum != 0) {
+        fprintf(stderr, "%s: the scanner and the state machine disagree\n", name);
+        return 1;
+    }
+    printf("%s block, %zu bytes: %.1f ns scanned, %.1f ns by the state machine, %.2f GB/s\n", name, size, scan, machine, (double) size / scan);
+    return 0;
+}
+
+int main(int argc, char* argv[]) {
+    if (argc > 1 && strcmp(argv[1], "--check") == 0) {
+        return check();
+    }
+    long iterations = argc > 1 ? strtol(argv[1], NULL, 10) : 1000000;
+    if (iterations < 1) {
+        fprintf(stderr, "iterations has to be at least 1\n");
+        return 1;
+    }
+    if (time_block("small", 200, iterations) || time_block("large", 8192, iterations / 16 + 1)) {
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,107 @@
+// ns and heap allocations per request head for parseRequest, which splits the head in place, against the copying parser it replaced
+// (str_dup'd request line, header_parse). each round does what handle_http_server_read does: a request pool, the head copied into it,
+// the parse, the pool freed. allocations are counted by wrapping glibc's malloc, so they include the pools' own bookkeeping.
+// usage: bench_parse_request [requests, 1000000]
+
+#include <avuna/http.h>
+#include <avuna/string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+extern void* __libc_malloc(size_t size);
+extern void* __libc_calloc(size_t count, size_t size);
+extern void* __libc_realloc(void* ptr, size_t size);
+
+static size_t allocations;
+
+void* malloc(size_t size) {
+    ++allocations;
+    return __libc_malloc(size);
+}
+
+void* calloc(size_t count, size_t size) {
+    ++allocations;
+    return __libc_calloc(count, size);
+}
+
+void* realloc(void* ptr, size_t size) {
+    ++allocations;
+    return __libc_realloc(ptr, size);
+}
+
+static const char head[] = "GET /articles/2019/03/avuna-httpd.html?ref=front HTTP/1.1\r\n"
+                           "Host: www.example.com\r\n"
+                           "User-Agent: Mozilla/5.0 (X11; Linux x86_64; rv:120.0) Gecko/20100101 Firefox/120.0\r\n"
+                           "Accept: text/html,application/xhtml+xml,application/xml;q=0.9,*/*;q=0.8\r\n"
+                           "Accept-Language: en-US,en;q=0.5\r\n"
+                           "Accept-Encoding: gzip, deflate, br\r\n"
+                           "Referer: https://www.example.com/\r\n"
+                           "Connection: keep-alive\r\n"
+                           "Cookie: session=5f2b8c1e9a7d4e3f8b6a0c2d1e4f7a9b; theme=dark\r\n"
+                           "Upgrade-Insecure-Requests: 1\r\n"
+                           "If-Modified-Since: Tue, 12 Mar 2019 10:00:00 GMT\r\n"
+                           "Cache-Control: max-age=0\r\n"
+                           "\r\n";
+
+// parseRequest as it was before heads were parsed in place, minus its Content-Length body setup
+static int parse_request_copying(struct request_session* rs, char* data) {
+    struct request* request = rs->request;
+    char* temp = data;
+    char* eol1 = strchr(temp, '\n');
+    if (eol1 == NULL) return -1;
+    eol1[0] = 0;
+    char* headers = eol1 + 1;
+    eol1 = strchr(temp, ' ');
+    if (eol1 == NULL) return -1;
+    eol1[0] = 0;
+    request->method = str_dup(temp, 0, rs->pool);
+    temp = eol1 + 1;
+    eol1 = strchr(temp, ' ');
+    if (eol1 == NULL) return -1;
+    eol1[0] = 0;
+    request->path = str_dup(temp, 0, rs->pool);
+    request->http_version = str_dup(str_trim(eol1 + 1), 0, rs->pool);
+    request->headers = header_parse(headers, rs->pool);
+    request->body = NULL;
+    return 0;
+}
+
+static double run(const char* name, int (*parse)(struct request_session*, char*), long requests) {
+    struct timespec start;
+    struct timespec end;
+    size_t head_size = sizeof(head) - 1;
+    size_t before = allocations;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (long i = 0; i < requests; ++i) {
+        struct mempool* req_pool = mempool_new();
+        char* data = pmalloc(req_pool, head_size + 1);
+        memcpy(data, head, head_size + 1);
+        struct request_session* rs = pcalloc(req_pool, sizeof(struct request_session));
+        rs->request = pcalloc(req_pool, sizeof(struct request));
+        rs->pool = req_pool;
+        if (parse(rs, data) < 0 || header_get(rs->request->headers, "Host") == NULL) {
+            fprintf(stderr, "%s: the head didn't parse\n", name);
+            exit(1);
+        }
+        pfree(req_pool);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double ns = ((double) (end.tv_sec - start.tv_sec) * 1e9 + (double) (end.tv_nsec - start.tv_nsec)) / (double) requests;
+    printf("%s: %.1f ns, %.1f allocations per request\n", name, ns, (double) (allocations - before) / (double) requests);
+    return ns;
+}
+
+int main(int argc, char* argv[]) {
+    long requests = argc > 1 ? strtol(argv[1], NULL, 10) : 1000000;
+    if (requests < 1) {
+        fprintf(stderr, "requests has to be at least 1\n");
+        return 1;
+    }
+    printf("%zu byte head, %ld requests\n", sizeof(head) - 1, requests);
+    double copying = run("copying", parse_request_copying, requests);
+    double in_place = run("in place", parseRequest, requests);
+    printf("in place takes %.0f%% of the time\n", in_place / copying * 100);
+    return 0;
+}
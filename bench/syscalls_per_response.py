@@ -0,0 +1,211 @@
+#!/usr/bin/env python3
+# send syscalls and tls records per response, against a running server. strace -c counts the worker's send family syscalls while
+# --requests responses for --path are fetched over keep-alive connections, with --tls the client also counts the application data
+# records the responses came in (tls 1.3 session tickets count too, a couple per connection).
+# strace has to be allowed to attach, as root or with kernel.yama.ptrace_scope = 0.
+# usage: syscalls_per_response.py <host> <port> <pid> [--path /] [--requests 1000] [--connections 4] [--tls]
+
+import argparse
+import os
+import signal
+import socket
+import ssl
+import subprocess
+import sys
+import tempfile
+import threading
+import time
+
+SEND_SYSCALLS = "write,writev,sendto,sendmsg,sendmmsg,sendfile,io_uring_enter"
+TLS_APPLICATION_DATA = 23
+
+
+class Connection:
+    def __init__(self, host, port, tls):
+        self.sock = socket.create_connection((host, port))
+        self.buffered = b""
+        self.tls = None
+        self.records = 0
+        self.record_bytes = 0
+        self.pending = b""  # raw tls bytes of a record header that came in split
+        self.record_left = 0
+        if tls:
+            # a MemoryBIO connection sees the raw bytes, so the records can be counted before they're decrypted
+            context = ssl.create_default_context()
+            context.check_hostname = False
+            context.verify_mode = ssl.CERT_NONE
+            self.incoming = ssl.MemoryBIO()
+            self.outgoing = ssl.MemoryBIO()
+            self.tls = context.wrap_bio(self.incoming, self.outgoing, server_hostname=host)
+            while True:
+                try:
+                    self.tls.do_handshake()
+                    break
+                except ssl.SSLWantReadError:
+                    self.flush()
+                    self.feed(self.sock.recv(65536), False)
+            self.flush()
+
+    def flush(self):
+        data = self.outgoing.read()
+        if data:
+            self.sock.sendall(data)
+
+    def feed(self, data, counting):
+        if not data:
+            raise ConnectionError("the server closed the connection")
+        if counting:
+            self.count_records(data)
+        self.incoming.write(data)
+
+    def count_records(self, data):
+        data = self.pending + data
+        self.pending = b""
+        i = 0
+        while i < len(data):
+            if self.record_left > 0:
+                step = min(self.record_left, len(data) - i)
+                self.record_left -= step
+                i += step
+                continue
+            if len(data) - i < 5:
+                self.pending = data[i:]
+                return
+            length = int.from_bytes(data[i + 3:i + 5], "big")
+            if data[i] == TLS_APPLICATION_DATA:
+                self.records += 1
+                self.record_bytes += length
+            self.record_left = length
+            i += 5
+
+    def send(self, data):
+        if self.tls is None:
+            self.sock.sendall(data)
+            return
+        self.tls.write(data)
+        self.flush()
+
+    def recv(self):
+        if self.tls is None:
+            data = self.sock.recv(1 << 20)
+            if not data:
+                raise ConnectionError("the server closed the connection")
+            return data
+        while True:
+            try:
+                return self.tls.read(1 << 20)
+            except ssl.SSLWantReadError:
+                self.feed(self.sock.recv(1 << 20), True)
+
+    def read_until(self, marker):
+        while marker not in self.buffered:
+            self.buffered += self.recv()
+        index = self.buffered.index(marker) + len(marker)
+        data, self.buffered = self.buffered[:index], self.buffered[index:]
+        return data
+
+    def read_exactly(self, size):
+        while len(self.buffered) < size:
+            self.buffered += self.recv()
+        data, self.buffered = self.buffered[:size], self.buffered[size:]
+        return data
+
+    def get(self, host, path):
+        self.send(("GET %s HTTP/1.1\r\nHost: %s\r\nAccept-Encoding: identity\r\n\r\n" % (path, host)).encode())
+        head = self.read_until(b"\r\n\r\n").decode("latin-1").lower().split("\r\n")
+        status = int(head[0].split(" ")[1])
+        headers = dict(line.split(":", 1) for line in head[1:] if ":" in line)
+        if "content-length" in headers:
+            self.read_exactly(int(headers["content-length"]))
+        elif "chunked" in headers.get("transfer-encoding", ""):
+            while True:
+                size = int(self.read_until(b"\r\n").split(b";")[0], 16)
+                self.read_exactly(size + 2)
+                if size == 0:
+                    break
+        return status
+
+
+def parse_strace_summary(text):
+    # % time     seconds  usecs/call     calls    errors syscall, errors is empty when there were none
+    calls = {}
+    errors = {}
+    for line in text.splitlines():
+        parts = line.split()
+        if len(parts) < 5 or not parts[0][0].isdigit() or parts[-1] == "total":
+            continue
+        calls[parts[-1]] = int(parts[3])
+        errors[parts[-1]] = int(parts[4]) if len(parts) == 6 else 0
+    return calls, errors
+
+
+def run_connection(args, requests, results, failures):
+    try:
+        conn = Connection(args.host, args.port, args.tls)
+        for _ in range(requests):
+            status = conn.get(args.host, args.path)
+            if status != 200:
+                failures.append("status %d" % status)
+                return
+        results.append((conn.records, conn.record_bytes))
+        conn.sock.close()
+    except (OSError, ValueError) as e:
+        failures.append(repr(e))
+
+
+def main():
+    parser = argparse.ArgumentParser()
+    parser.add_argument("host")
+    parser.add_argument("port", type=int)
+    parser.add_argument("pid", type=int, help="of the server, strace follows its worker threads")
+    parser.add_argument("--path", default="/")
+    parser.add_argument("--requests", type=int, default=1000)
+    parser.add_argument("--connections", type=int, default=4)
+    parser.add_argument("--tls", action="store_true")
+    args = parser.parse_args()
+
+    summary = tempfile.NamedTemporaryFile(prefix="avuna-strace-", suffix=".txt", delete=False)
+    summary.close()
+    try:
+        strace = subprocess.Popen(["strace", "-f", "-c", "-e", "trace=" + SEND_SYSCALLS, "-o", summary.name, "-p", str(args.pid)],
+                                  stderr=subprocess.DEVNULL)
+    except FileNotFoundError:
+        print("strace isn't installed")
+        return 1
+    # strace has no signal for having attached, give it a moment
+    time.sleep(1)
+    if strace.poll() is not None:
+        print("strace couldn't attach to %d, it needs root or kernel.yama.ptrace_scope = 0" % args.pid)
+        return 1
+
+    results = []
+    failures = []
+    per_connection = args.requests // args.connections
+    connections = [threading.Thread(target=run_connection, args=(args, per_connection, results, failures)) for _ in range(args.connections)]
+    for connection in connections:
+        connection.start()
+    for connection in connections:
+        connection.join()
+    strace.send_signal(signal.SIGINT)
+    strace.wait()
+    with open(summary.name) as f:
+        calls, errors = parse_strace_summary(f.read())
+    os.unlink(summary.name)
+    if failures:
+        print("%d connections failed, the first with %s" % (len(failures), failures[0]))
+        return 1
+
+    responses = per_connection * args.connections
+    print("%d responses for %s over %d connections" % (responses, args.path, args.connections))
+    for name in sorted(calls):
+        print("  %-16s %8.2f per response, %d failed, mostly EAGAIN" % (name, calls[name] / responses, errors[name]))
+    print("  %-16s %8.2f per response" % ("all of them", sum(calls.values()) / responses))
+    if args.tls:
+        records = sum(r[0] for r in results)
+        record_bytes = sum(r[1] for r in results)
+        print("  %-16s %8.2f per response, %.0f bytes on average" % ("tls records", records / responses, record_bytes / max(records, 1)))
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -24,6 +24,7 @@ struct scache {
     struct provision* body;
     size_t size;
     struct mempool* pool;
+    size_t refs; // the cache's own, plus one per response still writing the body out of it
 };
 
 struct cache {
@@ -39,4 +40,9 @@ struct scache* cache_get(struct cache* cache, char* request_path, int content_en
 
 void cache_add(struct cache* cache, struct scache* scache);
 
+void cache_ref(struct scache* scache);
+
+// frees the entry's pool with the last reference, so bodies being written survive the cache
+void cache_unref(struct scache* scache);
+
 #endif /* CACHE_H_ */
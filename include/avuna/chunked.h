@@ -5,7 +5,37 @@
 #ifndef AVUNA_HTTPD_CHUNKED_H
 #define AVUNA_HTTPD_CHUNKED_H
 
+#include <avuna/buffer.h>
+#include <stddef.h>
+
+#define CHUNKED_MAX_LINE 8192 // bytes of chunk extensions and trailers accepted per chunk
+
+#define CHUNKED_SIZE 0
+#define CHUNKED_EXTENSION 1 // the rest of a size line
+#define CHUNKED_DATA 2
+#define CHUNKED_DATA_CR 3
+#define CHUNKED_DATA_LF 4
+#define CHUNKED_TRAILER 5 // at the start of a trailer line
+#define CHUNKED_TRAILER_LINE 6
+#define CHUNKED_TRAILER_LF 7
+#define CHUNKED_DONE 8
+
+// incremental state of a Transfer-Encoding: chunked decode, zeroed to start one
+struct chunked_decoder {
+    int state;
+    size_t remaining; // of the current chunk's data, or its size while that is read
+    int digits;
+    size_t line_length;
+};
+
+struct request_session;
+struct provision;
+
 int init_chunked_stream(struct request_session* rs, struct provision* parent, struct provision* provision);
 
+// decodes as much of in as there is, moving chunk data onto out, or dropping it if out is NULL.
+// entries that are chunk data as a whole change buffers without being copied, only the pieces next to chunk boundaries are.
+// 1 once the last chunk and its trailer were read, anything past it is left in in. 0 if more is needed, -1 if malformed
+int chunked_decode(struct chunked_decoder* decoder, struct buffer* in, struct buffer* out);
 
 #endif //AVUNA_HTTPD_CHUNKED_H
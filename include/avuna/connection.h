@@ -14,30 +14,70 @@
 #include <avuna/http.h>
 #include <avuna/server.h>
 #include <avuna/buffer.h>
+#include <avuna/timer.h>
 #include <openssl/ssl.h>
 #include <sys/socket.h>
 #include <openssl/ssl.h>
 #include <openssl/md5.h>
 #include <netinet/ip6.h>
 #include <stdint.h>
+#include <time.h>
+
+#define TLS_STATE_NONE 0 // plaintext
+#define TLS_STATE_HANDSHAKE 1 // SSL_accept has not completed yet, driven by the worker on epoll events
+#define TLS_STATE_ESTABLISHED 2
+
+#define TIMEOUT_NONE 0
+#define TIMEOUT_KEEPALIVE 1 // extended by any activity
+#define TIMEOUT_HEADER 2 // armed once per request head, activity doesn't extend it
+#define TIMEOUT_BODY 3 // extended by any activity
 
 struct conn;
 
+struct uring_conn;
+
+// a pool for data written from outside of the write buffer's pool, freed once the last byte pushed while it was open left
+struct write_pin {
+    struct mempool* pool; // the pin itself lives in it
+    size_t start; // sub_conn.write_offset of the first byte it may cover
+    size_t end; // of the byte after its last, SIZE_MAX while it's still open
+    int refs; // the sub_conn's, and one per io_uring send chain carrying its bytes
+    struct write_pin* next;
+};
+
 struct sub_conn {
     struct conn* conn;
     struct mempool* pool;
     int fd;
     int tls;
-    int tls_handshaked;
+    int tls_state;
+    struct timespec tls_handshake_start;
     SSL* tls_session;
+    int ktls_send; // the kernel encrypts what's written to fd, so writes skip SSL_write and files go out with sendfile. see work_tls_handshake
     struct buffer read_buffer;
     struct buffer write_buffer;
     int write_available;
-    int (*read)(struct sub_conn* sub_conn, uint8_t* read_buf, size_t read_buf_len);
+    int (*read)(struct sub_conn* sub_conn, uint8_t* read_buf, size_t read_buf_len); // read_buf is the worker's, what's kept goes through sub_conn_keep
     void (*on_closed)(struct sub_conn* sub_conn);
     void* extra;
     int safe_close; // to allow closing when there might be pending events
     int (*notifier)(struct request_session* rs); // used for streams
+    void (*refresh_timeout)(struct sub_conn* sub_conn); // picks a TIMEOUT_* phase after activity, NULL for no timeouts
+    struct timer timer;
+    int timeout_phase;
+    struct uring_conn* uring; // set while an io_uring worker owns the socket, see network_uring.c
+    struct sub_conn** write_pprev; // non-NULL while in connection_manager.pending_writes
+    struct sub_conn* write_next;
+    struct sub_conn** ready_pprev; // non-NULL while in connection_manager.ready, its read budget ran out before the socket drained
+    struct sub_conn* ready_next;
+    int queue_hooked;
+    void (*on_written)(struct sub_conn* sub_conn); // NULL or called when write_buffer was fully written, may push more without calling trigger_write
+    int read_paused; // the socket isn't read until sub_conn_resume, so the peer is held back by tcp
+    struct write_pin* write_pins; // oldest first, what write_buffer entries point into outside of its pool. see sub_conn_write_pins
+    struct write_pin* write_pins_tail;
+    int write_pins_hooked;
+    size_t write_offset; // bytes taken off the front of write_buffer so far
+    int resume; // read is called with no new data on the next ready pass, see sub_conn_resume
 };
 
 struct connection_manager;
@@ -56,11 +96,39 @@ struct conn {
 };
 
 struct connection_manager {
-    struct llist* pending_sub_conns;
+    int epoll_fd; // the owning worker's, see sub_conn_register
+    struct timer_wheel* timers;
+    uint64_t timeouts[4]; // by TIMEOUT_* phase
+    int corked; // trigger_write only queues onto pending_writes while set
+    struct sub_conn* pending_writes;
+    struct sub_conn* ready; // read again after the next batch of events
+    uint8_t* write_staging; // TLS record coalescing
+    uint64_t write_calls; // writev or SSL_write calls from trigger_write
+    uint64_t write_entries; // write buffer entries those calls covered
 };
 
 int configure_fd(struct logsess* logger, int fd, int is_tcp);
 
 void trigger_write(struct sub_conn* sub_conn);
 
+// a pool freed once everything pushed to write_buffer until the next write was written, for entries whose data the
+// write buffer's pool doesn't own. all of those have to be pushed before the write
+struct mempool* sub_conn_write_pins(struct sub_conn* sub_conn);
+
+// as bytes leave write_buffer, write_offset already counting them: the open pin covers what was pushed before, and pins
+// with nothing left in write_buffer are let go. a chain (if not NULL) keeps every pin with bytes in it until it's freed
+void sub_conn_write_pins_advance(struct sub_conn* sub_conn, size_t pushed, struct mempool* chain);
+
+// adds a backend sub_conn with a connected fd to its conn and watches it right away, only from the worker owning the conn
+void sub_conn_register(struct sub_conn* sub_conn);
+
+// copies what a read handler leaves of read_buf onto read_buffer, the worker reuses read_buf once read returns
+void sub_conn_keep(struct sub_conn* sub_conn, uint8_t* data, size_t size);
+
+// calls read with no new data once the current event is done, for protocols that stopped consuming their read_buffer. only from the worker owning the sub_conn
+void sub_conn_resume(struct sub_conn* sub_conn);
+
+// only from the worker owning the sub_conn
+void sub_conn_set_timeout(struct sub_conn* sub_conn, int phase);
+
 #endif //AVUNA_HTTPD_CONNECTION_H
@@ -8,23 +8,86 @@
 #include <avuna/pmem.h>
 #include <avuna/hash.h>
 #include <avuna/llist.h>
+#include <stdint.h>
 #include <stdlib.h>
 
+#define HEADERS_INLINE 16 // entries held in struct headers itself before an array is allocated
+
+// well-known names, resolved once when a header is added. see header_id
+#define HEADER_OTHER 0
+#define HEADER_PSEUDO_AUTHORITY 1
+#define HEADER_PSEUDO_METHOD 2
+#define HEADER_PSEUDO_PATH 3
+#define HEADER_PSEUDO_SCHEME 4
+#define HEADER_PSEUDO_STATUS 5
+#define HEADER_ACCEPT 6
+#define HEADER_ACCEPT_ENCODING 7
+#define HEADER_ACCEPT_LANGUAGE 8
+#define HEADER_ACCEPT_RANGES 9
+#define HEADER_AUTHORIZATION 10
+#define HEADER_CACHE_CONTROL 11
+#define HEADER_CONNECTION 12
+#define HEADER_CONTENT_ENCODING 13
+#define HEADER_CONTENT_LENGTH 14
+#define HEADER_CONTENT_RANGE 15
+#define HEADER_CONTENT_TYPE 16
+#define HEADER_COOKIE 17
+#define HEADER_DATE 18
+#define HEADER_ETAG 19
+#define HEADER_EXPIRES 20
+#define HEADER_HOST 21
+#define HEADER_IF_MODIFIED_SINCE 22
+#define HEADER_IF_NONE_MATCH 23
+#define HEADER_IF_RANGE 24
+#define HEADER_KEEP_ALIVE 25
+#define HEADER_LAST_MODIFIED 26
+#define HEADER_LOCATION 27
+#define HEADER_ORIGIN 28
+#define HEADER_RANGE 29
+#define HEADER_REFERER 30
+#define HEADER_SERVER 31
+#define HEADER_SET_COOKIE 32
+#define HEADER_STATUS 33 // CGI's, not HTTP/2's
+#define HEADER_TRANSFER_ENCODING 34
+#define HEADER_UPGRADE 35
+#define HEADER_USER_AGENT 36
+#define HEADER_VARY 37
+#define HEADER_X_FORWARDED_FOR 38
+#define HEADER_X_POWERED_BY 39
+#define HEADER_WELL_KNOWN 40
+
 struct header_entry {
-    char* name;
+    int id; // HEADER_OTHER unless the name is well-known
+    char* name; // lowercase
     char* value;
-    struct llist_node* map_node;
-    struct llist_node* node;
 };
 
+// a flat table in the order the headers were added.
+// this replaced header_list, header_map and header_entry's node and map_node, so modules built against the llist/hashmap
+// layout have to be rebuilt, and ones that walked header_list iterate with header_count and header_at instead
 struct headers {
-    struct llist* header_list;
-    struct hashmap* header_map;
+    struct header_entry* entries; // inline_entries until there are more than HEADERS_INLINE
+    size_t count;
+    size_t capacity;
+    uint32_t first[HEADER_WELL_KNOWN]; // index + 1 of the first entry with each well-known name, 0 if there is none
     struct mempool* pool;
+    struct header_entry inline_entries[HEADERS_INLINE];
 };
 
+// the HEADER_* of a name in any case, HEADER_OTHER if it isn't well-known
+int header_id(const char* name, size_t length);
+
+// header_get for a well-known name, without looking it up
+char* header_get_id(struct headers* headers, int id);
+
 char* header_get(struct headers* headers, char* name);
 
+size_t header_count(struct headers* headers);
+
+// the index-th header in the order they were added, NULL from header_count on. header_set, header_prepend and header_del
+// shift the ones behind what they change, so don't count on an index across them
+struct header_entry* header_at(struct headers* headers, size_t index);
+
 int header_set(struct headers* headers, char* name, char* value);
 
 int header_add(struct headers* headers, char* name, char* value);
@@ -39,6 +102,12 @@ int header_setoradd(struct headers* headers, char* name, char* value);
 
 struct headers* header_new(struct mempool* parent);
 
+// a copy of headers that can be changed without touching them, e.g. a cached response's
+struct headers* header_clone(struct headers* headers, struct mempool* parent);
+
+// like header_parse, without copying: names (lowercased) and values point into data, which must outlive the headers
+struct headers* header_parse_in_place(char* data, struct mempool* parent);
+
 struct headers* header_parse(char* data, struct mempool* parent);
 
 char* header_serialize(struct headers* headers, size_t* len);
@@ -38,6 +38,10 @@ struct hpack_ctx* hpack_init(struct mempool* pool, size_t max_dynamic_size);
 
 int hpack_decode(struct headers* headers, struct hpack_ctx* ctx, struct mempool* pool, uint8_t* data, size_t data_length);
 
-uint8_t* hpack_encode(struct hpack_ctx* ctx, struct mempool* pool, struct headers* headers, size_t* out_length);
+// server (unless not with_server) and date header fields, rebuilt with the date. see http_fixed_headers
+const uint8_t* hpack_fixed_headers(int with_server, size_t* length);
+
+// fixed_headers appends hpack_fixed_headers after the pseudo-headers
+uint8_t* hpack_encode(struct hpack_ctx* ctx, struct mempool* pool, struct headers* headers, int fixed_headers, size_t* out_length);
 
 #endif //AVUNA_HTTPD_HPACK_H
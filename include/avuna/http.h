@@ -12,6 +12,8 @@
 #include <avuna/server.h>
 #include <avuna/cache.h>
 #include <avuna/connection.h>
+#include <avuna/http_range.h>
+#include <time.h>
 
 // perhaps a data attachment system?
 
@@ -31,6 +33,7 @@ struct response {
     struct headers* headers;
     struct provision* body; // may be NULL
     struct scache* fromCache; // todo: remove
+    struct http_ranges* ranges; // NULL or the parts of body that are sent, see http_range_apply
 };
 
 
@@ -47,12 +50,28 @@ struct request_session {
 };
 
 
-int parseRequest(struct request_session* rs, char* data, size_t maxPost);
+// splits data in place, the request line and headers point into it, so it has to live as long as rs->pool
+int parseRequest(struct request_session* rs, char* data);
+
+// sets up rs->request->body once the vhost is known. bodies of streamPost bytes or more (if not 0) become a post_stream of up to
+// maxStreamPost, others up to maxPost are read in full, chunked ones too. -1 with errno EMSGSIZE if it's larger,
+// the body is then a post_stream nothing reads, to be skipped behind the error
+int parseRequestBody(struct request_session* rs, size_t maxPost, size_t streamPost, size_t maxStreamPost);
 
 unsigned char* serializeRequest(struct request_session* rs, size_t* out_len);
 
 int parseResponse(struct request_session* rs, struct sub_conn* sub_conn, char* data);
 
+#define HTTP_DATE_LENGTH 29
+
+// the current time as an HTTP-date, formatted at most once a second per worker thread. *second (if not NULL) is the second it shows
+const char* http_date(time_t* second);
+
+// "Server" and "Date" lines every HTTP/1.1 response starts its headers with, rebuilt with the date. "Server" is left out
+// unless with_server. "Connection" differs per response and is one of its headers
+const char* http_fixed_headers(int with_server, size_t* length);
+
+// status line and headers only, a PROVISION_DATA body is written as its own entry
 unsigned char* serializeResponse(struct request_session* rs, size_t* out_len);
 
 void updateContentHeaders(struct request_session* rs);
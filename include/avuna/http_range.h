@@ -0,0 +1,32 @@
+#ifndef AVUNA_HTTPD_HTTP_RANGE_H
+#define AVUNA_HTTPD_HTTP_RANGE_H
+
+#include <stddef.h>
+
+#define HTTP_RANGE_MAX 16 // requests asking for more parts than this get the whole body
+
+struct request_session;
+
+struct http_range {
+    size_t start;
+    size_t length;
+    char* part_header; // the boundary and headers in front of a multipart/byteranges part, NULL for a single range
+    size_t part_header_length;
+};
+
+// the parts of a body sent as a 206, in the request's pool
+struct http_ranges {
+    struct http_range* ranges;
+    size_t count;
+    char* trailer; // the closing boundary, NULL for a single range
+    size_t trailer_length;
+    char* content_type; // multipart/byteranges with its boundary, NULL for a single range
+    size_t length; // of the body as sent, framing included
+};
+
+// decides on Range and If-Range for a 200 response whose body is length bytes, etag being its ETag or NULL if it has none.
+// 1 if it became a 206 with rs->response->ranges set, -1 if it became an empty 416, 0 if the whole body goes out.
+// the response headers are copied before they're changed, so cached ones stay as they are
+int http_range_apply(struct request_session* rs, size_t length, const char* etag);
+
+#endif //AVUNA_HTTPD_HTTP_RANGE_H
@@ -0,0 +1,16 @@
+#ifndef AVUNA_HTTPD_HTTP_SCAN_H
+#define AVUNA_HTTPD_HTTP_SCAN_H
+
+#include <avuna/buffer.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+// how much of a "\r\n\r\n" the bytes of buffer in front of chunk end with, chunk being its last entry. the state to start scanning chunk with
+int http_scan_resume(struct buffer* buffer, const uint8_t* chunk);
+
+// offset just past the first "\r\n\r\n" in data, given *state bytes of it already matched in front of data.
+// -1 if there is none, *state then holds the partial match data ends with
+ssize_t http_scan_headers_end(const uint8_t* data, size_t size, int* state);
+
+#endif //AVUNA_HTTPD_HTTP_SCAN_H
@@ -28,7 +28,7 @@ struct module {
         void (*on_disconnect)(struct module* module, struct conn* conn);
         int (*on_request_received)(struct module* module, struct request_session* rs); // 0 = do nothing, 1 = no further processing (i.e. error page return), -1 = drop connection. POST data not yet available
         struct vhost* (*on_request_vhost_resolved)(struct module* module, struct request_session* rs, struct vhost* vhost); // overrides default vhost identification
-        int (*on_request_post_received)(struct module* module, struct request_session* rs); // 0 = do nothing, 1 = drop connection
+        int (*on_request_post_received)(struct module* module, struct request_session* rs); // 0 = do nothing, 1 = drop connection. bodies are never streamed while a module has this, see http_stream_post_allowed
         char* (*on_mime_type_resolved)(struct module* module, struct request_session* rs, char* mime_type); // overrides mime types
         struct provider* (*on_request_handler_found)(struct module* module, struct request_session* rs, struct provider* provider); // allows provider overwriting before provision is returned.
         void (*on_request_handled)(struct module* module, struct request_session* rs); // called after provision is called
@@ -0,0 +1,46 @@
+#ifndef AVUNA_HTTPD_POST_STREAM_H
+#define AVUNA_HTTPD_POST_STREAM_H
+
+#include <avuna/provider.h>
+#include <avuna/http.h>
+#include <avuna/buffer.h>
+#include <avuna/chunked.h>
+
+#define POST_STREAM_WINDOW 262144 // bytes received ahead of the provider before the client is paused
+
+// a request body handed to the provider as it arrives rather than buffered up to max_post, see post_stream_new
+struct post_stream {
+    struct request_session* rs;
+    struct buffer pending; // received, not read by the provider yet
+    size_t remaining; // still to come from the client, 0 if the length isn't known
+    int finished;
+    int failed; // the client went away before sending all of it
+    int paused; // post_stream_push asked the protocol to stop reading
+    struct chunked_decoder* chunked; // NULL unless the body comes with Transfer-Encoding: chunked
+    int buffered; // collected in full for a vhost that only takes PROVISION_DATA, see post_stream_collect
+    size_t limit; // most bytes it may decode to, 0 for no limit
+    size_t received;
+    void (*on_drained)(struct post_stream* stream); // set by the protocol, called once a paused stream fell below POST_STREAM_WINDOW
+    void* protocol_extra;
+};
+
+// a PROVISION_STREAM request body, length is -1 if unknown. providers read it with data.stream.read and set data.stream.notify to hear of more
+struct provision* post_stream_new(struct request_session* rs, ssize_t length, char* content_type);
+
+// data belongs to the body's pool from here on. 1 if the provider is POST_STREAM_WINDOW behind and the protocol should stop reading,
+// -1 if the body went past stream->limit
+int post_stream_push(struct provision* body, uint8_t* data, size_t size);
+
+// decodes the chunked body at the front of in, the protocol finishes the stream once chunked->state is CHUNKED_DONE.
+// -1 if it's malformed, -2 if it decodes past stream->limit, otherwise 1 or 0 as post_stream_push
+int post_stream_push_chunked(struct provision* body, struct buffer* in);
+
+// turns a finished buffered body into PROVISION_DATA, and the request's framing headers into a Content-Length to match
+void post_stream_collect(struct provision* body);
+
+// no more data will come, failed if the client didn't send all of it
+void post_stream_finish(struct provision* body, int failed);
+
+ssize_t post_stream_read(struct provision* provision, struct provision_data* buffer);
+
+#endif //AVUNA_HTTPD_POST_STREAM_H
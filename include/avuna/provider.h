@@ -9,6 +9,7 @@
 #include <avuna/http.h>
 #include <avuna/hash.h>
 #include <avuna/config.h>
+#include <avuna/chunked.h>
 #include <stdint.h>
 #include <stdlib.h>
 #include <time.h>
@@ -34,6 +35,7 @@ struct provision_stream {
     ssize_t known_length;
     ssize_t (*read)(struct provision* provision, struct provision_data* buffer); // -2 == no data, not broken, -1 = error, 0 = end of stream_id, > 0 = data returned
     int (*notify)(struct request_session* rs); // called by a provision's resource (say a sub_conn) to notify the requester that data is available to read (0 = nop, else = kill provider). if NULL, stream is an intermediary ONLY
+    struct sub_conn* source; // NULL or the sub_conn the data comes in on, its reads are paused while the requester is behind. intermediaries take their parent's
     int delay_header_output; // if true, headers will not be sent until the last moment before stream_id data is sent.
     struct timespec delayed_start;
     void (*delay_finish)(struct request_session* rs, struct timespec* ts);
@@ -62,9 +64,29 @@ struct provider {
 
 ssize_t raw_stream_read(struct provision* provision, struct provision_data* buffer);
 
+#define FILE_STREAM_CHUNK 65536 // read from the file at a time, see file_stream_read
+
+// stream_fd read at offsets with pread, so only the bytes that are sent are read
+struct file_stream_extra {
+    struct http_ranges* ranges; // NULL for the whole file
+    size_t size; // of the file
+    size_t index; // range being read
+    size_t offset; // into it
+    int framed; // the range's part header was handed out by file_stream_send
+};
+
+// reads the next FILE_STREAM_CHUNK of the file or its ranges, with the multipart framing in between
+ssize_t file_stream_read(struct provision* provision, struct provision_data* buffer);
+
+// file_stream_read without the copy: the file's bytes go to out_fd with sendfile, as much as it takes. the multipart framing
+// is handed back in buffer instead (pointing into the ranges), and has to be written before the next call.
+// -2 if out_fd is full, otherwise returns as file_stream_read
+ssize_t file_stream_send(struct provision* provision, int out_fd, struct provision_data* buffer);
+
 struct chunked_stream_extra {
     struct sub_conn* sub_conn;
-    ssize_t remaining;
+    struct chunked_decoder decoder;
+    struct buffer decoded; // in the provision's pool, not read yet
 };
 
 ssize_t chunked_read(struct provision* provision, struct provision_data* buffer);
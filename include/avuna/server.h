@@ -25,8 +25,25 @@
 #define BINDING_MODE_HTTP2_UPGRADABLE 8
 #define BINDING_MODE_HTTP2_ONLY 16
 
+#define ACCEPT_MODE_THREAD 0 // one accept thread per binding, handing conns to workers through their handoff rings
+#define ACCEPT_MODE_REUSEPORT 1 // every worker accepts on its own SO_REUSEPORT socket per binding
+
+#define REUSEPORT_STEERING_NONE 0
+#define REUSEPORT_STEERING_CPU 1 // CBPF program picks the socket of the worker for the receiving CPU
+
+#define DISPATCH_ROUND_ROBIN 0
+#define DISPATCH_LEAST_CONN 1
+#define DISPATCH_P2C 2 // power of two choices on live connections
+#define DISPATCH_LEAST_BUSY 3
+
+#define IO_BACKEND_EPOLL 0
+#define IO_BACKEND_URING 1 // multishot accept and recv, linked sends, tls sub_conns and module backends still go through epoll
+
+struct server_info;
+
 struct server_binding {
     struct mempool* pool;
+    char* name;
     uint8_t binding_type;
     union {
         struct sockaddr_in tcp4;
@@ -34,9 +51,19 @@ struct server_binding {
         struct sockaddr_un un;
     } binding;
     int fd;
+    int reuseport; // a server accepts on it with accept-mode = reuseport, so its sockets join a SO_REUSEPORT group
+    struct server_info* reuseport_server; // the one server allowed to accept on it in reuseport mode
     uint32_t mode;
     struct cert* ssl_cert;
-    size_t conn_limit;
+    size_t conn_limit; // 0 for unlimited
+    size_t live_conns; // atomic
+    // listening socket options, 0 leaves the kernel default. accepted sockets inherit all but the first three
+    int backlog;
+    int defer_accept; // s, TCP_DEFER_ACCEPT
+    int fastopen; // TCP_FASTOPEN queue length
+    int rcvbuf;
+    int sndbuf;
+    int notsent_lowat;
 };
 
 struct server_info {
@@ -47,7 +74,21 @@ struct server_info {
     struct logsess* logsess;
     uint16_t max_worker_count;
     size_t max_post;
-    struct queue* prepared_connections;
+    size_t stream_post; // request bodies this large go to the provider as they arrive instead of up to max_post, 0 to disable
+    size_t max_stream_post; // 0 for unlimited
+    size_t conn_limit; // 0 for unlimited
+    size_t live_conns; // atomic
+    uint64_t keepalive_timeout; // ms, 0 to disable
+    uint64_t header_timeout;
+    uint64_t body_timeout;
+    uint8_t accept_mode;
+    uint8_t reuseport_steering;
+    uint8_t dispatch_policy; // ACCEPT_MODE_THREAD only
+    struct list* worker_listeners; // ACCEPT_MODE_REUSEPORT only: per worker, a list of listening sockets
+    struct list* worker_cpus; // (size_t) cpu ids, worker i is pinned to worker_cpus[i % count], NULL if unpinned
+    uint8_t io_backend;
+    size_t read_budget; // bytes read from one sub_conn before the worker moves on to others, 0 for unlimited
+    uint32_t busy_poll; // us workers keep polling without blocking after an event, and SO_BUSY_POLL of accepted sockets. 0 to disable
 };
 
 #endif //AVUNA_HTTPD_SERVER_H
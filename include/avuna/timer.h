@@ -0,0 +1,47 @@
+#ifndef AVUNA_HTTPD_TIMER_H
+#define AVUNA_HTTPD_TIMER_H
+
+#include <avuna/pmem.h>
+#include <stdint.h>
+#include <stddef.h>
+
+#define TIMER_WHEEL_BITS 6
+#define TIMER_WHEEL_SLOTS (1 << TIMER_WHEEL_BITS)
+#define TIMER_WHEEL_LEVELS 4 // at 100 ms ticks, covers ~19 days
+#define TIMER_WHEEL_TICK_NS 100000000
+
+// intrusive, embed in the owning object and hook timer_cancel on its pool
+struct timer_wheel;
+
+struct timer {
+    struct timer_wheel* wheel;
+    struct timer* prev;
+    struct timer* next;
+    struct timer** slot; // NULL when not armed
+    uint64_t deadline; // in ticks
+    void (*expired)(void* arg);
+    void* arg;
+};
+
+struct timer_wheel {
+    struct mempool* pool;
+    uint64_t start_ns;
+    uint64_t now; // in ticks
+    size_t count;
+    struct timer* slots[TIMER_WHEEL_LEVELS][TIMER_WHEEL_SLOTS];
+};
+
+struct timer_wheel* timer_wheel_new(struct mempool* pool, uint64_t now_ns);
+
+// (re)arms a timer to fire timeout_ms from now, within one tick, O(1)
+void timer_arm(struct timer_wheel* wheel, struct timer* timer, uint64_t timeout_ms);
+
+void timer_cancel(struct timer* timer);
+
+// fires every timer that expired by now_ns
+void timer_wheel_advance(struct timer_wheel* wheel, uint64_t now_ns);
+
+// milliseconds until the wheel next needs to advance, -1 if there is nothing armed. suitable as an epoll_wait timeout.
+int timer_wheel_timeout(struct timer_wheel* wheel, uint64_t now_ns);
+
+#endif //AVUNA_HTTPD_TIMER_H
@@ -27,6 +27,7 @@ struct vhost_type {
     char* name;
     int (*load_config)(struct vhost* vhost, struct config_node* node);
     int (*handle_request)(struct request_session* rs); // returns a VHOST_ACTION_* value
+    int stream_post; // handle_request reads a PROVISION_STREAM request body, see post_stream.h. others only get PROVISION_DATA
     void* extra;
 };
 
@@ -79,10 +79,14 @@ int fcgi_request_connection(struct request_session* rs, struct fcgi_config* fcgi
     return fd;
 }
 
+#define FCGI_STDIN_WINDOW 65536 // unwritten bytes to the FCGI server before a streamed request body is left waiting
+
 struct fcgi_stream_data {
     struct request_session* rs;
     struct provision* provision;
+    struct sub_conn* sub_conn;
     uint16_t request_id;
+    int stdin_done;
     int stdout_state; // 0 = headers, 1 = errors, 2 = headers read finished, 3 = body
     struct buffer headers;
     struct buffer* output;
@@ -90,7 +94,7 @@ struct fcgi_stream_data {
 };
 
 int fcgi_read(struct sub_conn* sub_conn, uint8_t* read_buf, size_t read_buf_len) {
-    buffer_push(&sub_conn->read_buffer, read_buf, read_buf_len);
+    sub_conn_keep(sub_conn, read_buf, read_buf_len);
     struct fcgi_stream_data* extra = sub_conn->extra;
     struct fcgi_frame frame;
     frame.type = FCGI_BEGIN_REQUEST;
@@ -149,16 +153,15 @@ int fcgi_read(struct sub_conn* sub_conn, uint8_t* read_buf, size_t read_buf_len)
                     headers[extra->headers.size] = 0;
                     buffer_pop(&extra->headers, extra->headers.size, (uint8_t*) headers);
                     struct headers* hdrs = header_parse(headers, extra->rs->pool);
-                    ITER_LLIST(hdrs->header_list, value) {
-                        struct header_entry* entry = value;
-                        if (str_eq(entry->name, "Content-Type")) {
+                    for (size_t i = 0; i < hdrs->count; ++i) {
+                        struct header_entry* entry = &hdrs->entries[i];
+                        if (entry->id == HEADER_CONTENT_TYPE) {
                             extra->rs->response->body->content_type = entry->value;
-                        } else if (str_eq(entry->name, "Status")) {
+                        } else if (entry->id == HEADER_STATUS) {
                             extra->rs->response->code = entry->value;
-                        } else if (str_eq(entry->name, "ETag")) {
+                        } else if (entry->id == HEADER_ETAG) {
                             // we handle ETags, ignore FCGI-given ones
                         } else header_add(extra->rs->response->headers, entry->name, entry->value);
-                        ITER_LLIST_END();
                     }
                 }
             }
@@ -189,6 +192,65 @@ int fcgi_read(struct sub_conn* sub_conn, uint8_t* read_buf, size_t read_buf_len)
     return -1;
 }
 
+// frames what the client sent of a streamed request body so far, as far as the FCGI server keeps up
+void fcgi_pump_stdin(struct fcgi_stream_data* extra) {
+    struct provision* body = extra->rs->request->body;
+    struct sub_conn* sub_conn = extra->sub_conn;
+    struct fcgi_frame frame;
+    frame.type = FCGI_STDIN;
+    frame.request_id = extra->request_id;
+    while (!extra->stdin_done && sub_conn->write_buffer.size < FCGI_STDIN_WINDOW) {
+        struct provision_data data;
+        data.data = NULL;
+        data.size = 0;
+        ssize_t status = body->data.stream.read(body, &data);
+        if (status == -2) {
+            return;
+        } else if (status == -1) {
+            // the client went away. stdin is ended so the application isn't left waiting for it, and the request aborted
+            frame.len = 0;
+            frame.data = NULL;
+            fcgi_writeFrame(&sub_conn->write_buffer, &frame);
+            frame.type = FCGI_ABORT_REQUEST;
+            fcgi_writeFrame(&sub_conn->write_buffer, &frame);
+            extra->stdin_done = 1;
+            return;
+        } else if (status == 0) {
+            frame.len = 0;
+            frame.data = NULL;
+            fcgi_writeFrame(&sub_conn->write_buffer, &frame);
+            extra->stdin_done = 1;
+            return;
+        }
+        if (data.size <= 0xFFFF) {
+            pxfer(body->pool, sub_conn->pool, data.data);
+            frame.len = (uint16_t) data.size;
+            frame.data = data.data;
+            fcgi_writeFrame(&sub_conn->write_buffer, &frame);
+            continue;
+        }
+        // write_buffer entries have to start their allocation
+        for (size_t offset = 0; offset < data.size; offset += frame.len) {
+            frame.len = (uint16_t) (data.size - offset > 0xFFFF ? 0xFFFF : data.size - offset);
+            frame.data = pmalloc(sub_conn->pool, frame.len);
+            memcpy(frame.data, (uint8_t*) data.data + offset, frame.len);
+            fcgi_writeFrame(&sub_conn->write_buffer, &frame);
+        }
+        pprefree(body->pool, data.data);
+    }
+}
+
+int fcgi_stdin_notify(struct request_session* rs) {
+    struct fcgi_stream_data* extra = rs->request->body->extra;
+    fcgi_pump_stdin(extra);
+    trigger_write(extra->sub_conn);
+    return extra->stdin_done;
+}
+
+void fcgi_stdin_written(struct sub_conn* sub_conn) {
+    fcgi_pump_stdin(sub_conn->extra);
+}
+
 ssize_t fcgi_provision_read(struct provision* provision, struct provision_data* buffer) {
     struct fcgi_stream_data* extra = provision->extra;
     if (extra->complete) {
@@ -267,10 +329,11 @@ struct provision* fcgi_provide_data(struct provider* provider, struct request_se
     stream_data->output = pcalloc(sub_conn->pool, sizeof(struct buffer));
     buffer_init(stream_data->output, sub_conn->pool);
     stream_data->rs = rs;
+    stream_data->sub_conn = sub_conn;
     sub_conn->extra = stream_data;
     sub_conn->read = fcgi_read;
     sub_conn->on_closed = fcgi_on_closed;
-    llist_append(rs->conn->manager->pending_sub_conns, sub_conn);
+    sub_conn_register(sub_conn);
 
     struct fcgi_frame frame;
     frame.type = FCGI_BEGIN_REQUEST;
@@ -289,9 +352,13 @@ struct provision* fcgi_provide_data(struct provider* provider, struct request_se
     hashmap_put(fcgi_params, "REQUEST_URI", rs->request->path);
     if (rs->request->body != NULL && rs->request->body->type == PROVISION_DATA) {
         hashmap_put(fcgi_params, "CONTENT_LENGTH", pprintf(fcgi_params->pool, "%lu", rs->request->body->data.data.size));
-    } else {
+    } else if (rs->request->body != NULL && rs->request->body->data.stream.known_length >= 0) {
+        hashmap_put(fcgi_params, "CONTENT_LENGTH", pprintf(fcgi_params->pool, "%li", rs->request->body->data.stream.known_length));
+    } else if (rs->request->body == NULL) {
         hashmap_put(fcgi_params, "CONTENT_LENGTH", "0");
     }
+    // a chunked body (or an h2 one without content-length) goes without CONTENT_LENGTH. this relies on the application reading
+    // stdin up to its empty record, ones that go by CONTENT_LENGTH alone see no body
     if (rs->request->body != NULL && rs->request->body->content_type != NULL) {
         hashmap_put(fcgi_params, "CONTENT_TYPE", rs->request->body->content_type);
     }
@@ -347,7 +414,7 @@ struct provision* fcgi_provide_data(struct provider* provider, struct request_se
     else {
         hashmap_put(fcgi_params, "SCRIPT_NAME", rs->request_htpath + htdocs_length + (htdocs_ends_slash ? -1 : 0));
     }
-    const char* host = header_get(rs->request->headers, "Host");
+    const char* host = header_get_id(rs->request->headers, HEADER_HOST);
     if (host != NULL) {
         hashmap_put(fcgi_params, "SERVER_NAME", (void*) host);
     }
@@ -357,9 +424,9 @@ struct provision* fcgi_provide_data(struct provider* provider, struct request_se
     hashmap_put(fcgi_params, "DOCUMENT_ROOT", htdocs->htdocs);
     hashmap_put(fcgi_params, "SCRIPT_FILENAME", rs->request_htpath);
 
-    ITER_LLIST(rs->request->headers->header_list, pre_entry) {
-        struct header_entry* entry = pre_entry;
-        if (str_eq(entry->name, "Accept-Encoding")) continue;
+    for (size_t i = 0; i < rs->request->headers->count; ++i) {
+        struct header_entry* entry = &rs->request->headers->entries[i];
+        if (entry->id == HEADER_ACCEPT_ENCODING) continue;
         size_t name_length = strlen(entry->name);
         char* nname = pmalloc(rs->pool, name_length + 6);
         memcpy(nname, "HTTP_", 5);
@@ -370,7 +437,6 @@ struct provision* fcgi_provide_data(struct provider* provider, struct request_se
             else if (nname[x] == '-') nname[x] = '_';
         }
         hashmap_put(fcgi_params, nname, (void*) entry->value);
-        ITER_LLIST_END();
     }
     ITER_MAP(fcgi_params) {
         fcgi_writeParam(&sub_conn->write_buffer, frame.request_id, str_key, (char*) value);
@@ -396,12 +462,18 @@ struct provision* fcgi_provide_data(struct provider* provider, struct request_se
                 fcgi_writeFrame(&sub_conn->write_buffer, &frame);
             }
         } else {
-            // TODO: implement once we have streaming post bodies implemented
+            // the rest follows as the client sends it
+            rs->request->body->extra = stream_data;
+            rs->request->body->data.stream.notify = fcgi_stdin_notify;
+            sub_conn->on_written = fcgi_stdin_written;
+            fcgi_pump_stdin(stream_data);
         }
     }
 
-    frame.len = 0;
-    fcgi_writeFrame(&sub_conn->write_buffer, &frame);
+    if (rs->request->body == NULL || rs->request->body->type == PROVISION_DATA) {
+        frame.len = 0;
+        fcgi_writeFrame(&sub_conn->write_buffer, &frame);
+    }
     trigger_write(sub_conn);
     if (rs->response->body != NULL) {
         rs->response->body = NULL;
@@ -416,6 +488,7 @@ struct provision* fcgi_provide_data(struct provider* provider, struct request_se
     provision->extra = stream_data;
     provision->data.stream.read = fcgi_provision_read;
     provision->data.stream.notify = rs->src_conn->notifier;
+    provision->data.stream.source = sub_conn;
     provision->data.stream.stream_fd = -1;
     provision->requested_vhost_action = VHOST_ACTION_NO_CONTENT_UPDATE;
     provision->data.stream.delay_header_output = 1;
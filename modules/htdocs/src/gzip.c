@@ -12,12 +12,12 @@
 #include <zlib.h>
 
 int should_gzip(struct request_session* rs) {
-    const char* content_encoding = header_get(rs->response->headers, "Content-Encoding");
+    const char* content_encoding = header_get_id(rs->response->headers, HEADER_CONTENT_ENCODING);
     if (content_encoding != NULL) {
         return -1;
     }
     if (rs->response->body != NULL && content_encoding == NULL && (rs->response->body->type == PROVISION_STREAM || rs->response->body->data.data.size > 1024)) {
-        return str_contains(header_get(rs->request->headers, "Accept-Encoding"), "gzip");
+        return str_contains(header_get_id(rs->request->headers, HEADER_ACCEPT_ENCODING), "gzip");
     }
     return 0;
 }
@@ -154,5 +154,6 @@ int init_gzip_stream(struct request_session* rs, struct provision* parent, struc
     provision->data.stream.extra = data;
     provision->data.stream.read = gzip_stream_read;
     provision->data.stream.notify = NULL;
+    provision->data.stream.source = parent->data.stream.source;
     return 0;
 }
\ No newline at end of file
@@ -27,17 +27,21 @@ void generateDefaultErrorPage(struct request_session* rs, const char* msg) {
 int check_cache(struct request_session* rs) {
     struct vhost* vhost = rs->vhost;
     struct scache* osc = cache_get(HTBASE(vhost)->cache, rs->request->path,
-                                   str_contains(header_get(rs->request->headers, "Accept-Encoding"), "gzip"));
+                                   str_contains(header_get_id(rs->request->headers, HEADER_ACCEPT_ENCODING), "gzip"));
     if (osc != NULL) {
         rs->response->body = osc->body;
+        rs->response->fromCache = osc;
         rs->request->add_to_cache = 1;
         rs->response->headers = osc->headers;
         rs->response->code = osc->code;
         if (rs->response->body != NULL && rs->response->body->data.data.size > 0 && rs->response->code != NULL &&
             rs->response->code[0] == '2') {
-            if (str_eq_case(osc->etag, header_get(rs->request->headers, "If-None-Match"))) {
+            if (str_eq_case(osc->etag, header_get_id(rs->request->headers, HEADER_IF_NONE_MATCH))) {
                 rs->response->code = "304 Not Modified";
                 rs->response->body = NULL;
+            } else if (str_eq(rs->response->code, "200 OK")) {
+                // the parts are sent as slices of the cached body
+                http_range_apply(rs, rs->response->body->data.data.size, osc->etag);
             }
         }
         return 1;
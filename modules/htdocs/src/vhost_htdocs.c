@@ -33,6 +33,7 @@ int handle_vhost_htdocs(struct request_session* rs) {
     rs->response->body->type = PROVISION_DATA;
 
     int isStatic = 1;
+    int ranged = 0;
     // make path relative to htdocs
     char* htpath;
     {
@@ -275,6 +276,7 @@ int handle_vhost_htdocs(struct request_session* rs) {
     } else {
         rs->response->body->content_type = content_type;
         check_client_cache(rs);
+        header_add(rs->response->headers, "Accept-Ranges", "bytes");
 
         int ffd = open(htpath, O_RDONLY);
         if (ffd < 0) {
@@ -312,12 +314,32 @@ int handle_vhost_htdocs(struct request_session* rs) {
             }
             close(ffd);
         } else {
-            phook(rs->pool, close_hook, (void*) ffd);
-            rs->response->body->type = PROVISION_STREAM;
-            rs->response->body->data.stream.stream_fd = ffd;
-            rs->response->body->data.stream.read = raw_stream_read;
-            rs->response->body->data.stream.notify = rs->src_conn->notifier;
-            rs->response->body->data.stream.known_length = len;
+            // too large to hash, so it's told apart by when it last changed and its size. If-Range still validates against it
+            struct stat st;
+            char* file_etag = NULL;
+            if (fstat(ffd, &st) == 0) {
+                file_etag = pprintf(rs->pool, "\"%lx.%lx-%lx\"", (unsigned long) st.st_mtim.tv_sec, (unsigned long) st.st_mtim.tv_nsec, (unsigned long) len);
+                header_add(rs->response->headers, "ETag", file_etag);
+            }
+            if (file_etag != NULL && str_eq_case(file_etag, header_get_id(rs->request->headers, HEADER_IF_NONE_MATCH))) {
+                close(ffd);
+                rs->response->code = "304 Not Modified";
+                rs->response->body = NULL;
+            } else if ((ranged = http_range_apply(rs, (size_t) len, file_etag)) < 0) {
+                // the 416 comes without a body
+                close(ffd);
+            } else {
+                phook(rs->pool, close_hook, (void*) ffd);
+                struct file_stream_extra* file = pcalloc(rs->response->body->pool, sizeof(struct file_stream_extra));
+                file->size = (size_t) len;
+                file->ranges = rs->response->ranges;
+                rs->response->body->type = PROVISION_STREAM;
+                rs->response->body->data.stream.stream_fd = ffd;
+                rs->response->body->data.stream.read = file_stream_read;
+                rs->response->body->data.stream.extra = file;
+                rs->response->body->data.stream.notify = rs->src_conn->notifier;
+                rs->response->body->data.stream.known_length = file->ranges == NULL ? len : (ssize_t) file->ranges->length;
+            }
         }
     }
 
@@ -348,7 +370,7 @@ int handle_vhost_htdocs(struct request_session* rs) {
         }
         etag[33] = '\"';
         header_add(rs->response->headers, "ETag", etag);
-        if (str_eq_case(etag, header_get(rs->request->headers, "If-None-Match"))) {
+        if (str_eq_case(etag, header_get_id(rs->request->headers, HEADER_IF_NONE_MATCH))) {
             cache_activated = 1;
             if (!isStatic) {
                 rs->response->code = "304 Not Modified";
@@ -378,12 +400,11 @@ int handle_vhost_htdocs(struct request_session* rs) {
     }
 
 
-    if (isStatic && htdocs->base.scacheEnabled && rs->response->body->type == PROVISION_DATA &&
+    if (isStatic && !ranged && htdocs->base.scacheEnabled && rs->response->body->type == PROVISION_DATA &&
         (htdocs->base.maxCache <= 0 || htdocs->base.maxCache < htdocs->base.cache->max_size)) {
         struct mempool* scpool = mempool_new();
         struct scache* sc = pmalloc(scpool, sizeof(struct scache));
         sc->pool = scpool;
-        pchild(htdocs->base.cache->pool, sc->pool);
         pxfer_parent(rs->pool, sc->pool, rs->response->body->pool);
         sc->body = rs->response->body;
         sc->content_encoding = do_gzip == 1 || do_gzip == -1; // done or already done
@@ -396,7 +417,8 @@ int handle_vhost_htdocs(struct request_session* rs) {
         header_setoradd(rs->response->headers, "Content-Length", rs->response->body == NULL ? "0" : l);
         pxfer_parent(rs->pool, sc->pool, rs->response->headers->pool);
         sc->headers = rs->response->headers;
-        sc->request_path = pxfer(rs->pool, sc->pool, rs->request->path);
+        // the path points into the request head, which goes with rs->pool
+        sc->request_path = str_dup(rs->request->path, 0, sc->pool);
         if (!has_etag) {
             if (rs->response->body == NULL) {
                 etag[0] = '\"';
@@ -418,6 +440,7 @@ int handle_vhost_htdocs(struct request_session* rs) {
             }
         }
         memcpy(sc->etag, etag, 35);
+        has_etag = 1;
         cache_add(htdocs->base.cache, sc);
         rs->response->fromCache = sc;
         rs->request->add_to_cache = 1;
@@ -426,6 +449,10 @@ int handle_vhost_htdocs(struct request_session* rs) {
             rs->response->code = "304 Not Modified";
         }
     }
+    // after caching, which keeps the whole body and its headers
+    if (isStatic && !ranged && rs->response->body != NULL && rs->response->body->type == PROVISION_DATA && str_eq(rs->response->code, "200 OK")) {
+        http_range_apply(rs, rs->response->body->data.data.size, has_etag ? etag : NULL);
+    }
     return rs->response->body == NULL ? VHOST_ACTION_NONE : rs->response->body->requested_vhost_action;
 }
 
@@ -519,5 +546,6 @@ void initialize(struct module* module) {
     vhost_type->handle_request = handle_vhost_htdocs;
     vhost_type->load_config = htdocs_parse_config;
     vhost_type->name = "htdocs";
+    vhost_type->stream_post = 1; // fcgi pumps it to the backend as it arrives
     hashmap_put(registered_vhost_types, "htdocs", vhost_type);
 }
\ No newline at end of file
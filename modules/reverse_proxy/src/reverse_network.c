@@ -7,6 +7,7 @@
 #include <avuna/http.h>
 #include <avuna/connection.h>
 #include <avuna/network.h>
+#include <avuna/http_scan.h>
 #include <stdint.h>
 #include <stdlib.h>
 
@@ -17,7 +18,7 @@ void http_client_on_closed(struct sub_conn* sub_conn) {
 
 int handle_http_client_read(struct sub_conn* sub_conn, uint8_t* read_buf, size_t read_buf_len) {
     struct http_client_extra* extra = sub_conn->extra;
-    buffer_push(&sub_conn->read_buffer, read_buf, read_buf_len);
+    sub_conn_keep(sub_conn, read_buf, read_buf_len);
     restart:;
 
     if (extra->currently_forwarding != NULL) {
@@ -146,9 +147,6 @@ int handle_http_client_read(struct sub_conn* sub_conn, uint8_t* read_buf, size_t
         if (!se) goto pc;
     }*/
 
-    size_t match_length = 0;
-    static unsigned char newlines[4] = {0x0D, 0x0A, 0x0D, 0x0A};
-
     // shrink read_buf if it was part header
     if (sub_conn->read_buffer.size < read_buf_len) {
         size_t shrink = read_buf_len - sub_conn->read_buffer.size;
@@ -160,76 +158,43 @@ int handle_http_client_read(struct sub_conn* sub_conn, uint8_t* read_buf, size_t
         return 0;
     }
 
-    // prepare match_length from previous buffer
-    struct llist_node* read_tail = sub_conn->read_buffer.buffers->tail;
-    if (read_tail != NULL) {
-        struct buffer_entry* entry = read_tail->data;
-        if (entry->data == read_buf) {
-            if (read_tail->prev == NULL) { // could be popped above
-                goto post_precheck;
-            }
-            entry = read_tail->prev->data;
-        }
-        ssize_t checking_index = entry->size - 3;
-        if (checking_index < 0)
-            checking_index = 0;
-        for (; checking_index < entry->size; ++checking_index) {
-            char c = ((char*) entry->data)[checking_index];
-            if (c == newlines[match_length]) {
-                match_length++;
-                if (match_length == 4) {
-                    errlog(sub_conn->conn->server->logsess, "Invalid state! This should never happen.");
-                }
-            } else if (c == newlines[0])
-                match_length = 1;
-            else
-                match_length = 0;
-        }
-    }
-    post_precheck:;
+    int scan_state = http_scan_resume(&sub_conn->read_buffer, read_buf);
 
     // match double new line
-    for (size_t checking_index = 0; checking_index < read_buf_len; ++checking_index) {
-        char c = read_buf[checking_index];
-        if (c == newlines[match_length]) {
-            match_length++;
-            if (match_length == 4) {
-                struct request_session* rs = queue_peek(extra->forwarding_sessions);
-                size_t req_size = sub_conn->read_buffer.size + checking_index + 1 - read_buf_len;
-                unsigned char* request_headers = pmalloc(rs->pool, req_size + 1);
-                buffer_pop(&sub_conn->read_buffer, req_size, request_headers);
-                request_headers[req_size] = 0;
-
-                struct timespec stt;
-                clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &stt);
-
-                if (parseResponse(rs, sub_conn, (char*) request_headers) < 0) {
-                    errlog(sub_conn->conn->server->logsess, "Malformed Response!");
-                    sub_conn->on_closed(sub_conn);
-                    return 1;
-                }
-                if (rs->response->body != NULL) {
-                    rs->response->body->content_type = header_get(rs->response->headers, "Content-Type");
-                }
-                send_request_session_http11(rs, &stt);
-                if (rs->response->body != NULL) {
-                    if (rs->response->body->type == PROVISION_DATA) {
-                        pxfer(rs->response->body->pool, sub_conn->pool, rs->response->body->data.data.data);
-                        buffer_push(&rs->src_conn->write_buffer, rs->response->body->data.data.data, rs->response->body->data.data.size);
-                        trigger_write(rs->src_conn);
-                    } else {
-                        extra->currently_forwarding = rs;
-                        goto restart;
-                    }
-                }
-                queue_pop(extra->forwarding_sessions);
-                pfree(rs->pool);
+    size_t scanned = 0;
+    ssize_t headers_end;
+    while (scanned < read_buf_len && (headers_end = http_scan_headers_end(read_buf + scanned, read_buf_len - scanned, &scan_state)) >= 0) {
+        scanned += headers_end;
+        struct request_session* rs = queue_peek(extra->forwarding_sessions);
+        size_t req_size = sub_conn->read_buffer.size + scanned - read_buf_len;
+        unsigned char* request_headers = pmalloc(rs->pool, req_size + 1);
+        buffer_pop(&sub_conn->read_buffer, req_size, request_headers);
+        request_headers[req_size] = 0;
+
+        struct timespec stt;
+        clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &stt);
+
+        if (parseResponse(rs, sub_conn, (char*) request_headers) < 0) {
+            errlog(sub_conn->conn->server->logsess, "Malformed Response!");
+            sub_conn->on_closed(sub_conn);
+            return 1;
+        }
+        if (rs->response->body != NULL) {
+            rs->response->body->content_type = header_get(rs->response->headers, "Content-Type");
+        }
+        send_request_session_http11(rs, &stt);
+        if (rs->response->body != NULL) {
+            if (rs->response->body->type == PROVISION_DATA) {
+                pxfer(rs->response->body->pool, sub_conn->pool, rs->response->body->data.data.data);
+                buffer_push(&rs->src_conn->write_buffer, rs->response->body->data.data.data, rs->response->body->data.data.size);
+                trigger_write(rs->src_conn);
+            } else {
+                extra->currently_forwarding = rs;
+                goto restart;
             }
-        } else if (c == newlines[0]) {
-            match_length = 1;
-        } else {
-            match_length = 0;
         }
+        queue_pop(extra->forwarding_sessions);
+        pfree(rs->pool);
     }
     return 0;
 }
\ No newline at end of file
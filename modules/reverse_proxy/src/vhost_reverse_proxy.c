@@ -21,6 +21,7 @@
 
 struct vhost_conn_extra {
     struct sub_conn* forward_connection;
+    int forward_registered; // once its first fd connected
     struct queue* forward_queue;
 };
 
@@ -82,7 +83,6 @@ int handle_vhost_reverse_proxy(struct request_session* rs) {
         sub_conn->fd = -1;
         sub_conn->read = handle_http_client_read;
         sub_conn->on_closed = http_client_on_closed;
-        llist_append(rs->conn->manager->pending_sub_conns, sub_conn);
         //todo: TLS?
     }
     init_forward_connection:;
@@ -99,6 +99,10 @@ int handle_vhost_reverse_proxy(struct request_session* rs) {
             goto return_error;
         }
         phook(extra->forward_connection->pool, close_hook, (void*) extra->forward_connection->fd);
+        if (!extra->forward_registered) {
+            sub_conn_register(extra->forward_connection);
+            extra->forward_registered = 1;
+        }
     }
 
     size_t sreql = 0;
@@ -4,7 +4,12 @@
  *  Created on: Nov 18, 2015
  *      Author: root
  */
+
+#define _GNU_SOURCE // accept4
+
 #include "accept.h"
+#include "dispatch.h"
+#include "stats.h"
 #include "http_network.h"
 #include "http2_network.h"
 #include "http_pipeline.h"
@@ -20,6 +25,8 @@
 #include <netinet/tcp.h>
 #include <fcntl.h>
 #include <poll.h>
+#include <unistd.h>
+#include <sys/socket.h>
 
 int accept_sni_callback(SSL* ssl, int* ad, struct accept_param* param) {
     if (ssl == NULL || param == NULL) return SSL_TLSEXT_ERR_NOACK;
@@ -50,12 +57,55 @@ int accept_sni_callback(SSL* ssl, int* ad, struct accept_param* param) {
     return SSL_TLSEXT_ERR_OK;
 }
 
+// closes the fd itself, so the close_notify goes out before it's gone
 void shutdown_ssl_hook(SSL* ssl) {
+    int fd = SSL_get_fd(ssl);
     SSL_shutdown(ssl);
     SSL_free(ssl);
+    close(fd);
+}
+
+const char overload_response[] = "HTTP/1.1 503 Service Unavailable\r\nConnection: close\r\nContent-Length: 0\r\nRetry-After: 1\r\n\r\n";
+
+// reserves a slot against both the binding and server limits, returns 0 if either is full
+int accept_admit(struct server_binding* binding, struct server_info* server) {
+    size_t binding_conns = __atomic_add_fetch(&binding->live_conns, 1, __ATOMIC_RELAXED);
+    size_t server_conns = __atomic_add_fetch(&server->live_conns, 1, __ATOMIC_RELAXED);
+    if ((binding->conn_limit > 0 && binding_conns > binding->conn_limit) || (server->conn_limit > 0 && server_conns > server->conn_limit)) {
+        __atomic_sub_fetch(&binding->live_conns, 1, __ATOMIC_RELAXED);
+        __atomic_sub_fetch(&server->live_conns, 1, __ATOMIC_RELAXED);
+        return 0;
+    }
+    return 1;
+}
+
+void accept_release(struct server_binding* binding, struct server_info* server) {
+    __atomic_sub_fetch(&binding->live_conns, 1, __ATOMIC_RELAXED);
+    __atomic_sub_fetch(&server->live_conns, 1, __ATOMIC_RELAXED);
+}
+
+void accept_turn_away(struct accept_param* param, int fd) {
+    ++param->rejected;
+    if (param->binding->mode & (BINDING_MODE_HTTPS | BINDING_MODE_HTTP2_ONLY)) {
+        // no cheap way to say anything, so reset
+        struct linger linger;
+        linger.l_onoff = 1;
+        linger.l_linger = 0;
+        setsockopt(fd, SOL_SOCKET, SO_LINGER, &linger, sizeof(linger));
+    } else {
+        send(fd, overload_response, sizeof(overload_response) - 1, MSG_DONTWAIT | MSG_NOSIGNAL);
+        shutdown(fd, SHUT_WR);
+    }
+}
+
+// turns away a connection without building a conn for it
+void accept_reject(struct accept_param* param, int fd) {
+    accept_turn_away(param, fd);
+    close(fd);
 }
 
 void conn_disconnect_handler(struct conn* conn) {
+    accept_release(conn->incoming_binding, conn->server);
     ITER_LLIST(loaded_modules, value) {
         struct module* module = value;
         if (module->events.on_disconnect) {
@@ -97,15 +147,10 @@ int alpn_select_callback (SSL* ssl,
     return 0;
 }
 
-void run_accept(struct accept_param* param) {
-    struct mempool* accept_pool = mempool_new();
-    struct pollfd spfd;
-    spfd.events = POLLIN;
-    spfd.revents = 0;
-    spfd.fd = param->binding->fd;
+void accept_init_binding(struct accept_param* param) {
     int ssl = (param->binding->mode & BINDING_MODE_HTTPS) != 0;
     if (ssl && param->binding->ssl_cert == NULL) {
-        param->binding->ssl_cert = pclaim(param->binding->pool, dummyCert(accept_pool));
+        param->binding->ssl_cert = dummyCert(param->binding->pool);
     }
     int http2 = param->binding->mode & BINDING_MODE_HTTP2_ONLY;
     if (ssl) {
@@ -115,109 +160,170 @@ void run_accept(struct accept_param* param) {
             SSL_CTX_set_alpn_select_cb(param->binding->ssl_cert->ctx, alpn_select_callback, NULL);
         }
     }
+}
+
+// a client's conn, its sub_conn and the protocol's state live and die together, so they're one allocation in one pool
+struct client_conn {
+    struct conn conn;
+    struct sub_conn sub_conn;
+    union {
+        struct http_server_extra http;
+        struct http2_server_extra http2;
+    } extra;
+};
+
+struct conn* accept_conn(struct accept_param* param, int fd, struct sockaddr_in6* addr) {
+    int ssl = (param->binding->mode & BINDING_MODE_HTTPS) != 0;
+    int http2 = param->binding->mode & BINDING_MODE_HTTP2_ONLY;
+    struct mempool* pool = mempool_new();
+    struct client_conn* client = pcalloc(pool, sizeof(struct client_conn));
+    struct conn* conn = &client->conn;
+    conn->manager = NULL;
+    conn->pool = pool;
+    conn->incoming_binding = param->binding;
+    conn->sub_conns = llist_new(pool);
+    conn->server = param->server;
+    memcpy(&conn->addr.tcp6, addr, sizeof(struct sockaddr_in6));
+    // only backend sub_conns get pools of their own, they come and go while the conn stays
+    struct sub_conn* sub_conn = &client->sub_conn;
+    sub_conn->pool = pool;
+    sub_conn->fd = fd;
+    if (!ssl) {
+        phook(pool, close_hook, (void*) fd);
+    }
+    sub_conn->read = http2 ? handle_http2_server_read : handle_http_server_read;
+    if (http2) {
+        struct http2_server_extra* extra = sub_conn->extra = &client->extra.http2;
+        extra->other_min_next_stream = 3;
+        extra->streams = hashmap_new(32, sub_conn->pool);
+        extra->our_max_frame_size = 65536;
+        extra->other_max_frame_size = 65536;
+        extra->frame_buffer = NULL; // acquired on preface, see handle_http2_server_read
+        extra->our_next_stream = 2;
+        extra->remote_idle_streams = llist_new(sub_conn->pool);
+        extra->send_hpack_ctx = hpack_init(sub_conn->pool, 4096);
+        extra->recv_hpack_ctx = hpack_init(sub_conn->pool, 4096);
+        sub_conn->notifier = http2_stream_notify;
+        sub_conn->refresh_timeout = http2_refresh_timeout;
+    } else {
+        sub_conn->extra = &client->extra.http;
+        sub_conn->notifier = http_stream_notify;
+        sub_conn->on_written = http_pull_stream;
+        sub_conn->refresh_timeout = http_refresh_timeout;
+    }
+    sub_conn->conn = conn;
+    sub_conn->on_closed = http_on_closed;
+    buffer_init(&sub_conn->read_buffer, sub_conn->pool);
+    buffer_init(&sub_conn->write_buffer, sub_conn->pool);
+    llist_append(conn->sub_conns, sub_conn);
+
+    sub_conn->tls = ssl;
+    sub_conn->tls_state = TLS_STATE_NONE;
+    if (ssl) {
+        // the handshake itself is left to the worker, see work_tls_handshake
+        sub_conn->tls_session = SSL_new(param->binding->ssl_cert->ctx);
+        if (sub_conn->tls_session == NULL) {
+            phook(pool, close_hook, (void*) fd);
+            pfree(pool);
+            return NULL;
+        }
+        SSL_set_fd(sub_conn->tls_session, sub_conn->fd);
+        phook(conn->pool, shutdown_ssl_hook, sub_conn->tls_session);
+#ifdef SSL_OP_ENABLE_KTLS
+        // hands the record layer to the kernel once the handshake is done, where both the kernel and the negotiated cipher allow
+        SSL_set_options(sub_conn->tls_session, SSL_OP_ENABLE_KTLS);
+#endif
+        SSL_set_mode(sub_conn->tls_session, SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER | SSL_MODE_ENABLE_PARTIAL_WRITE);
+        SSL_set_accept_state(sub_conn->tls_session);
+        sub_conn->tls_state = TLS_STATE_HANDSHAKE;
+        clock_gettime(CLOCK_MONOTONIC, &sub_conn->tls_handshake_start);
+    }
+
+    ITER_LLIST(loaded_modules, value) {
+        struct module* module = value;
+        if (module->events.on_connect && module->events.on_connect(module, conn)) {
+            pfree(conn->pool);
+            return NULL;
+        }
+        ITER_LLIST_END();
+    }
+
+    phook(pool, (void (*)(void*)) conn_disconnect_handler, conn);
+    return conn;
+}
+
+void accept_busy_poll(struct accept_param* param, int fd) {
+    int busy_poll = (int) param->server->busy_poll;
+    int one = 1;
+    if (setsockopt(fd, SOL_SOCKET, SO_BUSY_POLL, &busy_poll, sizeof(busy_poll))
+#ifdef SO_PREFER_BUSY_POLL
+        || setsockopt(fd, SOL_SOCKET, SO_PREFER_BUSY_POLL, &one, sizeof(one))
+#endif
+        ) {
+        if (!param->busy_poll_failed) {
+            errlog(param->server->logsess, "Failed to enable busy polling for binding: %s, %s", param->binding->name, strerror(errno));
+            param->busy_poll_failed = 1;
+        }
+    }
+}
+
+struct conn* accept_admitted(struct accept_param* param, int fd, struct sockaddr_in6* addr) {
+    ++param->accepted;
+    if (!accept_admit(param->binding, param->server)) {
+        accept_reject(param, fd);
+        return NULL;
+    }
+    if (param->server->busy_poll > 0 && param->binding->binding_type != BINDING_UNIX && !param->busy_poll_failed) {
+        accept_busy_poll(param, fd);
+    }
+    struct conn* conn = accept_conn(param, fd, addr);
+    if (conn == NULL) {
+        // the disconnect handler is hooked last, so it never ran for a rejected conn
+        accept_release(param->binding, param->server);
+    }
+    return conn;
+}
+
+void accept_drain(struct accept_param* param, void (*on_conn)(void* arg, struct conn* conn), void* arg) {
     while (1) {
-        struct mempool* pool = mempool_new();
-        struct conn* conn = pcalloc(pool, sizeof(struct conn));
-        conn->manager = NULL;
-        conn->pool = pool;
-        conn->incoming_binding = param->binding;
-        conn->sub_conns = llist_new(pool);
-        conn->server = param->server;
-        pool = mempool_new();
-        pchild(conn->pool, pool);
-        struct sub_conn* sub_conn = pcalloc(pool, sizeof(struct sub_conn));
-        sub_conn->pool = pool;
-        sub_conn->read = http2 ? handle_http2_server_read : handle_http_server_read;
-        if (http2) {
-            struct http2_server_extra* extra = sub_conn->extra = pcalloc(sub_conn->pool, sizeof(struct http2_server_extra));
-            extra->other_min_next_stream = 3;
-            extra->streams = hashmap_new(32, sub_conn->pool);
-            extra->our_max_frame_size = 65536;
-            extra->other_max_frame_size = 65536;
-            extra->frame_buffer = pmalloc(sub_conn->pool, 65536 + 9);
-            extra->our_next_stream = 2;
-            extra->remote_idle_streams = llist_new(sub_conn->pool);
-            extra->send_hpack_ctx = hpack_init(sub_conn->pool, 4096);
-            extra->recv_hpack_ctx = hpack_init(sub_conn->pool, 4096);
-            sub_conn->notifier = http2_stream_notify;
-        } else {
-            sub_conn->extra = pcalloc(sub_conn->pool, sizeof(struct http_server_extra));
-            sub_conn->notifier = http_stream_notify;
+        struct sockaddr_in6 addr;
+        socklen_t addr_len = sizeof(struct sockaddr_in6);
+        // timeouts and TCP_NODELAY are inherited from the listening socket, so the client fd needs no further setup
+        int cfd = accept4(param->fd, (struct sockaddr*) &addr, &addr_len, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (cfd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) {
+                continue;
+            } else if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                errlog(param->server->logsess, "Error while accepting client: %s", strerror(errno));
+            }
+            return;
         }
-        sub_conn->conn = conn;
-        sub_conn->on_closed = http_on_closed;
-        buffer_init(&sub_conn->read_buffer, sub_conn->pool);
-        buffer_init(&sub_conn->write_buffer, sub_conn->pool);
-        llist_append(conn->sub_conns, sub_conn);
-
-        sub_conn->tls = ssl;
-        if (ssl) {
-            sub_conn->tls_session = SSL_new(param->binding->ssl_cert->ctx);
-            phook(conn->pool, shutdown_ssl_hook, sub_conn->tls_session);
-            SSL_set_mode(sub_conn->tls_session, SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER | SSL_MODE_ENABLE_PARTIAL_WRITE);
-            SSL_set_accept_state(sub_conn->tls_session);
+        struct conn* conn = accept_admitted(param, cfd, &addr);
+        if (conn == NULL) {
+            continue;
         }
+        on_conn(arg, conn);
+    }
+}
 
+void run_accept(struct accept_param* param) {
+    struct pollfd spfd;
+    spfd.events = POLLIN;
+    spfd.revents = 0;
+    spfd.fd = param->fd;
+    accept_init_binding(param);
+    param->dispatch_seed = (unsigned int) monotonic_ns();
+    while (1) {
         if (poll(&spfd, 1, -1) < 0) {
             errlog(param->server->logsess, "Error while polling server: %s", strerror(errno));
-            pfree(pool);
             continue;
         }
         if ((spfd.revents ^ POLLIN) != 0) {
             errlog(param->server->logsess, "Error after polling server: %i (poll revents)!",
                    spfd.revents);
-            pfree(pool);
             break;
         }
         spfd.revents = 0;
-        socklen_t temp = sizeof(struct sockaddr_in6);
-        int cfd = accept(param->binding->fd, (struct sockaddr*) &conn->addr.tcp6, &temp);
-        if (cfd < 0) {
-            if (errno == EAGAIN) continue;
-            errlog(param->server->logsess, "Error while accepting client: %s", strerror(errno));
-            pfree(pool);
-            continue;
-        }
-        sub_conn->fd = cfd;
-        phook(pool, close_hook, (void*) cfd);
-        if (configure_fd(param->server->logsess, cfd, param->binding->binding_type != BINDING_UNIX)) {
-            pfree(pool);
-            continue;
-        }
-        if (ssl) {
-            SSL_set_fd(sub_conn->tls_session, sub_conn->fd);
-            int r = SSL_accept(sub_conn->tls_session);
-            if (r == 1) {
-                sub_conn->tls_handshaked = 1;
-            } else if (r == 2) {
-                pfree(pool);
-                continue;
-            } else {
-                int err = SSL_get_error(sub_conn->tls_session, r);
-                if (err != SSL_ERROR_WANT_READ && err != SSL_ERROR_WANT_WRITE) {
-                    pfree(pool);
-                    continue;
-                }
-            }
-        }
-        if (ssl && param->binding->ssl_cert->isDummy &&
-            SSL_get_SSL_CTX(sub_conn->tls_session) == param->binding->ssl_cert->ctx) {
-            pfree(pool);
-            continue;
-        }
-
-        ITER_LLIST(loaded_modules, value) {
-            struct module* module = value;
-            if (module->events.on_connect && module->events.on_connect(module, conn)) {
-                pfree(pool);
-                break;
-            }
-            ITER_LLIST_END();
-        }
-
-        phook(pool, (void (*)(void*)) conn_disconnect_handler, conn);
-
-        queue_push(param->server->prepared_connections, conn);
+        accept_drain(param, (void (*)(void*, struct conn*)) dispatch_conn, param);
     }
-    pfree(accept_pool);
 }
@@ -9,12 +9,36 @@
 #define ACCEPT_H_
 
 #include <avuna/server.h>
+#include <avuna/connection.h>
+#include <avuna/list.h>
+#include <netinet/in.h>
+#include <stdint.h>
 
 struct accept_param {
     struct server_info* server;
     struct server_binding* binding;
+    int fd; // listening socket, binding->fd unless this is a per-worker reuseport socket
+    uint64_t accepted;
+    uint64_t rejected; // over the binding or server conn_limit, or with every worker's handoff ring full
+    struct list* works; // struct work_param*, ACCEPT_MODE_THREAD only
+    size_t dispatch_counter;
+    unsigned int dispatch_seed;
+    int busy_poll_failed; // logged once, busy polling needs CAP_NET_ADMIN past net.core.busy_read
 };
 
+void accept_init_binding(struct accept_param* param);
+
+// answers a connection that is dropped right after with a 503, or resets it where nothing can be said cheaply (TLS, h2). counted as rejected, fd stays open
+void accept_turn_away(struct accept_param* param, int fd);
+
+// takes ownership of fd, returns NULL if the connection was rejected
+struct conn* accept_conn(struct accept_param* param, int fd, struct sockaddr_in6* addr);
+
+// accept_conn behind the binding and server connection limits, for sockets accepted by other means than accept_drain
+struct conn* accept_admitted(struct accept_param* param, int fd, struct sockaddr_in6* addr);
+
+// accepts until the listening socket would block, handing every admitted connection to on_conn
+void accept_drain(struct accept_param* param, void (*on_conn)(void* arg, struct conn* conn), void* arg);
 
 void run_accept(struct accept_param* param);
 
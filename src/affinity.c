@@ -0,0 +1,82 @@
+#define _GNU_SOURCE // CPU_SETSIZE
+
+#include "affinity.h"
+#include <avuna/string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sched.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/mempolicy.h>
+
+// every core's first hyperthread, so workers don't share execution units
+static struct list* physical_cores(struct mempool* pool) {
+    struct list* cpus = list_new(16, pool);
+    long cpu_count = sysconf(_SC_NPROCESSORS_CONF);
+    for (long cpu = 0; cpu < cpu_count; ++cpu) {
+        char path[128];
+        snprintf(path, 128, "/sys/devices/system/cpu/cpu%li/topology/thread_siblings_list", cpu);
+        FILE* file = fopen(path, "r");
+        if (file == NULL) {
+            continue;
+        }
+        long first_sibling = -1;
+        if (fscanf(file, "%li", &first_sibling) != 1) {
+            first_sibling = -1;
+        }
+        fclose(file);
+        if (first_sibling == cpu) {
+            list_append(cpus, (void*) (size_t) cpu);
+        }
+    }
+    return cpus;
+}
+
+struct list* affinity_parse(const char* spec, struct mempool* pool) {
+    if (str_eq_case(spec, "physical-cores")) {
+        struct list* cpus = physical_cores(pool);
+        return cpus->count == 0 ? NULL : cpus;
+    }
+    struct list* cpus = list_new(16, pool);
+    struct list* ranges = list_new(16, pool);
+    char spec_dup[strlen(spec) + 1];
+    strcpy(spec_dup, spec);
+    str_split(spec_dup, ",", ranges);
+    for (size_t i = 0; i < ranges->count; ++i) {
+        char* range = str_trim(ranges->data[i]);
+        char* dash = strchr(range, '-');
+        if (dash != NULL) {
+            *dash = 0;
+        }
+        char* last = dash == NULL ? range : str_trim(dash + 1);
+        if (!str_isunum(range) || !str_isunum(last)) {
+            return NULL;
+        }
+        size_t start = strtoul(range, NULL, 10);
+        size_t end = strtoul(last, NULL, 10);
+        if (end < start || end >= CPU_SETSIZE) {
+            return NULL;
+        }
+        for (size_t cpu = start; cpu <= end; ++cpu) {
+            list_append(cpus, (void*) cpu);
+        }
+    }
+    return cpus->count == 0 ? NULL : cpus;
+}
+
+int affinity_pin_attr(pthread_attr_t* attr, size_t cpu) {
+    if (cpu >= CPU_SETSIZE) {
+        return EINVAL;
+    }
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    CPU_SET(cpu, &cpus);
+    return pthread_attr_setaffinity_np(attr, sizeof(cpu_set_t), &cpus);
+}
+
+int affinity_bind_memory_local() {
+    // no libnuma, the raw syscall is all we need
+    return (int) syscall(SYS_set_mempolicy, MPOL_LOCAL, NULL, 0);
+}
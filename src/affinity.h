@@ -0,0 +1,17 @@
+#ifndef AVUNA_HTTPD_AFFINITY_H
+#define AVUNA_HTTPD_AFFINITY_H
+
+#include <avuna/pmem.h>
+#include <avuna/list.h>
+#include <pthread.h>
+
+// parses "physical-cores" or a cpu list like "0-3,8,10" into a list of (size_t) cpu ids, NULL if invalid
+struct list* affinity_parse(const char* spec, struct mempool* pool);
+
+// threads created with attr start on cpu alone. 0 or the pthread error, the thread would otherwise run unpinned
+int affinity_pin_attr(pthread_attr_t* attr, size_t cpu);
+
+// restricts the calling thread's future page allocations to its local NUMA node
+int affinity_bind_memory_local();
+
+#endif //AVUNA_HTTPD_AFFINITY_H
@@ -44,6 +44,18 @@ void cache_add(struct cache* cache, struct scache* scache) {
         hashmap_put(cache->entries, scache->request_path, local_list);
     }
     list_append(local_list, scache);
+    scache->refs = 1;
+    phook(cache->pool, (void (*)(void*)) cache_unref, scache);
     pthread_rwlock_unlock(&cache->scachelock);
 }
 
+void cache_ref(struct scache* scache) {
+    __atomic_add_fetch(&scache->refs, 1, __ATOMIC_RELAXED);
+}
+
+void cache_unref(struct scache* scache) {
+    if (__atomic_sub_fetch(&scache->refs, 1, __ATOMIC_ACQ_REL) == 0) {
+        pfree(scache->pool);
+    }
+}
+
@@ -2,9 +2,11 @@
 // Created by p on 4/2/19.
 //
 
+#include <avuna/chunked.h>
 #include <avuna/http.h>
 #include <avuna/pmem.h>
 #include <avuna/globals.h>
+#include <string.h>
 
 
 struct chunked_stream_data {
@@ -35,12 +37,15 @@ ssize_t chunked_stream_read(struct provision* provision, struct provision_data*
 
     int size_len = snprintf(size_str, 128, "%lX\r\n", output.size);
 
-    uint8_t* new_data = pmalloc(provision->pool, (size_t) (read + size_len + 2));
+    // a parent ending with data still needs the last chunk behind it
+    size_t last_len = read == 0 && output.size > 0 ? 5 : 0;
+    uint8_t* new_data = pmalloc(provision->pool, (size_t) size_len + output.size + 2 + last_len);
     memcpy(new_data, size_str, (size_t) size_len);
     memcpy(new_data + size_len, output.data, output.size);
     memcpy(new_data + size_len + output.size, "\r\n", 2);
+    memcpy(new_data + size_len + output.size + 2, "0\r\n\r\n", last_len);
     buffer->data = new_data;
-    buffer->size = (size_t) (size_len + output.size + 2);
+    buffer->size = (size_t) size_len + output.size + 2 + last_len;
     return read == 0 ? 0 : buffer->size;
 }
 
@@ -52,5 +57,137 @@ int init_chunked_stream(struct request_session* rs, struct provision* parent, st
     provision->data.stream.extra = data;
     provision->data.stream.read = chunked_stream_read;
     provision->data.stream.notify = NULL;
+    provision->data.stream.source = parent->data.stream.source;
     return 0;
-}
\ No newline at end of file
+}
+
+// a hex digit's value plus one, 0 for anything else
+static const uint8_t hex_digits[256] = {
+    ['0'] = 1, ['1'] = 2, ['2'] = 3, ['3'] = 4, ['4'] = 5, ['5'] = 6, ['6'] = 7, ['7'] = 8, ['8'] = 9, ['9'] = 10,
+    ['a'] = 11, ['b'] = 12, ['c'] = 13, ['d'] = 14, ['e'] = 15, ['f'] = 16,
+    ['A'] = 11, ['B'] = 12, ['C'] = 13, ['D'] = 14, ['E'] = 15, ['F'] = 16,
+};
+
+// drops used bytes from the front of in's head entry
+static void chunked_consume(struct buffer* in, struct llist_node* node, size_t used) {
+    struct buffer_entry* entry = node->data;
+    entry->data = (uint8_t*) entry->data + used;
+    entry->size -= used;
+    in->size -= used;
+    if (entry->size == 0) {
+        pprefree_strict(in->pool, entry->data_root);
+        llist_del(in->buffers, node);
+    }
+}
+
+// hands size bytes of chunk data from the front of in's head entry on to out
+static void chunked_emit(struct buffer* in, struct llist_node* node, size_t size, struct buffer* out) {
+    struct buffer_entry* entry = node->data;
+    if (out == NULL) {
+        chunked_consume(in, node, size);
+        return;
+    }
+    if (size < entry->size) {
+        uint8_t* copy = pmalloc(out->pool, size);
+        memcpy(copy, entry->data, size);
+        buffer_push(out, copy, size);
+        chunked_consume(in, node, size);
+        return;
+    }
+    // the rest of the entry is all data, so its allocation changes hands as it is
+    if (in->pool != out->pool) {
+        pxfer(in->pool, out->pool, entry->data_root);
+    }
+    buffer_push(out, entry->data, size);
+    ((struct buffer_entry*) out->buffers->tail->data)->data_root = entry->data_root;
+    in->size -= size;
+    llist_del(in->buffers, node);
+}
+
+int chunked_decode(struct chunked_decoder* decoder, struct buffer* in, struct buffer* out) {
+    while (decoder->state != CHUNKED_DONE) {
+        struct llist_node* node = in->buffers->head;
+        if (node == NULL) {
+            return 0;
+        }
+        struct buffer_entry* entry = node->data;
+        if (entry->size == 0) {
+            chunked_consume(in, node, 0);
+            continue;
+        }
+        uint8_t* data = entry->data;
+        size_t used = 0;
+        switch (decoder->state) {
+            case CHUNKED_SIZE:
+                for (; used < entry->size && hex_digits[data[used]] != 0; ++used) {
+                    if (++decoder->digits > 15) {
+                        return -1;
+                    }
+                    decoder->remaining = (decoder->remaining << 4) | (size_t) (hex_digits[data[used]] - 1);
+                }
+                if (used < entry->size) {
+                    if (decoder->digits == 0) {
+                        return -1;
+                    }
+                    decoder->state = CHUNKED_EXTENSION;
+                }
+                break;
+            case CHUNKED_EXTENSION:
+            case CHUNKED_TRAILER_LINE: {
+                // memchr is vectorised by libc, these lines are skipped rather than parsed
+                uint8_t* lf = memchr(data, '\n', entry->size);
+                used = lf == NULL ? entry->size : (size_t) (lf - data) + 1;
+                decoder->line_length += used;
+                if (decoder->line_length > CHUNKED_MAX_LINE) {
+                    return -1;
+                }
+                if (lf != NULL) {
+                    if (decoder->state == CHUNKED_TRAILER_LINE) {
+                        decoder->state = CHUNKED_TRAILER;
+                    } else {
+                        decoder->state = decoder->remaining == 0 ? CHUNKED_TRAILER : CHUNKED_DATA;
+                    }
+                }
+                break;
+            }
+            case CHUNKED_DATA: {
+                size_t size = entry->size < decoder->remaining ? entry->size : decoder->remaining;
+                chunked_emit(in, node, size, out);
+                decoder->remaining -= size;
+                if (decoder->remaining == 0) {
+                    decoder->state = CHUNKED_DATA_CR;
+                }
+                continue;
+            }
+            case CHUNKED_DATA_CR:
+            case CHUNKED_DATA_LF:
+                if (data[0] == '\r' && decoder->state == CHUNKED_DATA_CR) {
+                    decoder->state = CHUNKED_DATA_LF;
+                } else if (data[0] == '\n') {
+                    decoder->state = CHUNKED_SIZE;
+                    decoder->digits = 0;
+                    decoder->line_length = 0;
+                } else {
+                    return -1;
+                }
+                used = 1;
+                break;
+            case CHUNKED_TRAILER:
+            case CHUNKED_TRAILER_LF:
+                if (data[0] == '\r' && decoder->state == CHUNKED_TRAILER) {
+                    decoder->state = CHUNKED_TRAILER_LF;
+                    used = 1;
+                } else if (data[0] == '\n') {
+                    decoder->state = CHUNKED_DONE;
+                    used = 1;
+                } else if (decoder->state == CHUNKED_TRAILER) {
+                    decoder->state = CHUNKED_TRAILER_LINE;
+                } else {
+                    return -1;
+                }
+                break;
+        }
+        chunked_consume(in, node, used);
+    }
+    return 1;
+}
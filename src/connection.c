@@ -27,4 +27,28 @@ int configure_fd(struct logsess* logger, int fd, int is_tcp) {
         return 1;
     }
     return 0;
-}
\ No newline at end of file
+}
+
+void sub_conn_timed_out(struct sub_conn* sub_conn) {
+    ++sub_conn->conn->manager->timeouts[sub_conn->timeout_phase];
+    sub_conn->on_closed(sub_conn);
+}
+
+void sub_conn_set_timeout(struct sub_conn* sub_conn, int phase) {
+    if (phase == TIMEOUT_HEADER && sub_conn->timeout_phase == TIMEOUT_HEADER) {
+        return; // a slow client must not be able to extend its deadline byte by byte
+    }
+    struct server_info* server = sub_conn->conn->server;
+    uint64_t timeout = phase == TIMEOUT_KEEPALIVE ? server->keepalive_timeout : phase == TIMEOUT_HEADER ? server->header_timeout : phase == TIMEOUT_BODY ? server->body_timeout : 0;
+    sub_conn->timeout_phase = phase;
+    if (timeout == 0) {
+        timer_cancel(&sub_conn->timer);
+        return;
+    }
+    if (sub_conn->timer.expired == NULL) {
+        sub_conn->timer.expired = (void (*)(void*)) sub_conn_timed_out;
+        sub_conn->timer.arg = sub_conn;
+        phook(sub_conn->pool, (void (*)(void*)) timer_cancel, &sub_conn->timer);
+    }
+    timer_arm(sub_conn->conn->manager->timers, &sub_conn->timer, timeout);
+}
@@ -0,0 +1,90 @@
+//
+// Created by p on 3/23/19.
+//
+
+#include "dispatch.h"
+#include "network.h"
+#include "stats.h"
+#include <avuna/log.h>
+#include <stdlib.h>
+
+struct work_param* least_conn(struct list* work_params) {
+    struct work_param* selected = NULL;
+    uint64_t selected_conns = 0;
+    for (size_t i = 0; i < work_params->count; ++i) {
+        struct work_param* param = work_params->data[i];
+        uint64_t conns = __atomic_load_n(&param->stats.live_conns, __ATOMIC_RELAXED);
+        if (selected == NULL || conns < selected_conns) {
+            selected = param;
+            selected_conns = conns;
+        }
+    }
+    return selected;
+}
+
+struct work_param* least_busy(struct list* work_params) {
+    uint64_t now = monotonic_ns();
+    struct work_param* selected = NULL;
+    uint32_t selected_load = 0;
+    uint64_t selected_conns = 0;
+    for (size_t i = 0; i < work_params->count; ++i) {
+        struct work_param* param = work_params->data[i];
+        uint32_t load = work_load(param, now);
+        uint64_t conns = __atomic_load_n(&param->stats.live_conns, __ATOMIC_RELAXED);
+        if (selected == NULL || load < selected_load || (load == selected_load && conns < selected_conns)) {
+            selected = param;
+            selected_load = load;
+            selected_conns = conns;
+        }
+    }
+    return selected;
+}
+
+struct work_param* two_choices(struct list* work_params, unsigned int* seed) {
+    size_t first_index = rand_r(seed) % work_params->count;
+    struct work_param* first = work_params->data[first_index];
+    if (work_params->count == 1) {
+        return first;
+    }
+    size_t second_index = rand_r(seed) % (work_params->count - 1);
+    if (second_index >= first_index) { // never pick the same worker twice
+        ++second_index;
+    }
+    struct work_param* second = work_params->data[second_index];
+    return __atomic_load_n(&second->stats.live_conns, __ATOMIC_RELAXED) < __atomic_load_n(&first->stats.live_conns, __ATOMIC_RELAXED) ? second : first;
+}
+
+struct work_param* dispatch_select(struct accept_param* param) {
+    struct list* work_params = param->works;
+    uint8_t policy = param->server->dispatch_policy;
+    if (policy == DISPATCH_LEAST_CONN) {
+        return least_conn(work_params);
+    } else if (policy == DISPATCH_P2C) {
+        return two_choices(work_params, &param->dispatch_seed);
+    } else if (policy == DISPATCH_LEAST_BUSY) {
+        return least_busy(work_params);
+    }
+    struct work_param* selected = work_params->data[param->dispatch_counter];
+    param->dispatch_counter = (param->dispatch_counter + 1) % work_params->count;
+    return selected;
+}
+
+void dispatch_conn(struct accept_param* param, struct conn* conn) {
+    struct work_param* selected = dispatch_select(param);
+    size_t first = 0;
+    while (param->works->data[first] != selected) {
+        ++first;
+    }
+    // a full ring means that worker is far behind, so walk on to the next one
+    for (size_t i = 0; i < param->works->count; ++i) {
+        struct work_param* candidate = param->works->data[(first + i) % param->works->count];
+        if (!handoff_push(&candidate->handoff, conn)) {
+            __atomic_add_fetch(&candidate->stats.dispatched, 1, __ATOMIC_RELAXED);
+            return;
+        }
+    }
+    // the same as being over a connection limit, the conn's pool closes the fd and releases its admission
+    struct sub_conn* sub_conn = conn->sub_conns->head->data;
+    accept_turn_away(param, sub_conn->fd);
+    pfree(conn->pool);
+}
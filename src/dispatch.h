@@ -0,0 +1,14 @@
+//
+// Created by p on 3/23/19.
+//
+
+#ifndef AVUNA_HTTPD_DISPATCH_H
+#define AVUNA_HTTPD_DISPATCH_H
+
+#include "accept.h"
+#include <avuna/connection.h>
+
+// hands an accepted conn to a worker picked by the server's dispatch_policy, frees it if every worker is backed up
+void dispatch_conn(struct accept_param* param, struct conn* conn);
+
+#endif //AVUNA_HTTPD_DISPATCH_H
@@ -0,0 +1,68 @@
+#include "handoff.h"
+#include <avuna/pmem_hooks.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+
+int handoff_init(struct handoff* handoff, struct mempool* pool) {
+    handoff->slots = pmalloc(pool, HANDOFF_CAPACITY * sizeof(struct handoff_slot));
+    for (size_t i = 0; i < HANDOFF_CAPACITY; ++i) {
+        handoff->slots[i].sequence = i;
+        handoff->slots[i].conn = NULL;
+    }
+    handoff->mask = HANDOFF_CAPACITY - 1;
+    handoff->head = 0;
+    handoff->tail = 0;
+    handoff->signalled = 0;
+    handoff->event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (handoff->event_fd < 0) {
+        return -1;
+    }
+    phook(pool, close_hook, (void*) handoff->event_fd);
+    return 0;
+}
+
+int handoff_push(struct handoff* handoff, struct conn* conn) {
+    uint64_t position = __atomic_load_n(&handoff->head, __ATOMIC_RELAXED);
+    struct handoff_slot* slot;
+    while (1) {
+        slot = &handoff->slots[position & handoff->mask];
+        uint64_t sequence = __atomic_load_n(&slot->sequence, __ATOMIC_ACQUIRE);
+        int64_t diff = (int64_t) (sequence - position);
+        if (diff == 0) {
+            if (__atomic_compare_exchange_n(&handoff->head, &position, position + 1, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+                break;
+            }
+            // position was reloaded by the failed exchange
+        } else if (diff < 0) {
+            return 1; // the consumer hasn't freed this slot yet
+        } else {
+            position = __atomic_load_n(&handoff->head, __ATOMIC_RELAXED);
+        }
+    }
+    slot->conn = conn;
+    __atomic_store_n(&slot->sequence, position + 1, __ATOMIC_RELEASE);
+    // one wakeup covers every push until the consumer resets, so a burst of accepts costs one write
+    if (!__atomic_exchange_n(&handoff->signalled, 1, __ATOMIC_SEQ_CST)) {
+        uint64_t one = 1;
+        write(handoff->event_fd, &one, sizeof(uint64_t));
+    }
+    return 0;
+}
+
+void handoff_reset(struct handoff* handoff) {
+    uint64_t value;
+    read(handoff->event_fd, &value, sizeof(uint64_t));
+    // pushes after this either get popped by the caller, or write the eventfd again
+    __atomic_store_n(&handoff->signalled, 0, __ATOMIC_SEQ_CST);
+}
+
+struct conn* handoff_pop(struct handoff* handoff) {
+    struct handoff_slot* slot = &handoff->slots[handoff->tail & handoff->mask];
+    if (__atomic_load_n(&slot->sequence, __ATOMIC_ACQUIRE) != handoff->tail + 1) {
+        return NULL;
+    }
+    struct conn* conn = slot->conn;
+    __atomic_store_n(&slot->sequence, handoff->tail + handoff->mask + 1, __ATOMIC_RELEASE);
+    ++handoff->tail;
+    return conn;
+}
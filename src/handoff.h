@@ -0,0 +1,37 @@
+#ifndef AVUNA_HTTPD_HANDOFF_H
+#define AVUNA_HTTPD_HANDOFF_H
+
+#include <avuna/pmem.h>
+#include <avuna/connection.h>
+#include <stdint.h>
+#include <stddef.h>
+
+#define HANDOFF_CAPACITY 4096 // a power of 2
+
+struct handoff_slot {
+    uint64_t sequence;
+    struct conn* conn;
+};
+
+// bounded lock-free ring, any number of threads push, only the owning worker pops
+struct handoff {
+    struct handoff_slot* slots;
+    size_t mask;
+    uint64_t head; // next slot to push, shared by producers
+    uint64_t tail; // next slot to pop, consumer only
+    int signalled; // the eventfd has been written since the consumer last reset it
+    int event_fd;
+};
+
+int handoff_init(struct handoff* handoff, struct mempool* pool);
+
+// returns 1 if the ring is full
+int handoff_push(struct handoff* handoff, struct conn* conn);
+
+// call once event_fd is readable, before popping
+void handoff_reset(struct handoff* handoff);
+
+// NULL once empty
+struct conn* handoff_pop(struct handoff* handoff);
+
+#endif //AVUNA_HTTPD_HANDOFF_H
@@ -4,80 +4,164 @@
 
 #include <avuna/headers.h>
 #include <avuna/string.h>
-#include <avuna/hash.h>
-#include <avuna/llist.h>
 #include <stdio.h>
 
+static const char* const header_names[HEADER_WELL_KNOWN] = {NULL, ":authority", ":method", ":path", ":scheme", ":status", "accept",
+    "accept-encoding", "accept-language", "accept-ranges", "authorization", "cache-control", "connection", "content-encoding",
+    "content-length", "content-range", "content-type", "cookie", "date", "etag", "expires", "host", "if-modified-since", "if-none-match",
+    "if-range", "keep-alive", "last-modified", "location", "origin", "range", "referer", "server", "set-cookie", "status",
+    "transfer-encoding", "upgrade", "user-agent", "vary", "x-forwarded-for", "x-powered-by"};
+
+// perfect hash of the names above, (length * 16 + name[0] + name[1] * 224 + name[length - 1] * 161) & 127 on the lowercase name.
+// the multipliers were searched for to leave every name its own slot. tools/header_table.py rebuilds this for a new name
+static const uint8_t header_table[128] = {
+    26, 0, 0, 0, 0, 0, 0, 0, 0, 18, 0, 34, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 5, 0, 0,
+    0, 0, 0, 0, 9, 0, 33, 29, 20, 36, 0, 0, 0, 0, 24, 37,
+    0, 39, 0, 0, 0, 0, 0, 0, 7, 0, 27, 0, 21, 28, 22, 10,
+    0, 0, 0, 0, 0, 0, 0, 0, 16, 0, 13, 14, 0, 0, 0, 4,
+    0, 12, 0, 1, 0, 6, 0, 0, 15, 0, 0, 0, 0, 0, 0, 0,
+    0, 23, 0, 0, 0, 31, 0, 0, 17, 0, 35, 0, 19, 0, 2, 0,
+    25, 0, 3, 0, 30, 0, 8, 0, 32, 0, 38, 0, 0, 0, 0, 11,
+};
+
+static inline uint8_t header_lower(char c) {
+    return (uint8_t) (c >= 'A' && c <= 'Z' ? c + ('a' - 'A') : c);
+}
+
+int header_id(const char* name, size_t length) {
+    if (length < 2) {
+        return HEADER_OTHER;
+    }
+    size_t hash = (length * 16 + header_lower(name[0]) + header_lower(name[1]) * 224 + header_lower(name[length - 1]) * 161) & 127;
+    int id = header_table[hash];
+    if (id == HEADER_OTHER) {
+        return HEADER_OTHER;
+    }
+    const char* known = header_names[id];
+    for (size_t i = 0; i < length; ++i) {
+        if (known[i] == 0 || header_lower(name[i]) != (uint8_t) known[i]) {
+            return HEADER_OTHER;
+        }
+    }
+    return known[length] == 0 ? id : HEADER_OTHER;
+}
+
+// first[] after entries moved
+static void header_reindex(struct headers* headers) {
+    memset(headers->first, 0, sizeof(headers->first));
+    for (size_t i = headers->count; i > 0; --i) {
+        int id = headers->entries[i - 1].id;
+        if (id != HEADER_OTHER) {
+            headers->first[id] = (uint32_t) i;
+        }
+    }
+}
+
+// the first entry called name, NULL if there is none
+static struct header_entry* header_find(struct headers* headers, const char* name) {
+    int id = header_id(name, strlen(name));
+    if (id != HEADER_OTHER) {
+        return headers->first[id] == 0 ? NULL : &headers->entries[headers->first[id] - 1];
+    }
+    for (size_t i = 0; i < headers->count; ++i) {
+        struct header_entry* entry = &headers->entries[i];
+        if (entry->id == HEADER_OTHER && str_eq_case(entry->name, name)) {
+            return entry;
+        }
+    }
+    return NULL;
+}
+
+// an uninitialized entry at index, the ones from there on move back
+static struct header_entry* header_insert(struct headers* headers, size_t index) {
+    if (headers->count == headers->capacity) {
+        size_t capacity = headers->capacity * 2;
+        struct header_entry* entries = pmalloc(headers->pool, capacity * sizeof(struct header_entry));
+        memcpy(entries, headers->entries, headers->count * sizeof(struct header_entry));
+        if (headers->entries != headers->inline_entries) {
+            pprefree(headers->pool, headers->entries);
+        }
+        headers->entries = entries;
+        headers->capacity = capacity;
+    }
+    memmove(&headers->entries[index + 1], &headers->entries[index], (headers->count - index) * sizeof(struct header_entry));
+    ++headers->count;
+    return &headers->entries[index];
+}
+
+// name must already be lowercase, neither is copied
+static void header_append(struct headers* headers, int id, char* name, char* value) {
+    struct header_entry* entry = header_insert(headers, headers->count);
+    entry->id = id;
+    entry->name = name;
+    entry->value = value;
+    if (id != HEADER_OTHER && headers->first[id] == 0) {
+        headers->first[id] = (uint32_t) headers->count;
+    }
+}
+
+// well-known names point at header_names rather than being copied
+static char* header_intern(struct headers* headers, int id, char* name) {
+    return id == HEADER_OTHER ? str_tolower(str_dup(name, 0, headers->pool)) : (char*) header_names[id];
+}
+
+char* header_get_id(struct headers* headers, int id) {
+    return headers->first[id] == 0 ? NULL : headers->entries[headers->first[id] - 1].value;
+}
 
 char* header_get(struct headers* headers, char* name) {
-    char lower[strlen(name) + 1];
-    memcpy(lower, name, strlen(name) + 1);
-    str_tolower(lower);
-    struct llist* list = hashmap_get(headers->header_map, lower);
-    if (list == NULL) return NULL;
-    struct header_entry* entry = list->head->data;
-    return entry->value;
+    struct header_entry* entry = header_find(headers, name);
+    return entry == NULL ? NULL : entry->value;
+}
+
+size_t header_count(struct headers* headers) {
+    return headers->count;
+}
+
+struct header_entry* header_at(struct headers* headers, size_t index) {
+    return index < headers->count ? &headers->entries[index] : NULL;
 }
 
 int header_set(struct headers* headers, char* name, char* value) {
-    char lower[strlen(name) + 1];
-    memcpy(lower, name, strlen(name) + 1);
-    str_tolower(lower);
-    struct llist* list = hashmap_get(headers->header_map, name);
-    if (list == NULL) return 0;
-    struct header_entry* entry = list->head->data;
+    struct header_entry* entry = header_find(headers, name);
+    if (entry == NULL) return 0;
     entry->value = str_dup(value, 0, headers->pool);
     return 1;
 }
 
 int header_add(struct headers* headers, char* name, char* value) {
-    struct llist* list = hashmap_get(headers->header_map, name);
-    char* new_name = str_tolower(str_dup(name, 0, headers->pool));
-    if (list == NULL) {
-        list = llist_new(headers->pool);
-        hashmap_put(headers->header_map, new_name, list);
-    }
-    struct header_entry* entry = pcalloc(headers->pool, sizeof(struct header_entry));
-    entry->name = new_name;
-    entry->value = str_dup(value, 0, headers->pool);
-    entry->map_node = llist_append(list, entry);
-    entry->node = llist_append(headers->header_list, entry);
+    int id = header_id(name, strlen(name));
+    header_append(headers, id, header_intern(headers, id, name), str_dup(value, 0, headers->pool));
     return 1;
 }
 
 int header_prepend(struct headers* headers, char* name, char* value) {
-    struct llist* list = hashmap_get(headers->header_map, name);
-    char* new_name = str_tolower(str_dup(name, 0, headers->pool));
-    if (list == NULL) {
-        list = llist_new(headers->pool);
-        hashmap_put(headers->header_map, new_name, list);
-    }
-    struct header_entry* entry = pcalloc(headers->pool, sizeof(struct header_entry));
-    entry->name = new_name;
+    int id = header_id(name, strlen(name));
+    struct header_entry* entry = header_insert(headers, 0);
+    entry->id = id;
+    entry->name = header_intern(headers, id, name);
     entry->value = str_dup(value, 0, headers->pool);
-    entry->map_node = llist_prepend(list, entry);
-    entry->node = llist_prepend(headers->header_list, entry);
+    header_reindex(headers);
     return 1;
 }
 
-
 void header_del(struct headers* headers, char* name) {
-    char lower[strlen(name) + 1];
-    memcpy(lower, name, strlen(name) + 1);
-    str_tolower(lower);
-    struct llist* list = hashmap_get(headers->header_map, lower);
-    if (list == NULL) {
-        return;
+    int id = header_id(name, strlen(name));
+    size_t kept = 0;
+    for (size_t i = 0; i < headers->count; ++i) {
+        struct header_entry* entry = &headers->entries[i];
+        if (id != HEADER_OTHER ? entry->id == id : (entry->id == HEADER_OTHER && str_eq_case(entry->name, name))) {
+            continue;
+        }
+        headers->entries[kept++] = *entry;
     }
-    ITER_LLIST(list, value) {
-        struct header_entry* entry = value;
-        llist_del(headers->header_list, entry->node);
-        ITER_LLIST_END();
+    if (kept != headers->count) {
+        headers->count = kept;
+        header_reindex(headers);
     }
-    hashmap_put(headers->header_map, lower, NULL);
 }
 
-
 int header_tryadd(struct headers* headers, char* name, char* value) {
     if (header_get(headers, name) != NULL) return 1;
     return header_add(headers, name, value);
@@ -94,12 +178,21 @@ struct headers* header_new(struct mempool* parent) {
     struct mempool* pool = mempool_new();
     pchild(parent, pool);
     struct headers* headers = pcalloc(pool, sizeof(struct headers));
-    headers->header_list = llist_new(pool);
-    headers->header_map = hashmap_new(16, pool);
+    headers->entries = headers->inline_entries;
+    headers->capacity = HEADERS_INLINE;
     headers->pool = pool;
     return headers;
 }
 
+struct headers* header_clone(struct headers* headers, struct mempool* parent) {
+    struct headers* clone = header_new(parent);
+    for (size_t i = 0; i < headers->count; ++i) {
+        struct header_entry* entry = &headers->entries[i];
+        header_append(clone, entry->id, entry->id == HEADER_OTHER ? str_dup(entry->name, 0, clone->pool) : entry->name, str_dup(entry->value, 0, clone->pool));
+    }
+    return clone;
+}
+
 struct headers* header_parse(char* data, struct mempool* parent) {
     struct headers* headers = header_new(parent);
     char* cd = data;
@@ -122,22 +215,36 @@ struct headers* header_parse(char* data, struct mempool* parent) {
     return headers;
 }
 
+struct headers* header_parse_in_place(char* data, struct mempool* parent) {
+    struct headers* headers = header_new(parent);
+    char* cd = data;
+    char* eol;
+    while ((eol = strchr(cd, '\n')) != NULL) {
+        eol[0] = 0;
+        char* value = strchr(cd, ':');
+        if (value != NULL) {
+            value[0] = 0;
+            char* name = str_tolower(str_trim(cd));
+            header_append(headers, header_id(name, strlen(name)), name, str_trim(value + 1));
+        }
+        cd = eol + 1;
+    }
+    return headers;
+}
+
 char* header_serialize(struct headers* headers, size_t* len) {
     *len = 0;
-    ITER_LLIST(headers->header_list, value) {
-        struct header_entry* entry = value;
-        *len += strlen(entry->name) + strlen(entry->value) + 4;
-        ITER_LLIST_END();
+    for (size_t i = 0; i < headers->count; ++i) {
+        *len += strlen(headers->entries[i].name) + strlen(headers->entries[i].value) + 4;
     }
     (*len) += 2;
     char* ret = pmalloc(headers->pool, *len);
-    int ri = 0;
-    ITER_LLIST(headers->header_list, value) {
-        struct header_entry* entry = value;
+    size_t ri = 0;
+    for (size_t i = 0; i < headers->count; ++i) {
+        struct header_entry* entry = &headers->entries[i];
         ri += snprintf(ret + ri, *len - ri, "%s: %s\r\n", entry->name, entry->value);
-        ITER_LLIST_END();
     }
     ret[ri++] = '\r';
     ret[ri++] = '\n';
     return ret;
-}
\ No newline at end of file
+}
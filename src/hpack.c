@@ -7,6 +7,8 @@
 #include <avuna/headers.h>
 #include <avuna/globals.h>
 #include <avuna/string.h>
+#include <avuna/http.h>
+#include <avuna/version.h>
 
 // https://tools.ietf.org/html/rfc7541
 
@@ -390,17 +392,64 @@ struct hpack_entry* _hpack_entry_in_list(struct llist* entries, char* value) {
     return NULL;
 }
 
-uint8_t* hpack_encode(struct hpack_ctx* ctx, struct mempool* pool, struct headers* headers, size_t* out_length) {
+static __thread time_t fixed_headers_second = -1;
+static __thread uint8_t fixed_headers[96];
+static __thread size_t fixed_headers_length;
+static __thread size_t fixed_server_length;
+
+// server and date as literals without indexing on their static names, so the block holds for any connection's table
+const uint8_t* hpack_fixed_headers(int with_server, size_t* length) {
+    time_t second;
+    const char* date = http_date(&second);
+    if (second != fixed_headers_second) {
+        size_t offset = 0;
+        struct hpack_entry* server = ((struct llist*) hashmap_get(static_entry_map, "server"))->head->data;
+        hpack_encode_integer(0, 0b1111, server->push_index, fixed_headers, &offset, sizeof(fixed_headers));
+        hpack_encode_string(NULL, "Avuna/" VERSION, 0, fixed_headers, &offset, sizeof(fixed_headers));
+        fixed_server_length = offset;
+        struct hpack_entry* date_entry = ((struct llist*) hashmap_get(static_entry_map, "date"))->head->data;
+        hpack_encode_integer(0, 0b1111, date_entry->push_index, fixed_headers, &offset, sizeof(fixed_headers));
+        hpack_encode_string(NULL, (char*) date, 0, fixed_headers, &offset, sizeof(fixed_headers));
+        fixed_headers_length = offset;
+        fixed_headers_second = second;
+    }
+    if (!with_server) {
+        *length = fixed_headers_length - fixed_server_length;
+        return fixed_headers + fixed_server_length;
+    }
+    *length = fixed_headers_length;
+    return fixed_headers;
+}
+
+void _hpack_append_fixed(struct mempool* pool, int with_server, uint8_t** out, size_t* out_i, size_t* out_cap) {
+    size_t fixed_length = 0;
+    const uint8_t* fixed = hpack_fixed_headers(with_server, &fixed_length);
+    while (*out_i + fixed_length > *out_cap) {
+        *out_cap *= 2;
+        *out = prealloc(pool, *out, *out_cap);
+    }
+    memcpy(*out + *out_i, fixed, fixed_length);
+    *out_i += fixed_length;
+}
+
+uint8_t* hpack_encode(struct hpack_ctx* ctx, struct mempool* pool, struct headers* headers, int fixed_headers, size_t* out_length) {
     uint8_t* out = pmalloc(pool, 1024);
     size_t out_cap = 1024;
     size_t out_i = 0;
     ctx->current_max_dynamic_size = ctx->max_dynamic_size;
+    // a module's own server goes out instead of ours
+    int with_server = fixed_headers && header_get_id(headers, HEADER_SERVER) == NULL;
     while (!hpack_encode_integer(0b001 << 5, 0b11111, ctx->current_max_dynamic_size, out, &out_i, out_cap)) {
         out_cap *= 2;
         out = prealloc(pool, out, out_cap);
     }
-    ITER_LLIST(headers->header_list, value) {
-        struct header_entry* entry = value;
+    for (size_t i = 0; i < headers->count; ++i) {
+        struct header_entry* entry = &headers->entries[i];
+        if (fixed_headers && entry->name[0] != ':') {
+            // right behind the pseudo-headers, which have to come first
+            _hpack_append_fixed(pool, with_server, &out, &out_i, &out_cap);
+            fixed_headers = 0;
+        }
         int never_index = hashset_has(never_index_headers, entry->name);
         struct llist* static_entries = hashmap_get(static_entry_map, entry->name);
         struct hpack_entry* static_entry = static_entries != NULL ? _hpack_entry_in_list(static_entries, entry->value) : NULL;
@@ -466,7 +515,9 @@ uint8_t* hpack_encode(struct hpack_ctx* ctx, struct mempool* pool, struct header
                 out = prealloc(pool, out, out_cap);
             }
         }
-        ITER_LLIST_END();
+    }
+    if (fixed_headers) {
+        _hpack_append_fixed(pool, with_server, &out, &out_i, &out_cap);
     }
     *out_length = out_i;
     return out;
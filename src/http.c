@@ -9,9 +9,54 @@
 #include <avuna/string.h>
 #include <avuna/provider.h>
 #include <avuna/chunked.h>
+#include <avuna/post_stream.h>
+#include <avuna/version.h>
 #include <errno.h>
+#include <time.h>
 
-int parseRequest(struct request_session* rs, char* data, size_t maxPost) {
+static const char* date_days[7] = {"Sun", "Mon", "Tue", "Wed", "Thu", "Fri", "Sat"};
+static const char* date_months[12] = {"Jan", "Feb", "Mar", "Apr", "May", "Jun", "Jul", "Aug", "Sep", "Oct", "Nov", "Dec"};
+
+static __thread time_t date_second = -1;
+static __thread char date_value[HTTP_DATE_LENGTH + 1];
+static __thread time_t fixed_headers_second = -1;
+static __thread char fixed_headers[128];
+static __thread size_t fixed_headers_length;
+static __thread size_t fixed_server_length;
+
+const char* http_date(time_t* second) {
+    time_t now = time(NULL);
+    if (now != date_second) {
+        // by hand rather than strftime, which follows the locale
+        struct tm tm;
+        gmtime_r(&now, &tm);
+        snprintf(date_value, sizeof(date_value), "%s, %02d %s %04d %02d:%02d:%02d GMT", date_days[tm.tm_wday], tm.tm_mday,
+                 date_months[tm.tm_mon], tm.tm_year + 1900, tm.tm_hour, tm.tm_min, tm.tm_sec);
+        date_second = now;
+    }
+    if (second != NULL) {
+        *second = date_second;
+    }
+    return date_value;
+}
+
+const char* http_fixed_headers(int with_server, size_t* length) {
+    time_t second;
+    const char* date = http_date(&second);
+    if (second != fixed_headers_second) {
+        fixed_server_length = sizeof("Server: Avuna/" VERSION "\r\n") - 1;
+        fixed_headers_length = (size_t) snprintf(fixed_headers, sizeof(fixed_headers), "Server: Avuna/" VERSION "\r\nDate: %s\r\n", date);
+        fixed_headers_second = second;
+    }
+    if (!with_server) {
+        *length = fixed_headers_length - fixed_server_length;
+        return fixed_headers + fixed_server_length;
+    }
+    *length = fixed_headers_length;
+    return fixed_headers;
+}
+
+int parseRequest(struct request_session* rs, char* data) {
     struct request* request = rs->request;
     request->add_to_cache = 0;
     char* temp = data;
@@ -21,13 +66,14 @@ int parseRequest(struct request_session* rs, char* data, size_t maxPost) {
         return -1;
     }
     eol1[0] = 0;
+    char* headers = eol1 + 1;
     eol1 = strchr(temp, ' ');
     if (eol1 == NULL) {
         errno = EINVAL;
         return -1;
     }
     eol1[0] = 0;
-    request->method = str_dup(temp, 0, rs->pool);
+    request->method = temp;
     temp = eol1 + 1;
     eol1 = strchr(temp, ' ');
     if (eol1 == NULL) {
@@ -35,29 +81,49 @@ int parseRequest(struct request_session* rs, char* data, size_t maxPost) {
         return -1;
     }
     eol1[0] = 0;
-    size_t temp_len = strlen(temp) + 1;
-    request->path = pmalloc(rs->pool, temp_len);
-    memcpy(request->path, temp, temp_len);
-    temp = eol1 + 1;
-    temp = str_trim(temp);
-    temp_len = strlen(temp) + 1;
-    request->http_version = pmalloc(rs->pool, temp_len);
-    memcpy(request->http_version, temp, temp_len);
-    printf("version: %s\n", request->http_version);
-    temp += temp_len + 1;
-    request->headers = header_parse(temp, rs->pool);
+    request->path = temp;
+    request->http_version = str_trim(eol1 + 1);
+    request->headers = header_parse_in_place(headers, rs->pool);
     request->body = NULL;
 
-    //TODO: for streaming posts (large posts or chunked posts), return a streamed type provision
-    const char* content_length = header_get(request->headers, "Content-Length");
-    if (str_eq(request->method, "POST") && content_length != NULL && str_isunum(content_length)) {
+    const char* transfer_encoding = header_get_id(request->headers, HEADER_TRANSFER_ENCODING);
+    if (transfer_encoding != NULL && !str_eq_case(transfer_encoding, "chunked")) {
+        errno = EINVAL;
+        return -1;
+    }
+    return 0;
+}
+
+int parseRequestBody(struct request_session* rs, size_t maxPost, size_t streamPost, size_t maxStreamPost) {
+    struct request* request = rs->request;
+    const char* transfer_encoding = header_get_id(request->headers, HEADER_TRANSFER_ENCODING);
+    const char* content_length = header_get_id(request->headers, HEADER_CONTENT_LENGTH);
+    const char* content_type = header_get_id(request->headers, HEADER_CONTENT_TYPE);
+    if (content_type == NULL) {
+        content_type = "application/x-www-form-urlencoded";
+    }
+    if (transfer_encoding != NULL) {
+        // its length is only known at the end, so it's decoded as it arrives and collected in full if it can't be streamed. this overrides any Content-Length
+        request->body = post_stream_new(rs, -1, (char*) content_type);
+        struct post_stream* stream = request->body->data.stream.extra;
+        stream->chunked = pcalloc(request->body->pool, sizeof(struct chunked_decoder));
+        stream->buffered = streamPost == 0;
+        stream->limit = stream->buffered ? maxPost : maxStreamPost;
+    } else if (str_eq(request->method, "POST") && content_length != NULL && str_isunum(content_length)) {
         size_t cli = strtoull(content_length, NULL, 10);
-        if (cli > 0 && (maxPost == 0 || cli < maxPost)) {
+        int stream = cli > 0 && streamPost > 0 && cli >= streamPost;
+        if (stream ? maxStreamPost > 0 && cli > maxStreamPost : maxPost > 0 && cli >= maxPost) {
+            // nothing reads it, so the protocol only skips it
+            request->body = post_stream_new(rs, (ssize_t) cli, (char*) content_type);
+            errno = EMSGSIZE;
+            return -1;
+        } else if (stream) {
+            request->body = post_stream_new(rs, (ssize_t) cli, (char*) content_type);
+        } else if (cli > 0) {
             request->body = pcalloc(rs->pool, sizeof(struct provision));
             request->body->pool = rs->pool;
             request->body->type = PROVISION_DATA;
-            const char* tmp = header_get(request->headers, "Content-Type");
-            request->body->content_type = (char*) (tmp == NULL ? "application/x-www-form-urlencoded" : tmp);
+            request->body->content_type = (char*) content_type;
             request->body->data.data.data = pmalloc(rs->pool, cli);
             request->body->data.data.size = cli;
         }
@@ -120,7 +186,11 @@ int parseResponse(struct request_session* rs, struct sub_conn* sub_conn, char* d
     if (eol[eol_length - 1] == '\r') eol[eol_length - 1] = 0;
     rs->response->code = str_dup(eol, 0, rs->pool);
     rs->response->headers = header_parse(headers, rs->pool);
-    const char* content_length = header_get(rs->response->headers, "Content-Length");
+    // ours go out with every response, see http_fixed_headers
+    header_del(rs->response->headers, "Server");
+    header_del(rs->response->headers, "Connection");
+    header_del(rs->response->headers, "Date");
+    const char* content_length = header_get_id(rs->response->headers, HEADER_CONTENT_LENGTH);
     if (content_length != NULL && str_isunum(content_length)) {
         size_t content_length_int = strtoull(content_length, NULL, 10);
         rs->response->body = pcalloc(rs->pool, sizeof(struct provision));
@@ -128,12 +198,12 @@ int parseResponse(struct request_session* rs, struct sub_conn* sub_conn, char* d
         pchild(rs->pool, rs->response->body->pool);
         rs->response->body->type = PROVISION_DATA;
         rs->response->body->data.data.size = content_length_int;
-        rs->response->body->content_type = (char*) header_get(rs->response->headers, "Content-Type");
+        rs->response->body->content_type = (char*) header_get_id(rs->response->headers, HEADER_CONTENT_TYPE);
         if (rs->response->body->content_type == NULL) {
             rs->response->body->content_type = "text/html";
         }
     }
-    const char* transfer_encoding = header_get(rs->response->headers, "Transfer-Encoding");
+    const char* transfer_encoding = header_get_id(rs->response->headers, HEADER_TRANSFER_ENCODING);
     if (transfer_encoding != NULL) {
         rs->response->body = pcalloc(rs->pool, sizeof(struct provision));
         rs->response->body->pool = mempool_new();
@@ -143,10 +213,11 @@ int parseResponse(struct request_session* rs, struct sub_conn* sub_conn, char* d
         rs->response->body->data.stream.known_length = -1;
         rs->response->body->data.stream.read = chunked_read;
         rs->response->body->data.stream.notify = NULL;
+        rs->response->body->data.stream.source = sub_conn;
         struct chunked_stream_extra* extra = rs->response->body->data.stream.extra = pcalloc(rs->response->body->pool, sizeof(struct chunked_stream_extra));
         extra->sub_conn = sub_conn;
-        extra->remaining = -1;
-        rs->response->body->content_type = (char*) header_get(rs->response->headers, "Content-Type");
+        buffer_init(&extra->decoded, rs->response->body->pool);
+        rs->response->body->content_type = (char*) header_get_id(rs->response->headers, HEADER_CONTENT_TYPE);
         if (rs->response->body->content_type == NULL) {
             rs->response->body->content_type = "text/html";
         }
@@ -158,13 +229,13 @@ unsigned char* serializeResponse(struct request_session* rs, size_t* out_len) {
     *out_len = 0;
     size_t http_version_length = strlen(rs->response->http_version);
     size_t response_code_length = strlen(rs->response->code);
-    *out_len = http_version_length + 1 + response_code_length + 2;
+    size_t fixed_length = 0;
+    // a module's own Server goes out instead of ours
+    const char* fixed = http_fixed_headers(header_get_id(rs->response->headers, HEADER_SERVER) == NULL, &fixed_length);
+    *out_len = http_version_length + 1 + response_code_length + 2 + fixed_length;
     size_t header_length = 0;
     char* headers = header_serialize(rs->response->headers, &header_length);
     *out_len += header_length;
-    if (rs->response->body != NULL && rs->response->body->type == PROVISION_DATA) {
-        *out_len += rs->response->body->data.data.size;
-    }
     unsigned char* out = pmalloc(rs->conn->pool, *out_len);
     size_t written = 0;
     memcpy(out, rs->response->http_version, http_version_length);
@@ -174,22 +245,24 @@ unsigned char* serializeResponse(struct request_session* rs, size_t* out_len) {
     written += response_code_length;
     out[written++] = '\r';
     out[written++] = '\n';
+    memcpy(out + written, fixed, fixed_length);
+    written += fixed_length;
     memcpy(out + written, headers, header_length);
     written += header_length;
-    // TODO: don't copy body here
-    if (!str_eq(rs->request->method, "HEAD") && rs->response->body != NULL && rs->response->body->type == PROVISION_DATA) {
-        memcpy(out + written, rs->response->body->data.data.data, rs->response->body->data.data.size);
-        written += rs->response->body->data.data.size;
-    }
     return out;
 }
 
 void updateContentHeaders(struct request_session* rs) {
-    if (rs->response->body->content_type != NULL) {
+    struct http_ranges* ranges = rs->response->ranges;
+    if (ranges != NULL && ranges->content_type != NULL) {
+        header_setoradd(rs->response->headers, "Content-Type", ranges->content_type);
+    } else if (rs->response->body->content_type != NULL) {
         header_setoradd(rs->response->headers, "Content-Type", rs->response->body->content_type);
     }
     ssize_t len = -1;
-    if (rs->response->body->type == PROVISION_DATA) {
+    if (ranges != NULL) {
+        len = ranges->length;
+    } else if (rs->response->body->type == PROVISION_DATA) {
         len = rs->response->body->data.data.size;
     } else if (rs->response->body->data.stream.known_length >= 0) {
         len = rs->response->body->data.stream.known_length;
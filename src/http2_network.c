@@ -10,6 +10,10 @@
 #include <avuna/http_util.h>
 #include <avuna/util.h>
 #include <stdint.h>
+#include <stdlib.h>
+
+#define FRAME_BUFFER_SIZE (65536 + 9)
+#define FRAME_BUFFER_CACHE 64
 
 const uint8_t* preface = "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n";
 
@@ -56,9 +60,52 @@ void http2_send_data(struct request_session* rs, uint8_t* data, size_t data_leng
     }
 }
 
+// recently released frame buffers, so reconnect storms don't churn 64 KB allocations through the allocator
+static __thread uint8_t* frame_buffer_cache[FRAME_BUFFER_CACHE];
+static __thread size_t frame_buffer_cache_count = 0;
+
+static void release_frame_buffer(uint8_t* frame_buffer) {
+    if (frame_buffer_cache_count < FRAME_BUFFER_CACHE) {
+        frame_buffer_cache[frame_buffer_cache_count++] = frame_buffer;
+    } else {
+        free(frame_buffer);
+    }
+}
+
+static uint8_t* acquire_frame_buffer(struct sub_conn* sub_conn) {
+    uint8_t* frame_buffer = frame_buffer_cache_count > 0 ? frame_buffer_cache[--frame_buffer_cache_count] : malloc(FRAME_BUFFER_SIZE);
+    if (frame_buffer != NULL) {
+        phook(sub_conn->pool, (void (*)(void*)) release_frame_buffer, frame_buffer);
+    }
+    return frame_buffer;
+}
+
+void http2_refresh_timeout(struct sub_conn* sub_conn) {
+    struct http2_server_extra* extra = sub_conn->extra;
+    sub_conn_set_timeout(sub_conn, sub_conn->tls_state == TLS_STATE_HANDSHAKE || !extra->has_received_preface ? TIMEOUT_HEADER : TIMEOUT_KEEPALIVE);
+}
+
+// frame_size + 9 bytes at data, 1 if the conn is to be closed
+int http2_handle_frame(struct sub_conn* sub_conn, uint8_t* data, uint32_t frame_size) {
+    struct mempool* frame_pool = mempool_new();
+    pchild(sub_conn->pool, frame_pool);
+    uint32_t error_code = 0;
+    struct frame* frame = parse_frame(frame_pool, data, frame_size, &error_code);
+    if (receive_http2_frame(sub_conn, frame)) {
+        pfree(frame->pool);
+        return 1;
+    }
+    pfree(frame->pool);
+    return 0;
+}
+
 int handle_http2_server_read(struct sub_conn* sub_conn, uint8_t* read_buf, size_t read_buf_len) {
     struct http2_server_extra* extra = sub_conn->extra;
-    buffer_push(&sub_conn->read_buffer, read_buf, read_buf_len);
+    if (sub_conn->read_buffer.size > 0 || !extra->has_received_preface) {
+        // behind what's already kept
+        sub_conn_keep(sub_conn, read_buf, read_buf_len);
+        read_buf_len = 0;
+    }
     if (!extra->has_received_preface) {
         if (sub_conn->read_buffer.size >= 24) {
             uint8_t maybe_preface[24];
@@ -67,12 +114,16 @@ int handle_http2_server_read(struct sub_conn* sub_conn, uint8_t* read_buf, size_
                 return 1;
             }
             extra->has_received_preface = 1;
+            // only allocated once the client has proven to speak http2
+            if (extra->frame_buffer == NULL && (extra->frame_buffer = acquire_frame_buffer(sub_conn)) == NULL) {
+                return 1;
+            }
             if (http2_start_connection(sub_conn)) {
                 return 1;
             }
         }
     }
-    while (sub_conn->read_buffer.size > 9) {
+    while (sub_conn->read_buffer.size >= 9) {
         uint8_t header[9];
         buffer_peek(&sub_conn->read_buffer, 9, header);
         uint32_t frame_size = (uint32_t) header[0] << 16 | (uint32_t) header[1] << 8 | (uint32_t) header[2];
@@ -81,19 +132,29 @@ int handle_http2_server_read(struct sub_conn* sub_conn, uint8_t* read_buf, size_
         }
         if (sub_conn->read_buffer.size >= frame_size + 9) {
             buffer_pop(&sub_conn->read_buffer, frame_size + 9, extra->frame_buffer);
-            struct mempool* frame_pool = mempool_new();
-            pchild(sub_conn->pool, frame_pool);
-            uint32_t error_code = 0;
-            struct frame* frame = parse_frame(frame_pool, extra->frame_buffer, frame_size, &error_code);
-            if (receive_http2_frame(sub_conn, frame)) {
-                pfree(frame->pool);
+            if (http2_handle_frame(sub_conn, extra->frame_buffer, frame_size)) {
                 return 1;
             }
-            pfree(frame->pool);
         } else {
             break;
         }
     }
+    // whole frames are handled where they are in the worker's buffer, only a partial one is kept
+    while (read_buf_len >= 9) {
+        uint32_t frame_size = (uint32_t) read_buf[0] << 16 | (uint32_t) read_buf[1] << 8 | (uint32_t) read_buf[2];
+        if (frame_size > extra->our_max_frame_size) {
+            return 1;
+        }
+        if (read_buf_len < frame_size + 9) {
+            break;
+        }
+        if (http2_handle_frame(sub_conn, read_buf, frame_size)) {
+            return 1;
+        }
+        read_buf += frame_size + 9;
+        read_buf_len -= frame_size + 9;
+    }
+    sub_conn_keep(sub_conn, read_buf, read_buf_len);
     return 0;
 }
 
@@ -123,6 +184,8 @@ int http2_stream_notify(struct request_session* rs) {
     } else {
         pxfer(provision->pool, stream->pool, data.data);
         http2_send_data(rs, data.data, data.size, 0);
+        // a stream making progress keeps the connection alive, even if the client is quiet
+        http2_refresh_timeout(rs->src_conn);
         return 0;
     }
     return 1;
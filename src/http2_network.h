@@ -33,6 +33,8 @@ struct http2_server_extra {
     struct hpack_ctx* send_hpack_ctx;
 };
 
+void http2_refresh_timeout(struct sub_conn* sub_conn);
+
 int handle_http2_server_read(struct sub_conn* sub_conn, uint8_t* read_buf, size_t read_buf_len);
 
 int http2_stream_notify(struct request_session* rs);
@@ -15,6 +15,7 @@
 #include <avuna/string.h>
 #include <avuna/module.h>
 #include <avuna/provider.h>
+#include <avuna/post_stream.h>
 
 void send_request_session_http2(struct request_session* rs, struct timespec* start) {
     struct http2_server_extra* extra = rs->src_conn->extra;
@@ -28,7 +29,7 @@ void send_request_session_http2(struct request_session* rs, struct timespec* sta
     header_del(rs->response->headers, "connection");
     header_del(rs->response->headers, "transfer-encoding");
     struct http2_stream* stream = rs->extra;
-    uint8_t* headers = hpack_encode(extra->recv_hpack_ctx, rs->pool, rs->response->headers, &header_length);
+    uint8_t* headers = hpack_encode(extra->recv_hpack_ctx, rs->pool, rs->response->headers, 1, &header_length);
 
     log_request_session(rs, start);
     size_t max_frame_size = extra->other_max_frame_size - 32;
@@ -67,7 +68,21 @@ void send_request_session_http2(struct request_session* rs, struct timespec* sta
         http2_send_frame(rs->src_conn, continuation);
     }
 
-    if (rs->response->body->type == PROVISION_DATA && rs->response->body->data.data.size > 0) {
+    struct http_ranges* ranges = rs->response->ranges;
+    if (rs->response->body->type == PROVISION_DATA && rs->response->body->data.data.size > 0 && ranges != NULL) {
+        // each part is a slice of the body
+        uint8_t* body = rs->response->body->data.data.data;
+        for (size_t i = 0; i < ranges->count; ++i) {
+            struct http_range* range = &ranges->ranges[i];
+            if (range->part_header != NULL) {
+                http2_send_data(rs, (uint8_t*) range->part_header, range->part_header_length, 0);
+            }
+            http2_send_data(rs, body + range->start, range->length, i + 1 == ranges->count && ranges->trailer == NULL);
+        }
+        if (ranges->trailer != NULL) {
+            http2_send_data(rs, (uint8_t*) ranges->trailer, ranges->trailer_length, 1);
+        }
+    } else if (rs->response->body->type == PROVISION_DATA && rs->response->body->data.data.size > 0) {
         http2_send_data(rs, rs->response->body->data.data.data, rs->response->body->data.data.size, 1);
     } else if (rs->response->body->type == PROVISION_STREAM) {
         // nop
@@ -96,22 +111,30 @@ int handle_http2_request(struct sub_conn* sub_conn, struct http2_stream* stream)
     rs->conn = sub_conn->conn;
     rs->src_conn = sub_conn;
     rs->request = pcalloc(req_pool, sizeof(struct request));
-    rs->request->method = header_get(stream->headers, ":method");
-    rs->request->path = header_get(stream->headers, ":path");
-    if (!str_eq(header_get(stream->headers, ":scheme"), "https") || !rs->request->method || !rs->request->path) {
+    rs->request->method = header_get_id(stream->headers, HEADER_PSEUDO_METHOD);
+    rs->request->path = header_get_id(stream->headers, HEADER_PSEUDO_PATH);
+    if (!str_eq(header_get_id(stream->headers, HEADER_PSEUDO_SCHEME), "https") || !rs->request->method || !rs->request->path) {
         return 1;
     }
-    char* authority = header_get(stream->headers, ":authority");
+    char* authority = header_get_id(stream->headers, HEADER_PSEUDO_AUTHORITY);
     header_add(stream->headers, "host", authority);
     rs->request->http_version = "HTTP/2";
     rs->request->headers = stream->headers;
-    rs->request->body = pcalloc(rs->pool, sizeof(struct provision));
-    rs->request->body->pool = rs->pool;
-    rs->request->body->type = PROVISION_DATA;
-    const char* posted_content_type = header_get(rs->request->headers, "Content-Type");
-    rs->request->body->content_type = (char*) (posted_content_type == NULL ? "application/x-www-form-urlencoded" : posted_content_type);
-    rs->request->body->data.data.data = pmalloc(rs->pool, stream->data_buffer.size);
-    rs->request->body->data.data.size = buffer_pop(&stream->data_buffer, stream->data_buffer.size, rs->request->body->data.data.data);
+    const char* posted_content_type = header_get_id(rs->request->headers, HEADER_CONTENT_TYPE);
+    if (stream->state == STREAM_OPEN) {
+        // started before the body arrived, DATA frames go to it from here on
+        const char* content_length = header_get_id(rs->request->headers, HEADER_CONTENT_LENGTH);
+        ssize_t length = content_length != NULL && str_isunum(content_length) ? (ssize_t) strtoull(content_length, NULL, 10) : -1;
+        stream->body = rs->request->body = post_stream_new(rs, length, (char*) (posted_content_type == NULL ? "application/x-www-form-urlencoded" : posted_content_type));
+        ((struct post_stream*) stream->body->data.stream.extra)->limit = sub_conn->conn->server->max_stream_post;
+    } else {
+        rs->request->body = pcalloc(rs->pool, sizeof(struct provision));
+        rs->request->body->pool = rs->pool;
+        rs->request->body->type = PROVISION_DATA;
+        rs->request->body->content_type = (char*) (posted_content_type == NULL ? "application/x-www-form-urlencoded" : posted_content_type);
+        rs->request->body->data.data.data = pmalloc(rs->pool, stream->data_buffer.size);
+        rs->request->body->data.data.size = buffer_pop(&stream->data_buffer, stream->data_buffer.size, rs->request->body->data.data.data);
+    }
 
     rs->response = pcalloc(rs->pool, sizeof(struct response));
     rs->response->headers = header_new(rs->pool);
@@ -172,6 +195,28 @@ int http2_start_connection(struct sub_conn* sub_conn) {
     return 0;
 }
 
+// whether a request whose headers are complete but whose body isn't should start right away with a streamed body
+int http2_stream_post(struct sub_conn* sub_conn, struct http2_stream* stream) {
+    size_t stream_post = sub_conn->conn->server->stream_post;
+    if (stream_post == 0 || !stream->headers_finished || stream->body != NULL || stream->state != STREAM_OPEN) {
+        return 0;
+    }
+    if (!http_stream_post_allowed(find_vhost(sub_conn->conn->server, header_get_id(stream->headers, HEADER_PSEUDO_AUTHORITY)))) {
+        return 0;
+    }
+    ITER_LLIST(loaded_modules, value) {
+        struct module* module = value;
+        // the vhost it ends up with isn't known yet
+        if (module->events.on_request_vhost_resolved) {
+            return 0;
+        }
+        ITER_LLIST_END();
+    }
+    const char* content_length = header_get_id(stream->headers, HEADER_CONTENT_LENGTH);
+    // without a length, it may well be large
+    return content_length == NULL || !str_isunum(content_length) || strtoull(content_length, NULL, 10) >= stream_post;
+}
+
 struct _hashmap_remove_callback_arg {
     struct hashmap* hashmap;
     uint32_t stream_id;
@@ -186,10 +231,27 @@ int receive_http2_frame(struct sub_conn* sub_conn, struct frame* frame) {
     struct http2_stream* stream = frame->stream_id == 0 ? NULL : hashmap_getint(extra->streams, frame->stream_id);
     switch (frame->type) {
         case FRAME_DATA_ID:;
+            if (stream == NULL && frame->stream_id != 0 && frame->stream_id < extra->other_min_next_stream) {
+                // closed, its response may have finished before the streamed request body did
+                break;
+            }
             if (stream == NULL || stream->state != STREAM_OPEN) {
                 http2_error(sub_conn, HTTP2_PROTOCOL_ERROR);
                 return 1;
             }
+            if (stream->body != NULL) {
+                // no flow control here, so nothing to hold the client back with. the initial window bounds it
+                pxfer(frame->pool, stream->body->pool, frame->data.data.data);
+                if (post_stream_push(stream->body, frame->data.data.data, frame->data.data.data_length) < 0) {
+                    http2_error(sub_conn, HTTP2_FRAME_SIZE_ERROR);
+                    return 1;
+                }
+                if (frame->flags & 0x1) {
+                    stream->state = STREAM_HALF_CLOSED_REMOTE;
+                    post_stream_finish(stream->body, 0);
+                }
+                break;
+            }
             if (frame->data.data.data_length + stream->data_buffer.size > sub_conn->conn->server->max_post) {
                 http2_error(sub_conn, HTTP2_FRAME_SIZE_ERROR); // TODO: this should probably be more graceful?
                 return 1;
@@ -212,6 +274,9 @@ int receive_http2_frame(struct sub_conn* sub_conn, struct frame* frame) {
                 stream->headers = header_new(stream->pool);
                 buffer_init(&stream->data_buffer, pool);
                 hashmap_putint(extra->streams, frame->stream_id, stream);
+                if (frame->stream_id >= extra->other_min_next_stream) {
+                    extra->other_min_next_stream = frame->stream_id + 2;
+                }
                 struct _hashmap_remove_callback_arg* callback_arg = pmalloc(stream->pool, sizeof(struct _hashmap_remove_callback_arg));
                 callback_arg->hashmap = extra->streams;
                 callback_arg->stream_id = stream->identifier;
@@ -231,6 +296,9 @@ int receive_http2_frame(struct sub_conn* sub_conn, struct frame* frame) {
                 stream->state = STREAM_HALF_CLOSED_REMOTE;
                 return handle_http2_request(sub_conn, stream);
             }
+            if (http2_stream_post(sub_conn, stream)) {
+                return handle_http2_request(sub_conn, stream);
+            }
             break;
         case FRAME_PRIORITY_ID:;
             printf("priority\n");
@@ -313,6 +381,9 @@ int receive_http2_frame(struct sub_conn* sub_conn, struct frame* frame) {
             if (frame->flags & 0x4) {
                 stream->headers_finished = 1;
             }
+            if (http2_stream_post(sub_conn, stream)) {
+                return handle_http2_request(sub_conn, stream);
+            }
             break;
         default:;
             // unknown packet type
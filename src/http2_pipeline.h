@@ -25,6 +25,7 @@ struct http2_stream {
     uint32_t identifier;
     struct headers* headers;
     struct buffer data_buffer;
+    struct provision* body; // a streamed request body still being received, see http2_stream_post
 };
 
 int http2_start_connection(struct sub_conn* sub_conn);
@@ -5,6 +5,9 @@
 #include "http_network.h"
 #include "http_pipeline.h"
 #include <avuna/http_util.h>
+#include <avuna/http_scan.h>
+#include <avuna/cache.h>
+#include <avuna/post_stream.h>
 #include <avuna/vhost.h>
 #include <avuna/http.h>
 #include <avuna/pmem.h>
@@ -15,6 +18,7 @@
 #include <avuna/module.h>
 #include <avuna/util.h>
 #include <errno.h>
+#include <strings.h>
 #include <arpa/inet.h>
 
 void log_request_session(struct request_session* rs, struct timespec* start) {
@@ -47,11 +51,50 @@ void log_request_session(struct request_session* rs, struct timespec* start) {
 
 
 void send_request_session_http11(struct request_session* rs, struct timespec* start) {
+    struct http_response_slot* slot = rs->extra;
+    header_setoradd(rs->response->headers, "Connection", slot->close ? "close" : "keep-alive");
     size_t response_length = 0;
     unsigned char* serialized_response = serializeResponse(rs, &response_length);
     log_request_session(rs, start);
-    buffer_push(&rs->src_conn->write_buffer, serialized_response, response_length);
-    trigger_write(rs->src_conn);
+    http_output(rs, serialized_response, response_length);
+    struct provision* body = rs->response->body;
+    if (body != NULL && body->type == PROVISION_DATA && body->data.data.size > 0 && !str_eq(rs->request->method, "HEAD")) {
+        // a write seals the pins, so every part that points into them goes in before it
+        struct http_server_extra* extra = rs->src_conn->extra;
+        int pulling = extra->pulling;
+        extra->pulling = 1;
+        // the body is written from where it is rather than copied behind the headers
+        int cached = rs->response->fromCache != NULL && rs->response->fromCache->body == body;
+        if (cached) {
+            cache_ref(rs->response->fromCache);
+            phook(http_output_pins(rs), (void (*)(void*)) cache_unref, rs->response->fromCache);
+        }
+        struct http_ranges* ranges = rs->response->ranges;
+        if (!cached || ranges != NULL) {
+            // a ranged body's framing lives in the request's pool too
+            pxfer_parent(rs->src_conn->pool, http_output_pins(rs), rs->pool);
+            slot->request_pinned = 1;
+        }
+        if (ranges == NULL) {
+            http_output(rs, body->data.data.data, body->data.data.size);
+        } else {
+            // each part is a slice of the body
+            for (size_t i = 0; i < ranges->count; ++i) {
+                struct http_range* range = &ranges->ranges[i];
+                if (range->part_header != NULL) {
+                    http_output(rs, (uint8_t*) range->part_header, range->part_header_length);
+                }
+                http_output(rs, (uint8_t*) body->data.data.data + range->start, range->length);
+            }
+            if (ranges->trailer != NULL) {
+                http_output(rs, (uint8_t*) ranges->trailer, ranges->trailer_length);
+            }
+        }
+        extra->pulling = pulling;
+        if (!pulling) {
+            trigger_write(rs->src_conn);
+        }
+    }
     ITER_LLIST(loaded_modules, value) {
         struct module* module = value;
         if (module->events.on_request_completed) {
@@ -61,233 +104,652 @@ void send_request_session_http11(struct request_session* rs, struct timespec* st
     }
 }
 
-void determine_vhost(struct request_session* rs, char* authority) {
+struct vhost* find_vhost(struct server_info* server, const char* authority) {
     if (authority == NULL) authority = "";
-    struct vhost* vhost = NULL;
-    for (size_t i = 0; i < rs->conn->server->vhosts->count; i++) {
-        struct vhost* iter_vhost = rs->conn->server->vhosts->data[i];
+    for (size_t i = 0; i < server->vhosts->count; i++) {
+        struct vhost* iter_vhost = server->vhosts->data[i];
         if (iter_vhost->hosts->count == 0) {
-            vhost = iter_vhost;
-            break;
-        } else
-            for (size_t x = 0; x < iter_vhost->hosts->count; x++) {
-                if (domeq(iter_vhost->hosts->data[x], authority)) {
-                    vhost = iter_vhost;
-                    break;
-                }
+            return iter_vhost;
+        }
+        for (size_t x = 0; x < iter_vhost->hosts->count; x++) {
+            if (domeq(iter_vhost->hosts->data[x], authority)) {
+                return iter_vhost;
             }
-        if (vhost != NULL) break;
+        }
+    }
+    return NULL;
+}
+
+void determine_vhost(struct request_session* rs, char* authority) {
+    rs->vhost = find_vhost(rs->conn->server, authority);
+}
+
+int http_stream_post_allowed(struct vhost* vhost) {
+    if (vhost == NULL || !vhost->sub->stream_post) {
+        return 0;
+    }
+    ITER_LLIST(loaded_modules, value) {
+        struct module* module = value;
+        // it's given the whole body before the response is generated
+        if (module->events.on_request_post_received) {
+            return 0;
+        }
+        ITER_LLIST_END();
     }
-    rs->vhost = vhost;
+    return 1;
 }
 
 void http_on_closed(struct sub_conn* sub_conn) {
     pfree(sub_conn->conn->pool);
 }
 
-int http_stream_notify(struct request_session* rs) {
+void http_refresh_timeout(struct sub_conn* sub_conn) {
+    struct http_server_extra* extra = sub_conn->extra;
+    if (sub_conn->tls_state == TLS_STATE_HANDSHAKE) {
+        sub_conn_set_timeout(sub_conn, TIMEOUT_HEADER);
+    } else if (extra->currently_posting != NULL && !sub_conn->read_paused) {
+        // the client owes the rest of the body, whatever responses are open
+        sub_conn_set_timeout(sub_conn, TIMEOUT_BODY);
+    } else if (sub_conn->read_buffer.size > 0 && extra->in_flight < HTTP_PIPELINE_DEPTH && extra->held == NULL) {
+        // a partial head, also when it sits behind open slots
+        sub_conn_set_timeout(sub_conn, TIMEOUT_HEADER);
+    } else if (extra->slots != NULL || sub_conn->read_paused) {
+        // up to the backend how long this takes
+        sub_conn_set_timeout(sub_conn, TIMEOUT_NONE);
+    } else {
+        sub_conn_set_timeout(sub_conn, TIMEOUT_KEEPALIVE);
+    }
+}
+
+// the slot at the head of the queue is the response on the wire, everything behind it is held back in order
+void http_output(struct request_session* rs, uint8_t* data, size_t size) {
     struct http_server_extra* extra = rs->src_conn->extra;
+    struct http_response_slot* slot = rs->extra;
+    if (slot != extra->slots) {
+        buffer_push(&slot->output, data, size);
+        return;
+    }
+    buffer_push(&rs->src_conn->write_buffer, data, size);
+    if (!extra->pulling) {
+        trigger_write(rs->src_conn);
+    }
+}
+
+struct mempool* http_output_pins(struct request_session* rs) {
+    struct http_server_extra* extra = rs->src_conn->extra;
+    struct http_response_slot* slot = rs->extra;
+    if (slot == extra->slots) {
+        return sub_conn_write_pins(rs->src_conn);
+    }
+    if (slot->pins == NULL) {
+        slot->pins = mempool_new();
+        pchild(rs->src_conn->pool, slot->pins);
+    }
+    return slot->pins;
+}
+
+struct http_response_slot* http_slot_open(struct sub_conn* sub_conn, struct request_session* rs) {
+    struct http_server_extra* extra = sub_conn->extra;
+    struct http_response_slot* slot = extra->free_slots;
+    if (slot != NULL) {
+        extra->free_slots = slot->next;
+    } else {
+        slot = pcalloc(sub_conn->pool, sizeof(struct http_response_slot));
+        buffer_init(&slot->output, sub_conn->pool);
+    }
+    slot->complete = 0;
+    slot->close = 0;
+    slot->request_pinned = 0;
+    slot->pull = NULL;
+    slot->paused = NULL;
+    slot->next = NULL;
+    if (extra->slots_tail == NULL) {
+        extra->slots = slot;
+    } else {
+        extra->slots_tail->next = slot;
+    }
+    extra->slots_tail = slot;
+    ++extra->in_flight;
+    rs->extra = slot;
+    return slot;
+}
+
+// the held entries are moved over as they are, both buffers belong to the sub_conn's pool
+void http_slot_release_output(struct sub_conn* sub_conn, struct http_response_slot* slot) {
+    for (struct llist_node* node = slot->output.buffers->head; node != NULL; ) {
+        struct buffer_entry* entry = node->data;
+        llist_append(sub_conn->write_buffer.buffers, entry);
+        sub_conn->write_buffer.size += entry->size;
+        struct llist_node* next = node->next;
+        llist_del(slot->output.buffers, node);
+        node = next;
+    }
+    slot->output.size = 0;
+    if (slot->pins != NULL) {
+        pxfer_parent(sub_conn->pool, sub_conn_write_pins(sub_conn), slot->pins);
+        slot->pins = NULL;
+    }
+}
+
+// once the response that asked for it is written
+void http_close_if_answered(struct sub_conn* sub_conn) {
+    struct http_server_extra* extra = sub_conn->extra;
+    if (extra->closing && extra->slots == NULL && sub_conn->write_buffer.size == 0 && !sub_conn->safe_close) {
+        // the worker closes it outside of whatever wrote the last of it
+        sub_conn->safe_close = 1;
+        sub_conn_resume(sub_conn);
+    }
+}
+
+// the slot's request session may already be freed
+void http_slot_complete(struct sub_conn* sub_conn, struct http_response_slot* slot) {
+    struct http_server_extra* extra = sub_conn->extra;
+    int was_full = extra->in_flight >= HTTP_PIPELINE_DEPTH;
+    slot->complete = 1;
+    while (extra->slots != NULL && extra->slots->complete) {
+        struct http_response_slot* done = extra->slots;
+        extra->slots = done->next;
+        if (extra->slots == NULL) {
+            extra->slots_tail = NULL;
+        }
+        done->next = extra->free_slots;
+        extra->free_slots = done;
+        --extra->in_flight;
+        if (extra->slots != NULL) {
+            http_slot_release_output(sub_conn, extra->slots);
+        }
+    }
+    http_pull_stream(sub_conn);
+    trigger_write(sub_conn);
+    if (was_full && extra->in_flight < HTTP_PIPELINE_DEPTH && sub_conn->read_buffer.size > 0) {
+        // parsing stopped at the pipeline depth, the worker picks it up again outside of whatever completed this
+        sub_conn_resume(sub_conn);
+    } else if (extra->held != NULL && extra->slots == NULL) {
+        // the request that waited for everything in front of it
+        sub_conn_resume(sub_conn);
+    }
+    http_close_if_answered(sub_conn);
+}
+
+int http_stream_notify(struct request_session* rs) {
+    struct http_response_slot* slot = rs->extra;
     struct provision* provision = rs->response->body;
     struct provision_data data;
     data.data = NULL;
     data.size = 0;
     ssize_t total_read = provision->data.stream.read(provision, &data);
+    if (total_read == -1 || total_read == 0) {
+        slot->pull = NULL;
+        slot->paused = NULL;
+    }
     if (total_read == -1) {
+        struct sub_conn* src_conn = rs->src_conn;
+        http_post_abandon(src_conn->extra, rs);
         pfree(rs->pool);
-        extra->currently_streaming = NULL;
-        // backend server failed during stream
+        // backend server failed during stream, the response is cut short and anything behind it would be read as its body
+        src_conn->safe_close = 1;
+        sub_conn_resume(src_conn);
     } else if (total_read == 0) {
         // end of stream
         if (data.size > 0) {
             pxfer(provision->pool, rs->src_conn->pool, data.data);
-            buffer_push(&rs->src_conn->write_buffer, data.data, data.size);
-            trigger_write(rs->src_conn);
+            http_output(rs, data.data, data.size);
         }
+        struct sub_conn* src_conn = rs->src_conn;
+        http_post_abandon(src_conn->extra, rs);
         pfree(rs->pool);
-        extra->currently_streaming = NULL;
+        http_slot_complete(src_conn, slot);
+        http_refresh_timeout(src_conn);
     } else if (total_read == -2) {
         // nothing to read, not end of stream
         return 0;
     } else {
         pxfer(provision->pool, rs->src_conn->pool, data.data);
-        buffer_push(&rs->src_conn->write_buffer, data.data, data.size);
-        trigger_write(rs->src_conn);
+        http_output(rs, data.data, data.size);
+        struct sub_conn* source = provision->data.stream.source;
+        size_t held = slot == ((struct http_server_extra*) rs->src_conn->extra)->slots ? rs->src_conn->write_buffer.size : slot->output.size;
+        if (source != NULL && held >= HTTP_HELD_OUTPUT_MAX) {
+            // tcp holds the backend back until the client caught up, see http_pull_stream
+            source->read_paused = 1;
+            slot->paused = source;
+        }
         return 0;
     }
     return 1;
 }
 
+// whether a file body can go from the page cache to the socket, with nothing in between that needs to see its bytes.
+// under kTLS the kernel encrypts what sendfile hands it
+int http_can_send_file(struct sub_conn* sub_conn, struct request_session* rs) {
+    return sub_conn->uring == NULL && (!sub_conn->tls || sub_conn->ktls_send) && rs->response->body->data.stream.read == file_stream_read;
+}
 
-int handle_http_server_read(struct sub_conn* sub_conn, uint8_t* read_buf, size_t read_buf_len) {
+// the zero-copy http_stream_notify for a file at the head of the pipeline, 1 once the socket is full
+int http_send_file(struct sub_conn* sub_conn, struct request_session* rs) {
+    struct http_response_slot* slot = rs->extra;
+    struct provision_data framing;
+    ssize_t status = file_stream_send(rs->response->body, sub_conn->fd, &framing);
+    if (status == -2) {
+        // EPOLLOUT calls on_written with nothing buffered, see work_handle_event
+        sub_conn->write_available = 0;
+        return 1;
+    }
+    if (framing.size > 0) {
+        // the ranges go with rs->pool, which can be gone before this is written
+        uint8_t* copy = pmalloc(sub_conn->pool, framing.size);
+        memcpy(copy, framing.data, framing.size);
+        buffer_push(&sub_conn->write_buffer, copy, framing.size);
+    }
+    if (status == -1) {
+        slot->pull = NULL;
+        http_post_abandon(sub_conn->extra, rs);
+        pfree(rs->pool);
+        // the response is cut short and anything behind it would be read as its body
+        sub_conn->safe_close = 1;
+        sub_conn_resume(sub_conn);
+        return 1;
+    } else if (status == 0) {
+        slot->pull = NULL;
+        http_post_abandon(sub_conn->extra, rs);
+        pfree(rs->pool);
+        http_slot_complete(sub_conn, slot);
+        http_refresh_timeout(sub_conn);
+    }
+    return 0;
+}
+
+void http_pull_stream(struct sub_conn* sub_conn) {
     struct http_server_extra* extra = sub_conn->extra;
-    buffer_push(&sub_conn->read_buffer, read_buf, read_buf_len);
-    restart:;
+    if (extra->pulling) {
+        return;
+    }
+    extra->pulling = 1;
+    // one read at a time, the next once it was written, so a file is never held in memory as a whole
+    while (extra->slots != NULL && extra->slots->pull != NULL && sub_conn->write_buffer.size == 0 && !sub_conn->safe_close) {
+        struct request_session* rs = extra->slots->pull;
+        if (!http_can_send_file(sub_conn, rs)) {
+            http_stream_notify(rs);
+        } else if (http_send_file(sub_conn, rs)) {
+            break;
+        }
+    }
+    extra->pulling = 0;
+    struct http_response_slot* head = extra->slots;
+    if (head != NULL && head->paused != NULL && sub_conn->write_buffer.size == 0 && !sub_conn->safe_close) {
+        // everything held was written, slots behind the head stay paused until their turn
+        head->paused->read_paused = 0;
+        sub_conn_resume(head->paused);
+        head->paused = NULL;
+    }
+    http_close_if_answered(sub_conn);
+}
 
-    // active post reading
-    if (extra->currently_posting != NULL) {
-        struct provision* provision = extra->currently_posting->request->body;
-        if (provision->type == PROVISION_DATA && sub_conn->read_buffer.size >= provision->data.data.size) {
-            struct timespec stt;
-            clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &stt);
-            pxfer(provision->pool, sub_conn->pool, provision->data.data.data);
-            buffer_pop(&sub_conn->read_buffer, provision->data.data.size, provision->data.data.data);
-            ITER_LLIST(loaded_modules, value) {
-                struct module* module = value;
-                if (module->events.on_request_post_received && module->events.on_request_post_received(module, extra->currently_posting)) {
-                    return 1;
-                }
-                ITER_LLIST_END();
-            }
-            if (!extra->skip_generate_response) {
-                generateResponse(extra->currently_posting);
-            }
-            if (extra->currently_posting->response->body != NULL && extra->currently_posting->response->body->type == PROVISION_STREAM) {
-                extra->currently_streaming = extra->currently_posting;
-                if (extra->currently_posting->response->body->data.stream.delay_header_output) {
-                    memcpy(&extra->currently_posting->response->body->data.stream.delayed_start, &stt, sizeof(struct timespec));
-                    extra->currently_posting->response->body->data.stream.delay_finish = send_request_session_http11;
-                } else {
-                    send_request_session_http11(extra->currently_posting, &stt);
-                }
-                extra->currently_posting = NULL;
-                goto restart;
-            } else {
-                send_request_session_http11(extra->currently_posting, &stt);
-                pfree(extra->currently_posting->pool);
-                extra->currently_posting = NULL;
+// the rest of the worker's buffer goes behind the read buffer, for anything that consumes more than whole heads
+void http_keep_direct(struct sub_conn* sub_conn, struct http_server_extra* extra) {
+    sub_conn_keep(sub_conn, extra->direct, extra->direct_size);
+    extra->direct = NULL;
+    extra->direct_size = 0;
+}
+
+// byte count of the next complete request head in the read buffer, or -1. resumes where the previous call stopped.
+// with the read buffer empty it's at the start of extra->direct instead, and is kept there if it's partial
+ssize_t http_next_head(struct sub_conn* sub_conn, struct http_server_extra* extra) {
+    if (sub_conn->read_buffer.size == 0 && extra->direct_size > 0) {
+        ssize_t end = http_scan_headers_end(extra->direct, extra->direct_size, &extra->scan_state);
+        if (end >= 0) {
+            extra->scan_state = 0;
+            return end;
+        }
+        extra->scanned = extra->direct_size;
+        http_keep_direct(sub_conn, extra);
+        return -1;
+    }
+    size_t offset = 0;
+    for (struct llist_node* node = sub_conn->read_buffer.buffers->head; node != NULL; node = node->next) {
+        struct buffer_entry* entry = node->data;
+        if (offset + entry->size > extra->scanned) {
+            size_t skip = extra->scanned - offset;
+            ssize_t end = http_scan_headers_end((uint8_t*) entry->data + skip, entry->size - skip, &extra->scan_state);
+            if (end >= 0) {
+                extra->scanned = 0;
+                extra->scan_state = 0;
+                return (ssize_t) (offset + skip + end);
             }
-        } else { // PROVISION_STREAM
-            errlog(delog, "Invalid state! STREAM found during active post read");
-            return 0;
+            extra->scanned = offset + entry->size;
         }
+        offset += entry->size;
     }
+    return -1;
+}
 
-    if (extra->currently_streaming != NULL) {
+void http_post_drained(struct post_stream* stream) {
+    struct sub_conn* sub_conn = stream->protocol_extra;
+    sub_conn->read_paused = 0;
+    sub_conn_resume(sub_conn);
+}
+
+// moves the read buffer into the streamed body of currently_posting, 1 while more of it is to come, -1 if it's malformed,
+// -2 if it's over its limit
+int http_feed_post(struct sub_conn* sub_conn, struct http_server_extra* extra) {
+    struct provision* body = extra->currently_posting->request->body;
+    struct post_stream* stream = body->data.stream.extra;
+    if (stream->chunked != NULL) {
+        int status = post_stream_push_chunked(body, &sub_conn->read_buffer);
+        extra->scanned = 0;
+        extra->scan_state = 0;
+        if (status < 0) {
+            return status;
+        } else if (status == 1) {
+            sub_conn->read_paused = 1;
+        }
+        if (stream->chunked->state != CHUNKED_DONE) {
+            return 1;
+        }
+        extra->currently_posting = NULL;
+        post_stream_finish(body, 0);
         return 0;
     }
+    size_t size = sub_conn->read_buffer.size < stream->remaining ? sub_conn->read_buffer.size : stream->remaining;
+    if (size > 0) {
+        uint8_t* data = pmalloc(body->pool, size);
+        buffer_pop(&sub_conn->read_buffer, size, data);
+        extra->scanned = 0;
+        extra->scan_state = 0;
+        if (post_stream_push(body, data, size)) {
+            // the provider is behind, the rest waits in the socket until it caught up
+            sub_conn->read_paused = 1;
+        }
+    }
+    if (stream->remaining > 0) {
+        return 1;
+    }
+    extra->currently_posting = NULL;
+    post_stream_finish(body, 0);
+    return 0;
+}
 
-    //TODO: while the HTTP spec doesn't allow \n, we should probably accept it similar to other implementations
-    size_t match_length = 0;
-    static unsigned char newlines[4] = {0x0D, 0x0A, 0x0D, 0x0A};
+int http_request_closes(struct request_session* rs) {
+    // keep-alive is the default from HTTP/1.1 on, HTTP/1.0 has to ask for it
+    int closes = str_eq(rs->request->http_version, "HTTP/1.0");
+    const char* connection = header_get_id(rs->request->headers, HEADER_CONNECTION);
+    while (connection != NULL && *connection != 0) {
+        while (*connection == ' ' || *connection == '\t' || *connection == ',') {
+            ++connection;
+        }
+        size_t length = strcspn(connection, " \t,");
+        if (length == 5 && strncasecmp(connection, "close", 5) == 0) {
+            return 1;
+        } else if (length == 10 && strncasecmp(connection, "keep-alive", 10) == 0) {
+            closes = 0;
+        }
+        connection += length;
+    }
+    return closes;
+}
 
-    // shrink read_buf if it was part header
-    if (sub_conn->read_buffer.size < read_buf_len) {
-        size_t shrink = read_buf_len - sub_conn->read_buffer.size;
-        read_buf += shrink;
-        read_buf_len -= shrink;
+void http_post_abandon(struct http_server_extra* extra, struct request_session* rs) {
+    if (extra->currently_posting != rs || rs->request->body->type != PROVISION_STREAM) {
+        return;
+    }
+    struct post_stream* stream = rs->request->body->data.stream.extra;
+    if (stream->chunked != NULL) {
+        // its end is only found by decoding the rest
+        extra->discard_chunked = *stream->chunked;
+        extra->discarding_chunked = 1;
+    } else {
+        extra->discarding = stream->remaining;
+    }
+    extra->currently_posting = NULL;
+    if (rs->src_conn->read_paused) {
+        rs->src_conn->read_paused = 0;
+        sub_conn_resume(rs->src_conn);
     }
+}
 
-    if (read_buf_len == 0) {
-        return 0;
+void http_respond(struct http_server_extra* extra, struct request_session* rs, int skip_generate_response, struct timespec* stt) {
+    if (!skip_generate_response) {
+        generateResponse(rs);
     }
+    struct provision* body = rs->response->body;
+    // a file has no body to send for HEAD, so it's done with the headers
+    int pull = body != NULL && body->type == PROVISION_STREAM && body->data.stream.stream_fd >= 0;
+    if (body != NULL && body->type == PROVISION_STREAM && !(pull && str_eq(rs->request->method, "HEAD"))) {
+        // completes through http_stream_notify
+        if (body->data.stream.delay_header_output) {
+            memcpy(&body->data.stream.delayed_start, stt, sizeof(struct timespec));
+            body->data.stream.delay_finish = send_request_session_http11;
+        } else {
+            send_request_session_http11(rs, stt);
+        }
+        if (pull) {
+            // nothing announces a file being readable, it's read as the socket drains instead
+            struct sub_conn* src_conn = rs->src_conn;
+            ((struct http_response_slot*) rs->extra)->pull = rs;
+            http_pull_stream(src_conn);
+            trigger_write(src_conn);
+        }
+    } else {
+        send_request_session_http11(rs, stt);
+        struct sub_conn* src_conn = rs->src_conn;
+        struct http_response_slot* slot = rs->extra;
+        http_post_abandon(extra, rs);
+        if (!slot->request_pinned) {
+            pfree(rs->pool);
+        }
+        http_slot_complete(src_conn, slot);
+    }
+}
 
-    // prepare match_length from previous buffer
-    struct llist_node* read_tail = sub_conn->read_buffer.buffers->tail;
-    if (read_tail != NULL) {
-        struct buffer_entry* entry = read_tail->data;
-        if (entry->data == read_buf) {
-            if (read_tail->prev == NULL) { // could be popped above
-                goto post_precheck;
-            }
-            entry = read_tail->prev->data;
-        }
-        ssize_t checking_index = entry->size - 3;
-        if (checking_index < 0)
-            checking_index = 0;
-        for (; checking_index < entry->size; ++checking_index) {
-            char c = ((char*) entry->data)[checking_index];
-            if (c == newlines[match_length]) {
-                match_length++;
-                if (match_length == 4) {
-                    errlog(sub_conn->conn->server->logsess, "Invalid state! This should never happen.");
-                }
-            } else if (c == newlines[0]) {
-                match_length = 1;
-            } else {
-                match_length = 0;
+int http_server_consume(struct sub_conn* sub_conn, struct http_server_extra* extra);
+
+int handle_http_server_read(struct sub_conn* sub_conn, uint8_t* read_buf, size_t read_buf_len) {
+    struct http_server_extra* extra = sub_conn->extra;
+    extra->direct = read_buf;
+    extra->direct_size = read_buf_len;
+    if (sub_conn->read_buffer.size > 0) {
+        // behind a partial head or body
+        http_keep_direct(sub_conn, extra);
+    }
+    int status = http_server_consume(sub_conn, extra);
+    if (status == 0) {
+        // a partial head, a body or requests past the pipeline depth, read_buf is the worker's again once this returns
+        http_keep_direct(sub_conn, extra);
+    }
+    return status;
+}
+
+int http_server_consume(struct sub_conn* sub_conn, struct http_server_extra* extra) {
+    // whatever was answered or taken in the loop below starts over here, rather than recursing once per request
+    next:;
+    if (extra->direct_size > 0 && (extra->discarding > 0 || extra->discarding_chunked || extra->currently_posting != NULL || extra->closing)) {
+        // bodies are read from the read buffer only
+        http_keep_direct(sub_conn, extra);
+    }
+    if (extra->discarding > 0) {
+        size_t size = sub_conn->read_buffer.size < extra->discarding ? sub_conn->read_buffer.size : extra->discarding;
+        buffer_skip(&sub_conn->read_buffer, size);
+        extra->discarding -= size;
+        extra->scanned = 0;
+        extra->scan_state = 0;
+        if (extra->discarding > 0) {
+            return 0;
+        }
+    }
+    if (extra->discarding_chunked) {
+        int status = chunked_decode(&extra->discard_chunked, &sub_conn->read_buffer, NULL);
+        extra->scanned = 0;
+        extra->scan_state = 0;
+        if (status < 0) {
+            return 1;
+        } else if (status == 0) {
+            return 0;
+        }
+        extra->discarding_chunked = 0;
+    }
+
+    // active post reading
+    struct request_session* posted = NULL;
+    if (extra->currently_posting != NULL && extra->currently_posting->request->body->type == PROVISION_STREAM) {
+        struct request_session* rs = extra->currently_posting;
+        struct post_stream* stream = rs->request->body->data.stream.extra;
+        int status = http_feed_post(sub_conn, extra);
+        if (status == -2 && stream->buffered) {
+            // the rest is decoded and dropped behind the error, see http_post_abandon
+            struct timespec stt;
+            clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &stt);
+            rs->response->code = "413 Payload Too Large";
+            generateBaseErrorPage(rs, "The request body is larger than this server accepts.");
+            http_respond(extra, rs, 1, &stt);
+            goto next;
+        } else if (status == -2) {
+            errlog(sub_conn->conn->server->logsess, "Chunked request body over max-stream-post");
+            return 1;
+        } else if (status < 0) {
+            errlog(sub_conn->conn->server->logsess, "Malformed chunked request body");
+            return 1;
+        } else if (status > 0) {
+            return 0;
+        }
+        if (stream->buffered) {
+            post_stream_collect(rs->request->body);
+            posted = rs;
+        }
+    } else if (extra->currently_posting != NULL) {
+        struct provision* provision = extra->currently_posting->request->body;
+        if (sub_conn->read_buffer.size < provision->data.data.size) {
+            return 0;
+        }
+        pxfer(provision->pool, sub_conn->pool, provision->data.data.data);
+        buffer_pop(&sub_conn->read_buffer, provision->data.data.size, provision->data.data.data);
+        extra->scanned = 0;
+        extra->scan_state = 0;
+        posted = extra->currently_posting;
+        extra->currently_posting = NULL;
+    }
+    if (posted != NULL) {
+        struct timespec stt;
+        clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &stt);
+        ITER_LLIST(loaded_modules, value) {
+            struct module* module = value;
+            if (module->events.on_request_post_received && module->events.on_request_post_received(module, posted)) {
+                return 1;
             }
+            ITER_LLIST_END();
         }
+        http_respond(extra, posted, extra->skip_generate_response, &stt);
+    }
+
+    if (extra->closing) {
+        // anything pipelined behind a request that closes the conn goes unanswered
+        buffer_skip(&sub_conn->read_buffer, sub_conn->read_buffer.size);
+        extra->scanned = 0;
+        extra->scan_state = 0;
+        return 0;
     }
-    post_precheck:;
 
-    // match double newline
-    for (size_t checking_index = 0; checking_index < read_buf_len; ++checking_index) {
-        char c = read_buf[checking_index];
-        if (c == newlines[match_length]) {
-            match_length++;
-            if (match_length != 4) {
-                continue;
+    //TODO: while the HTTP spec doesn't allow \n, we should probably accept it similar to other implementations
+
+    // requests behind a streaming response are parsed and answered ahead of time, up to HTTP_PIPELINE_DEPTH.
+    // only GET and HEAD though, anything else waits until every response in front of it is complete (RFC 9112 9.3.2)
+    for (;;) {
+        struct request_session* rs = extra->held;
+        struct timespec stt;
+        clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &stt);
+        if (rs != NULL) {
+            if (extra->slots != NULL) {
+                // picked up again by http_slot_complete
+                break;
+            }
+            extra->held = NULL;
+        } else {
+            ssize_t req_size;
+            if (extra->closing || extra->in_flight >= HTTP_PIPELINE_DEPTH || (req_size = http_next_head(sub_conn, extra)) < 0) {
+                break;
             }
             struct mempool* req_pool = mempool_new();
             pchild(sub_conn->pool, req_pool);
-            size_t req_size = sub_conn->read_buffer.size + checking_index + 1 - read_buf_len;
-            unsigned char* request_headers = pmalloc(req_pool, req_size + 1);
-            buffer_pop(&sub_conn->read_buffer, req_size, request_headers);
+            unsigned char* request_headers = pmalloc(req_pool, (size_t) req_size + 1);
+            if (sub_conn->read_buffer.size == 0) {
+                memcpy(request_headers, extra->direct, (size_t) req_size);
+                extra->direct += req_size;
+                extra->direct_size -= req_size;
+            } else {
+                buffer_pop(&sub_conn->read_buffer, (size_t) req_size, request_headers);
+            }
             request_headers[req_size] = 0;
+            // the next request head gets a fresh header timeout
+            sub_conn_set_timeout(sub_conn, TIMEOUT_NONE);
 
-            struct timespec stt;
-            clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &stt);
-
-            struct request_session* rs = pcalloc(req_pool, sizeof(struct request_session));
+            rs = pcalloc(req_pool, sizeof(struct request_session));
             rs->conn = sub_conn->conn;
             rs->src_conn = sub_conn;
             rs->request = pcalloc(req_pool, sizeof(struct request));
             rs->pool = req_pool;
-            if (parseRequest(rs, (char*) request_headers, sub_conn->conn->server->max_post) < 0) {
+            if (parseRequest(rs, (char*) request_headers) < 0) {
                 errlog(sub_conn->conn->server->logsess, "Malformed Request!\n%s", request_headers);
                 return 1;
             }
-            rs->response = pcalloc(rs->pool, sizeof(struct response));
-            rs->response->headers = header_new(rs->pool);
-            rs->response->http_version = "HTTP/1.1";
-            rs->response->code = "200 OK";
-            int skip_generate_response = 0;
-            ITER_LLIST(loaded_modules, value) {
-                struct module* module = value;
-                if (module->events.on_request_received) {
-                    int status = module->events.on_request_received(module, rs);
-                    if (status == 1) {
-                        skip_generate_response = 1;
-                        break;
-                    } else if (status == -1) {
-                        return 1;
-                    }
-                }
-                ITER_LLIST_END();
+            if (extra->slots != NULL && !str_eq(rs->request->method, "GET") && !str_eq(rs->request->method, "HEAD")) {
+                // its body, if any, stays in the read buffer behind it
+                extra->held = rs;
+                break;
             }
-            determine_vhost(rs, header_get(rs->request->headers, "Host"));
-            ITER_LLIST(loaded_modules, value) {
-                struct module* module = value;
-                if (module->events.on_request_vhost_resolved) {
-                    rs->vhost = module->events.on_request_vhost_resolved(module, rs, rs->vhost);
+        }
+        struct http_response_slot* slot = http_slot_open(sub_conn, rs);
+        if (http_request_closes(rs)) {
+            slot->close = 1;
+            extra->closing = 1;
+        }
+        rs->response = pcalloc(rs->pool, sizeof(struct response));
+        rs->response->headers = header_new(rs->pool);
+        rs->response->http_version = "HTTP/1.1";
+        rs->response->code = "200 OK";
+        int skip_generate_response = 0;
+        ITER_LLIST(loaded_modules, value) {
+            struct module* module = value;
+            if (module->events.on_request_received) {
+                int status = module->events.on_request_received(module, rs);
+                if (status == 1) {
+                    skip_generate_response = 1;
+                    break;
+                } else if (status == -1) {
+                    return 1;
                 }
-                ITER_LLIST_END();
-            }
-            if (rs->request->body != NULL && rs->request->body->type == PROVISION_DATA) {
-                extra->currently_posting = rs;
-                extra->skip_generate_response = skip_generate_response;
-                goto restart;
             }
-            if (!skip_generate_response) {
-                generateResponse(rs);
-            }
-            if (rs->response->body != NULL && rs->response->body->type == PROVISION_STREAM) {
-                extra->currently_streaming = rs;
-                if (rs->response->body->data.stream.delay_header_output) {
-                    memcpy(&rs->response->body->data.stream.delayed_start, &stt, sizeof(struct timespec));
-                    rs->response->body->data.stream.delay_finish = send_request_session_http11;
-                } else {
-                    send_request_session_http11(rs, &stt);
-                }
-                goto restart;
-            } else {
-                send_request_session_http11(rs, &stt);
-                pfree(req_pool);
+            ITER_LLIST_END();
+        }
+        determine_vhost(rs, header_get_id(rs->request->headers, HEADER_HOST));
+        ITER_LLIST(loaded_modules, value) {
+            struct module* module = value;
+            if (module->events.on_request_vhost_resolved) {
+                rs->vhost = module->events.on_request_vhost_resolved(module, rs, rs->vhost);
             }
-        } else if (c == newlines[0])
-            match_length = 1;
-        else
-            match_length = 0;
+            ITER_LLIST_END();
+        }
+        // a vhost that can't take a streamed body gets it buffered, up to max_post like any other
+        struct server_info* server = sub_conn->conn->server;
+        if (parseRequestBody(rs, server->max_post, http_stream_post_allowed(rs->vhost) ? server->stream_post : 0, server->max_stream_post) < 0) {
+            // answered right away, the body is skipped by http_post_abandon
+            rs->response->code = "413 Payload Too Large";
+            generateBaseErrorPage(rs, "The request body is larger than this server accepts.");
+            skip_generate_response = 1;
+        }
+        struct provision* body = rs->request->body;
+        if (body != NULL && (body->type == PROVISION_DATA || ((struct post_stream*) body->data.stream.extra)->buffered)) {
+            extra->currently_posting = rs;
+            extra->skip_generate_response = skip_generate_response;
+            // the body comes next, so no further heads until it's complete
+            goto next;
+        } else if (body != NULL) {
+            // the provider is set up first and then fed the body as it arrives, see http_feed_post
+            struct post_stream* stream = rs->request->body->data.stream.extra;
+            stream->on_drained = http_post_drained;
+            stream->protocol_extra = sub_conn;
+            extra->currently_posting = rs;
+            http_respond(extra, rs, skip_generate_response, &stt);
+            goto next;
+        }
+        http_respond(extra, rs, skip_generate_response, &stt);
     }
     return 0;
-}
\ No newline at end of file
+}
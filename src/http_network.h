@@ -11,20 +11,72 @@
 #include <stdint.h>
 #include <time.h>
 
+#define HTTP_PIPELINE_DEPTH 16 // parsed requests awaiting their response per connection
+#define HTTP_HELD_OUTPUT_MAX 262144 // unwritten bytes of a response before the backend it streams from stops being read
+
+// a response's place on the connection, in request order
+struct http_response_slot {
+    struct buffer output; // held until every slot in front of it completed
+    struct mempool* pins; // NULL or what output points into, handed to the sub_conn's write pins along with it
+    int request_pinned; // the request's pool went with the pins instead of being freed on completion
+    struct request_session* pull; // a file body read as the socket drains, see http_pull_stream
+    struct sub_conn* paused; // NULL or the backend left unread until the output is written, see HTTP_HELD_OUTPUT_MAX
+    int complete;
+    int close; // the client asked for the conn to be closed behind this response
+    struct http_response_slot* next;
+};
+
 struct http_server_extra {
     struct request_session* currently_posting;
     int skip_generate_response;
-    struct request_session* currently_streaming;
+    struct http_response_slot* slots; // head is the response on the wire
+    struct http_response_slot* slots_tail;
+    struct http_response_slot* free_slots;
+    size_t in_flight;
+    size_t discarding; // bytes of an abandoned streamed request body still to skip, see http_post_abandon
+    struct chunked_decoder discard_chunked; // where an abandoned chunked request body was left off
+    int discarding_chunked;
+    int pulling; // inside http_pull_stream or pushing a body's parts, output is written by whoever set it
+    size_t scanned; // bytes of read_buffer already searched for the end of a request head
+    int scan_state;
+    uint8_t* direct; // what's left of the worker's buffer while it's handled, heads are taken from it without a copy
+    size_t direct_size;
+    struct request_session* held; // parsed but not dispatched until every slot in front of it completed, see handle_http_server_read
+    int closing; // a request asked for the conn to be closed, nothing behind it is parsed and it's closed once answered
 };
 
 void log_request_session(struct request_session* rs, struct timespec* start);
 
+// the first of server's vhosts that serves authority, NULL if none does
+struct vhost* find_vhost(struct server_info* server, const char* authority);
+
 void determine_vhost(struct request_session* rs, char* authority);
 
+// whether a request body may be handed to vhost as it arrives rather than buffered, see vhost_type.stream_post.
+// never while a module has on_request_post_received
+int http_stream_post_allowed(struct vhost* vhost);
+
 void http_on_closed(struct sub_conn* sub_conn);
 
+void http_refresh_timeout(struct sub_conn* sub_conn);
+
+// writes the response data for rs in request order, see http_response_slot
+void http_output(struct request_session* rs, uint8_t* data, size_t size);
+
+// a pool that lives until rs's output pushed ahead of the next write was written, see sub_conn_write_pins
+struct mempool* http_output_pins(struct request_session* rs);
+
+// a response can finish before its streamed request body did, what's left of the body is then read and dropped
+// whether the client doesn't keep the conn alive past rs, RFC 9112 9.3
+int http_request_closes(struct request_session* rs);
+
+void http_post_abandon(struct http_server_extra* extra, struct request_session* rs);
+
 int handle_http_server_read(struct sub_conn* sub_conn, uint8_t* read_buf, size_t read_buf_len);
 
 int http_stream_notify(struct request_session* rs);
 
+// reads the next piece of the file body at the head of the pipeline once everything before it was written, the sub_conn's on_written
+void http_pull_stream(struct sub_conn* sub_conn);
+
 #endif //AVUNA_HTTPD_HTTP_NETWORK_H
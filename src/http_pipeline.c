@@ -6,7 +6,6 @@
 #include "http2_network.h"
 #include <avuna/string.h>
 #include <avuna/http_util.h>
-#include <avuna/version.h>
 #include <avuna/mime.h>
 #include <avuna/pmem_hooks.h>
 #include <avuna/provider.h>
@@ -59,8 +58,7 @@ int domeq(const char* dom1, const char* dom2) {
 int generateResponse(struct request_session* rs) {
     restart:;
     rs->response->body = NULL;
-    header_add(rs->response->headers, "Server", "Avuna/" VERSION);
-    header_add(rs->response->headers, "Connection", "keep-alive");
+    // Server and Date are added by serializeResponse and hpack_encode, Connection by send_request_session_http11
     int vhost_action = VHOST_ACTION_NONE;
     if (rs->vhost == NULL) {
         rs->response->code = "500 Internal Server Error";
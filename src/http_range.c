@@ -0,0 +1,142 @@
+#include <avuna/http_range.h>
+#include <avuna/http.h>
+#include <avuna/headers.h>
+#include <avuna/string.h>
+#include <avuna/pmem.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+
+static __thread uint64_t boundary_counter;
+
+// a decimal byte position at *cursor, moving it past. 0 if there is none or it overflows
+static int parse_position(const char** cursor, size_t* position) {
+    const char* c = *cursor;
+    if (*c < '0' || *c > '9') {
+        return 0;
+    }
+    size_t value = 0;
+    for (; *c >= '0' && *c <= '9'; ++c) {
+        if (value > (SIZE_MAX - 9) / 10) {
+            return 0;
+        }
+        value = value * 10 + (size_t) (*c - '0');
+    }
+    *cursor = c;
+    *position = value;
+    return 1;
+}
+
+// the satisfiable ranges of "bytes=first-last, first-, -suffix" for a body length bytes long, in the order asked for.
+// -1 if the header is malformed or asks for too much, which means it's ignored
+static ssize_t parse_ranges(const char* value, size_t length, struct http_range* ranges) {
+    if (!str_prefixes_case(value, "bytes=")) {
+        return -1;
+    }
+    const char* c = value + 6;
+    size_t asked = 0;
+    size_t count = 0;
+    size_t total = 0;
+    while (1) {
+        while (*c == ' ' || *c == '\t') ++c;
+        size_t first = 0;
+        size_t last = 0;
+        int has_first = parse_position(&c, &first);
+        if (*c != '-') {
+            return -1;
+        }
+        ++c;
+        int has_last = parse_position(&c, &last);
+        if ((!has_first && !has_last) || (has_first && has_last && last < first) || ++asked > HTTP_RANGE_MAX) {
+            return -1;
+        }
+        size_t start;
+        size_t end; // exclusive
+        if (!has_first) {
+            start = last >= length ? 0 : length - last;
+            end = last > 0 ? length : start;
+        } else {
+            start = first;
+            end = has_last && last < length ? last + 1 : length;
+        }
+        if (start < end) {
+            ranges[count].start = start;
+            ranges[count].length = end - start;
+            ranges[count].part_header = NULL;
+            ranges[count].part_header_length = 0;
+            total += end - start;
+            ++count;
+        }
+        while (*c == ' ' || *c == '\t') ++c;
+        if (*c == 0) {
+            break;
+        } else if (*c != ',') {
+            return -1;
+        }
+        ++c;
+    }
+    // overlapping ranges that add up to more than the body would only amplify it
+    if (total > length) {
+        return -1;
+    }
+    return (ssize_t) count;
+}
+
+int http_range_apply(struct request_session* rs, size_t length, const char* etag) {
+    const char* range = header_get_id(rs->request->headers, HEADER_RANGE);
+    if (range == NULL || !(str_eq(rs->request->method, "GET") || str_eq(rs->request->method, "HEAD"))) {
+        return 0;
+    }
+    // only a matching strong ETag validates, dates can't as no Last-Modified is sent
+    const char* if_range = header_get_id(rs->request->headers, HEADER_IF_RANGE);
+    if (if_range != NULL && (etag == NULL || !str_eq(if_range, etag))) {
+        return 0;
+    }
+    struct http_range parsed[HTTP_RANGE_MAX];
+    ssize_t count = parse_ranges(range, length, parsed);
+    if (count < 0) {
+        return 0;
+    }
+    rs->response->headers = header_clone(rs->response->headers, rs->pool);
+    char value[64];
+    if (count == 0) {
+        rs->response->code = "416 Range Not Satisfiable";
+        snprintf(value, sizeof(value), "bytes */%zu", length);
+        header_setoradd(rs->response->headers, "Content-Range", value);
+        header_del(rs->response->headers, "Content-Type");
+        header_del(rs->response->headers, "Content-Length");
+        struct provision* body = pcalloc(rs->pool, sizeof(struct provision));
+        body->pool = rs->pool;
+        body->type = PROVISION_DATA;
+        rs->response->body = body;
+        return -1;
+    }
+    rs->response->code = "206 Partial Content";
+    struct http_ranges* ranges = pcalloc(rs->pool, sizeof(struct http_ranges));
+    ranges->count = (size_t) count;
+    ranges->ranges = pmalloc(rs->pool, ranges->count * sizeof(struct http_range));
+    memcpy(ranges->ranges, parsed, ranges->count * sizeof(struct http_range));
+    if (ranges->count == 1) {
+        snprintf(value, sizeof(value), "bytes %zu-%zu/%zu", parsed[0].start, parsed[0].start + parsed[0].length - 1, length);
+        header_setoradd(rs->response->headers, "Content-Range", value);
+        ranges->length = parsed[0].length;
+    } else {
+        const char* content_type = rs->response->body->content_type == NULL ? "application/octet-stream" : rs->response->body->content_type;
+        char boundary[17];
+        snprintf(boundary, sizeof(boundary), "%016llx", (unsigned long long) (((uint64_t) time(NULL) * 0x9E3779B97F4A7C15ULL) ^ ++boundary_counter));
+        for (size_t i = 0; i < ranges->count; ++i) {
+            struct http_range* part = &ranges->ranges[i];
+            part->part_header = pprintf(rs->pool, "\r\n--%s\r\nContent-Type: %s\r\nContent-Range: bytes %zu-%zu/%zu\r\n\r\n", boundary, content_type,
+                                        part->start, part->start + part->length - 1, length);
+            part->part_header_length = strlen(part->part_header);
+            ranges->length += part->part_header_length + part->length;
+        }
+        ranges->trailer = pprintf(rs->pool, "\r\n--%s--\r\n", boundary);
+        ranges->trailer_length = strlen(ranges->trailer);
+        ranges->length += ranges->trailer_length;
+        ranges->content_type = pprintf(rs->pool, "multipart/byteranges; boundary=%s", boundary);
+    }
+    header_del(rs->response->headers, "Content-Length");
+    rs->response->ranges = ranges;
+    return 1;
+}
@@ -0,0 +1,121 @@
+#include <avuna/http_scan.h>
+#include <avuna/llist.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HTTP_SCAN_X86
+#endif
+
+static const uint8_t terminator[4] = {'\r', '\n', '\r', '\n'};
+
+// start of the first full terminator at or after from, size if there is none
+static size_t find_scalar(const uint8_t* data, size_t size, size_t from) {
+    for (size_t i = from; i + 4 <= size; ++i) {
+        if (data[i] == '\r' && data[i + 1] == '\n' && data[i + 2] == '\r' && data[i + 3] == '\n') {
+            return i;
+        }
+    }
+    return size;
+}
+
+#ifdef HTTP_SCAN_X86
+
+// one compare per terminator byte against shifted loads, so a set bit marks a whole match and header lines cost nothing extra
+
+static size_t find_sse2(const uint8_t* data, size_t size) {
+    const __m128i cr = _mm_set1_epi8('\r');
+    const __m128i lf = _mm_set1_epi8('\n');
+    size_t i = 0;
+    for (; i + 16 + 3 <= size; i += 16) {
+        __m128i match = _mm_and_si128(
+            _mm_and_si128(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*) (data + i)), cr), _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*) (data + i + 1)), lf)),
+            _mm_and_si128(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*) (data + i + 2)), cr), _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*) (data + i + 3)), lf)));
+        int mask = _mm_movemask_epi8(match);
+        if (mask != 0) {
+            return i + __builtin_ctz((unsigned int) mask);
+        }
+    }
+    return find_scalar(data, size, i);
+}
+
+__attribute__((target("avx2")))
+static size_t find_avx2(const uint8_t* data, size_t size) {
+    const __m256i cr = _mm256_set1_epi8('\r');
+    const __m256i lf = _mm256_set1_epi8('\n');
+    size_t i = 0;
+    for (; i + 32 + 3 <= size; i += 32) {
+        __m256i match = _mm256_and_si256(
+            _mm256_and_si256(_mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*) (data + i)), cr), _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*) (data + i + 1)), lf)),
+            _mm256_and_si256(_mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*) (data + i + 2)), cr), _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*) (data + i + 3)), lf)));
+        unsigned int mask = (unsigned int) _mm256_movemask_epi8(match);
+        if (mask != 0) {
+            return i + __builtin_ctz(mask);
+        }
+    }
+    return find_sse2(data + i, size - i) + i;
+}
+
+#endif
+
+static size_t find_terminator(const uint8_t* data, size_t size) {
+#ifdef HTTP_SCAN_X86
+    static int has_avx2 = -1;
+    if (has_avx2 < 0) {
+        has_avx2 = __builtin_cpu_supports("avx2") ? 1 : 0;
+    }
+    return has_avx2 ? find_avx2(data, size) : find_sse2(data, size);
+#else
+    return find_scalar(data, size, 0);
+#endif
+}
+
+// length of the longest terminator prefix that the size bytes at data end with
+static int partial_match(const uint8_t* data, size_t size) {
+    for (size_t length = size < 3 ? size : 3; length > 0; --length) {
+        if (memcmp(data + size - length, terminator, length) == 0) {
+            return (int) length;
+        }
+    }
+    return 0;
+}
+
+int http_scan_resume(struct buffer* buffer, const uint8_t* chunk) {
+    struct llist_node* node = buffer->buffers->tail;
+    if (node != NULL && ((struct buffer_entry*) node->data)->data == chunk) {
+        node = node->prev;
+    }
+    // the last 3 bytes in front of chunk, which may span several small entries
+    uint8_t tail[3];
+    size_t have = 0;
+    for (; node != NULL && have < 3; node = node->prev) {
+        struct buffer_entry* entry = node->data;
+        size_t take = entry->size < 3 - have ? entry->size : 3 - have;
+        memcpy(tail + 3 - have - take, (uint8_t*) entry->data + entry->size - take, take);
+        have += take;
+    }
+    return partial_match(tail + 3 - have, have);
+}
+
+ssize_t http_scan_headers_end(const uint8_t* data, size_t size, int* state) {
+    if (*state > 0) {
+        // only the longest partial match can complete, the shorter ones ("\r" inside "\r\n\r") need the same next byte
+        size_t needed = (size_t) (4 - *state);
+        size_t available = size < needed ? size : needed;
+        if (memcmp(data, terminator + *state, available) == 0) {
+            if (available == needed) {
+                *state = 0;
+                return (ssize_t) needed;
+            }
+            *state += (int) available;
+            return -1;
+        }
+    }
+    size_t found = find_terminator(data, size);
+    if (found < size) {
+        *state = 0;
+        return (ssize_t) (found + 4);
+    }
+    *state = partial_match(data, size);
+    return -1;
+}
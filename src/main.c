@@ -5,9 +5,13 @@
  *      Author: root
  */
 
+#define _GNU_SOURCE // pthread_attr_setaffinity_np
+
 #include "accept.h"
 #include "network.h"
-#include "wake_thread.h"
+#include "network_uring.h"
+#include "stats.h"
+#include "affinity.h"
 #include <avuna/config.h>
 #include <avuna/string.h>
 #include <avuna/version.h>
@@ -23,9 +27,11 @@
 #include <stdio.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <limits.h>
 #include <signal.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <sys/un.h>
 #include <arpa/inet.h>
 #include <pthread.h>
@@ -35,6 +41,7 @@
 #include <dirent.h>
 #include <avuna/module.h>
 #include <sys/epoll.h>
+#include <linux/filter.h>
 
 int load_vhost(struct config_node* config_node, struct vhost* vhost) {
     vhost->name = config_node->name;
@@ -89,12 +96,115 @@ int load_vhost(struct config_node* config_node, struct vhost* vhost) {
     return 0;
 }
 
+int open_binding_socket(struct server_binding* binding) {
+    int namespace = binding->binding_type == BINDING_TCP6 ? PF_INET6 : binding->binding_type == BINDING_TCP4 ? PF_INET : PF_LOCAL;
+    int server_fd = socket(namespace, SOCK_STREAM, 0);
+    if (server_fd < 0) {
+        errlog(delog, "Error creating socket for binding: %s, %s", binding->name, strerror(errno));
+        return -1;
+    }
+    int one = 1;
+    int zero = 0;
+    if (setsockopt(server_fd, SOL_SOCKET, SO_REUSEADDR, (void*) &one, sizeof(one)) == -1) {
+        errlog(delog, "Error setting SO_REUSEADDR for binding: %s, %s", binding->name, strerror(errno));
+        goto error;
+    }
+    // has to be set before bind for workers to add their own sockets to the group later
+    if (binding->reuseport && namespace != PF_LOCAL && setsockopt(server_fd, SOL_SOCKET, SO_REUSEPORT, (void*) &one, sizeof(one)) == -1) {
+        errlog(delog, "Error setting SO_REUSEPORT for binding: %s, %s", binding->name, strerror(errno));
+        goto error;
+    }
+    if (binding->binding_type == BINDING_TCP6) {
+        if (setsockopt(server_fd, IPPROTO_IPV6, IPV6_V6ONLY, (void*) &zero, sizeof(zero)) == -1) {
+            errlog(delog, "Error unsetting IPV6_V6ONLY for binding: %s, %s", binding->name, strerror(errno));
+            goto error;
+        }
+        if (bind(server_fd, (struct sockaddr*) &binding->binding.tcp6, sizeof(binding->binding.tcp6))) {
+            errlog(delog, "Error binding socket for binding: %s, %s", binding->name, strerror(errno));
+            goto error;
+        }
+    } else if (binding->binding_type == BINDING_TCP4) {
+        if (bind(server_fd, (struct sockaddr*) &binding->binding.tcp4, sizeof(binding->binding.tcp4))) {
+            errlog(delog, "Error binding socket for binding: %s, %s", binding->name, strerror(errno));
+            goto error;
+        }
+    } else {
+        if (bind(server_fd, (struct sockaddr*) &binding->binding.un, sizeof(binding->binding.un))) {
+            errlog(delog, "Error binding socket for binding: %s, %s", binding->name, strerror(errno));
+            goto error;
+        }
+    }
+    // buffer sizes have to be known before the handshake for window scaling, so they are set on the listener
+    if (binding->rcvbuf > 0 && setsockopt(server_fd, SOL_SOCKET, SO_RCVBUF, &binding->rcvbuf, sizeof(int))) {
+        errlog(delog, "Error setting SO_RCVBUF for binding: %s, %s", binding->name, strerror(errno));
+    }
+    if (binding->sndbuf > 0 && setsockopt(server_fd, SOL_SOCKET, SO_SNDBUF, &binding->sndbuf, sizeof(int))) {
+        errlog(delog, "Error setting SO_SNDBUF for binding: %s, %s", binding->name, strerror(errno));
+    }
+    if (namespace != PF_LOCAL) {
+        if (binding->fastopen > 0 && setsockopt(server_fd, IPPROTO_TCP, TCP_FASTOPEN, &binding->fastopen, sizeof(int))) {
+            errlog(delog, "Error setting TCP_FASTOPEN for binding: %s, %s", binding->name, strerror(errno));
+        }
+        // clients speak first, so the listener only becomes readable once the request (or client hello) is in
+        if (binding->defer_accept > 0 && setsockopt(server_fd, IPPROTO_TCP, TCP_DEFER_ACCEPT, &binding->defer_accept, sizeof(int))) {
+            errlog(delog, "Error setting TCP_DEFER_ACCEPT for binding: %s, %s", binding->name, strerror(errno));
+        }
+        if (binding->notsent_lowat > 0 && setsockopt(server_fd, IPPROTO_TCP, TCP_NOTSENT_LOWAT, &binding->notsent_lowat, sizeof(int))) {
+            errlog(delog, "Error setting TCP_NOTSENT_LOWAT for binding: %s, %s", binding->name, strerror(errno));
+        }
+    }
+    // capped by net.core.somaxconn
+    if (listen(server_fd, binding->backlog)) {
+        errlog(delog, "Error listening on socket for binding: %s, %s", binding->name, strerror(errno));
+        goto error;
+    }
+    // Linux copies timeouts and TCP_NODELAY onto accepted sockets, and accept4 takes care of O_NONBLOCK
+    if (configure_fd(delog, server_fd, namespace != PF_LOCAL)) {
+        goto error;
+    }
+    return server_fd;
+    error:;
+    close(server_fd);
+    return -1;
+}
+
+// an optional unsigned option of a binding, returns 1 if it's set but invalid
+int load_binding_int(struct config_node* bind_node, char* name, int fallback, int* value) {
+    const char* str = config_get(bind_node, name);
+    if (str != NULL && (!str_isunum(str) || strtoul(str, NULL, 10) > INT_MAX)) {
+        errlog(delog, "Invalid %s for binding: %s", name, bind_node->name);
+        return 1;
+    }
+    *value = str == NULL ? fallback : (int) strtoul(str, NULL, 10);
+    return 0;
+}
+
+// names of the bindings some server accepts on with accept-mode = reuseport, these are bound as part of a SO_REUSEPORT group
+struct hashmap* find_reuseport_bindings(struct list* server_list, struct mempool* pool) {
+    struct hashmap* names = hashmap_new(16, pool);
+    for (size_t i = 0; i < (server_list == NULL ? 0 : server_list->count); i++) {
+        struct config_node* serv = server_list->data[i];
+        const char* accept_mode = config_get(serv, "accept-mode");
+        const char* bindings = config_get(serv, "bindings");
+        if (accept_mode == NULL || !str_eq_case(accept_mode, "reuseport") || bindings == NULL) {
+            continue;
+        }
+        struct list* binding_names = list_new(8, pool);
+        str_split(str_dup(bindings, 0, pool), ",", binding_names);
+        for (size_t j = 0; j < binding_names->count; ++j) {
+            hashmap_put(names, str_trim(binding_names->data[j]), (void*) 1);
+        }
+    }
+    return names;
+}
+
 int load_binding(struct config_node* bind_node, struct server_binding* binding) {
     const char* bind_mode = config_get(bind_node, "bind-mode");
     const char* bind_ip = NULL;
     uint16_t port = 0;
     const char* bind_file = NULL;
     int namespace;
+    binding->name = bind_node->name;
     int bind_all = 0;
     int use_ipv6 = 0;
     if (str_eq_case(bind_mode, "tcp")) {
@@ -128,27 +238,18 @@ int load_binding(struct config_node* bind_node, struct server_binding* binding)
         errlog(delog, "Invalid max-conn for binding: %s", bind_node->name);
         return 1;
     }
-    binding->conn_limit = (size_t) strtol(mcc, NULL, 10);
-
-    int server_fd = socket(namespace, SOCK_STREAM, 0);
-    if (server_fd < 0) {
-        errlog(delog, "Error creating socket for binding: %s, %s", bind_node->name, strerror(errno));
+    binding->conn_limit = mcc == NULL ? 0 : (size_t) strtoul(mcc, NULL, 10);
+    binding->live_conns = 0;
+    if (load_binding_int(bind_node, "backlog", 511, &binding->backlog) ||
+        load_binding_int(bind_node, "defer-accept", 0, &binding->defer_accept) ||
+        load_binding_int(bind_node, "fastopen", 0, &binding->fastopen) ||
+        load_binding_int(bind_node, "rcvbuf", 0, &binding->rcvbuf) ||
+        load_binding_int(bind_node, "sndbuf", 0, &binding->sndbuf) ||
+        load_binding_int(bind_node, "notsent-lowat", 0, &binding->notsent_lowat)) {
         return 1;
     }
-    phook(binding->pool, close_hook, (void*) server_fd);
-    int one = 1;
-    int zero = 0;
-    if (setsockopt(server_fd, SOL_SOCKET, SO_REUSEADDR, (void*) &one, sizeof(one)) == -1) {
-        errlog(delog, "Error setting SO_REUSEADDR for binding: %s, %s", bind_node->name, strerror(errno));
-        return 1;
-    }
-    sock:;
 
     if (binding->binding_type == BINDING_TCP6) {
-        if (setsockopt(server_fd, IPPROTO_IPV6, IPV6_V6ONLY, (void*) &zero, sizeof(zero)) == -1) {
-            errlog(delog, "Error unsetting IPV6_V6ONLY for binding: %s, %s", bind_node->name, strerror(errno));
-            return 1;
-        }
         binding->binding.tcp6.sin6_flowinfo = 0;
         binding->binding.tcp6.sin6_scope_id = 0;
         binding->binding.tcp6.sin6_family = AF_INET6;
@@ -158,14 +259,6 @@ int load_binding(struct config_node* bind_node, struct server_binding* binding)
             return 1;
         }
         binding->binding.tcp6.sin6_port = htons(port);
-        if (bind(server_fd, (struct sockaddr*) &binding->binding.tcp6, sizeof(binding->binding.tcp6))) {
-            if (bind_all) {
-                binding->binding_type = BINDING_TCP4;
-                goto sock;
-            }
-            errlog(delog, "Error binding socket for binding: %s, %s", bind_node->name, strerror(errno));
-            return 1;
-        }
     } else if (binding->binding_type == BINDING_TCP4) {
         binding->binding.tcp4.sin_family = AF_INET;
         if (bind_all) binding->binding.tcp4.sin_addr.s_addr = INADDR_ANY;
@@ -174,28 +267,26 @@ int load_binding(struct config_node* bind_node, struct server_binding* binding)
             return 1;
         }
         binding->binding.tcp4.sin_port = htons(port);
-        if (bind(server_fd, (struct sockaddr*) &binding->binding.tcp4, sizeof(binding->binding.tcp4))) {
-            errlog(delog, "Error binding socket for binding: %s, %s", bind_node->name, strerror(errno));
-            return 1;
-        }
     } else if (namespace == PF_LOCAL) {
+        binding->binding.un.sun_family = AF_LOCAL;
         strncpy(binding->binding.un.sun_path, bind_file, 108);
-        if (bind(server_fd, (struct sockaddr*) &binding->binding.un, sizeof(binding->binding.un))) {
-            errlog(delog, "Error binding socket for binding: %s, %s", bind_node->name, strerror(errno));
-            return 1;
-        }
     } else {
         errlog(delog, "Invalid family for binding: %s", bind_node->name);
         return 1;
     }
-    if (listen(server_fd, 50)) {
-        errlog(delog, "Error listening on socket for binding: %s, %s", bind_node->name, strerror(errno));
-        return 1;
+
+    int server_fd = open_binding_socket(binding);
+    if (server_fd < 0 && binding->binding_type == BINDING_TCP6 && bind_all) {
+        binding->binding_type = BINDING_TCP4;
+        binding->binding.tcp4.sin_family = AF_INET;
+        binding->binding.tcp4.sin_addr.s_addr = INADDR_ANY;
+        binding->binding.tcp4.sin_port = htons(port);
+        server_fd = open_binding_socket(binding);
     }
-    if (fcntl(server_fd, F_SETFL, fcntl(server_fd, F_GETFL) | O_NONBLOCK) < 0) {
-        errlog(delog, "Error setting non-blocking for binding: %s, %s", bind_node->name, strerror(errno));
+    if (server_fd < 0) {
         return 1;
     }
+    phook(binding->pool, close_hook, (void*) server_fd);
     binding->fd = server_fd;
 
     binding->mode = 0;
@@ -234,6 +325,81 @@ int load_binding(struct config_node* bind_node, struct server_binding* binding)
     return 0;
 }
 
+struct list* open_worker_listeners(struct server_info* server) {
+    struct list* worker_listeners = list_new(server->max_worker_count, server->pool);
+    for (size_t i = 0; i < server->max_worker_count; ++i) {
+        list_append(worker_listeners, list_new(server->bindings->count, server->pool));
+    }
+    // only handed to the pool once all of them are open, a socket left in a group nobody accepts on would still get its share
+    struct list* opened = list_new(8, server->pool);
+    size_t j = 0;
+    for (; j < server->bindings->count; ++j) {
+        struct server_binding* binding = server->bindings->data[j];
+        for (size_t i = 0; i < server->max_worker_count; ++i) {
+            struct accept_param* param = pcalloc(server->pool, sizeof(struct accept_param));
+            param->server = server;
+            param->binding = binding;
+            param->fd = binding->fd;
+            // the binding's own socket is the first member of the group, so it serves worker 0
+            if (i > 0 && binding->binding_type != BINDING_UNIX) {
+                param->fd = open_binding_socket(binding);
+                if (param->fd < 0) {
+                    goto error;
+                }
+                list_append(opened, (void*) (size_t) param->fd);
+            }
+            if (i == 0) {
+                accept_init_binding(param);
+            }
+            if (server->worker_cpus != NULL && binding->binding_type != BINDING_UNIX) {
+                // lets the kernel prefer the socket of the worker on the cpu that took the SYN, pairs with rx queue irq affinity
+                int cpu = (int) (size_t) server->worker_cpus->data[i % server->worker_cpus->count];
+                if (setsockopt(param->fd, SOL_SOCKET, SO_INCOMING_CPU, &cpu, sizeof(cpu))) {
+                    errlog(delog, "Failed to set SO_INCOMING_CPU for binding: %s, %s", binding->name, strerror(errno));
+                }
+            }
+            list_append(worker_listeners->data[i], param);
+        }
+        if (server->reuseport_steering == REUSEPORT_STEERING_CPU && binding->binding_type != BINDING_UNIX) {
+            // socket index = worker pinned to the receiving cpu, or receiving cpu % worker count. group order matches worker order,
+            // the group being this server's alone (see reuseport_server). sockets another process adds later come after ours
+            size_t pinned = server->worker_cpus == NULL ? 0 : server->max_worker_count;
+            struct sock_filter code[pinned * 2 + 3];
+            size_t len = 0;
+            code[len++] = (struct sock_filter) {BPF_LD | BPF_W | BPF_ABS, 0, 0, (uint32_t) (SKF_AD_OFF + SKF_AD_CPU)};
+            for (size_t i = 0; i < pinned; ++i) {
+                code[len++] = (struct sock_filter) {BPF_JMP | BPF_JEQ | BPF_K, 0, 1, (uint32_t) (size_t) server->worker_cpus->data[i % server->worker_cpus->count]};
+                code[len++] = (struct sock_filter) {BPF_RET | BPF_K, 0, 0, (uint32_t) i};
+            }
+            code[len++] = (struct sock_filter) {BPF_ALU | BPF_MOD | BPF_K, 0, 0, server->max_worker_count};
+            code[len++] = (struct sock_filter) {BPF_RET | BPF_A, 0, 0, 0};
+            struct sock_fprog program;
+            program.len = (unsigned short) len;
+            program.filter = code;
+            if (setsockopt(binding->fd, SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF, &program, sizeof(program))) {
+                errlog(delog, "Failed to attach reuseport steering program for server: %s, %s", server->id, strerror(errno));
+            }
+        }
+    }
+    for (size_t k = 0; k < opened->count; ++k) {
+        phook(server->pool, close_hook, opened->data[k]);
+    }
+    return worker_listeners;
+    error:;
+    for (size_t k = 0; k < opened->count; ++k) {
+        close((int) (size_t) opened->data[k]);
+    }
+    // the binding's own socket stays, without the steering program that counted on the others
+    for (size_t k = 0; server->reuseport_steering == REUSEPORT_STEERING_CPU && k < j; ++k) {
+        struct server_binding* binding = server->bindings->data[k];
+        int zero = 0;
+        if (binding->binding_type != BINDING_UNIX && setsockopt(binding->fd, SOL_SOCKET, SO_DETACH_REUSEPORT_BPF, &zero, sizeof(zero))) {
+            errlog(delog, "Failed to detach reuseport steering program for server: %s, %s", server->id, strerror(errno));
+        }
+    }
+    return NULL;
+}
+
 int main(int argc, char* argv[]) {
     signal(SIGPIPE, SIG_IGN);
 #ifndef DEBUG
@@ -366,6 +532,12 @@ int main(int argc, char* argv[]) {
         errlog(delog, "No fd-limit in daemon config! Assuming 1024.");
     }
     size_t fd_lim = fd_limit_str == NULL ? 1024 : strtoul(fd_limit_str, NULL, 10);
+    const char* stats_interval_str = config_get(daemon_node, "stats-interval");
+    if (stats_interval_str != NULL && !str_isunum(stats_interval_str)) {
+        errlog(delog, "Invalid stats-interval in daemon config! Assuming 0.");
+        stats_interval_str = NULL;
+    }
+    size_t stats_interval = stats_interval_str == NULL ? 0 : strtoul(stats_interval_str, NULL, 10);
     struct rlimit rlx;
     rlx.rlim_cur = fd_lim;
     rlx.rlim_max = fd_lim;
@@ -456,6 +628,7 @@ int main(int argc, char* argv[]) {
     }
 
     struct hashmap* binding_map = hashmap_new(16, global_pool);
+    struct hashmap* reuseport_bindings = find_reuseport_bindings(hashmap_get(cfg->nodeListsByCat, "server"), global_pool);
 
     struct list* binding_list = hashmap_get(cfg->nodeListsByCat, "binding");
     for (int i = 0; i < (binding_list == NULL ? 0 : binding_list->count); i++) {
@@ -467,6 +640,8 @@ int main(int argc, char* argv[]) {
         struct mempool* pool = mempool_new();
         struct server_binding* binding = pmalloc(pool, sizeof(struct server_binding));
         binding->pool = pool;
+        binding->reuseport = hashmap_get(reuseport_bindings, bind_node->name) != NULL;
+        binding->reuseport_server = NULL;
 
         if (load_binding(bind_node, binding)) {
             pfree(binding->pool);
@@ -558,7 +733,6 @@ int main(int argc, char* argv[]) {
         info->pool = pool;
         info->bindings = list_new(8, info->pool);
         info->vhosts = list_new(16, info->pool);
-        info->prepared_connections = queue_new(0, 1, info->pool);
         list_append(server_infos, info);
         const char* bindings = config_get(serv, "bindings");
         struct list* binding_names = list_new(8, info->pool);
@@ -609,6 +783,110 @@ int main(int argc, char* argv[]) {
             maxPostStr = "0";
         }
         info->max_post = strtoul(maxPostStr, NULL, 10);
+        const char* stream_post = config_get(serv, "stream-post");
+        if (stream_post != NULL && !str_isunum(stream_post)) {
+            errlog(delog, "Invalid stream-post at server: %s, assuming '0'", serv->name);
+            stream_post = NULL;
+        }
+        info->stream_post = stream_post == NULL ? 0 : strtoul(stream_post, NULL, 10);
+        const char* max_stream_post = config_get(serv, "max-stream-post");
+        if (max_stream_post != NULL && !str_isunum(max_stream_post)) {
+            errlog(delog, "Invalid max-stream-post at server: %s, assuming '1073741824'", serv->name);
+            max_stream_post = NULL;
+        }
+        info->max_stream_post = max_stream_post == NULL ? 1073741824 : strtoul(max_stream_post, NULL, 10);
+        const char* max_conn = config_get(serv, "max-conn");
+        if (max_conn != NULL && !str_isunum(max_conn)) {
+            errlog(delog, "Invalid max-conn at server: %s, assuming '0'", serv->name);
+            max_conn = NULL;
+        }
+        info->conn_limit = max_conn == NULL ? 0 : strtoul(max_conn, NULL, 10);
+        info->live_conns = 0;
+        const char* keepalive_timeout = config_get(serv, "keepalive-timeout");
+        if (keepalive_timeout == NULL || !str_isunum(keepalive_timeout)) {
+            errlog(delog, "No keepalive-timeout at server: %s, assuming '60'", serv->name);
+            keepalive_timeout = "60";
+        }
+        info->keepalive_timeout = strtoul(keepalive_timeout, NULL, 10) * 1000;
+        const char* header_timeout = config_get(serv, "header-timeout");
+        if (header_timeout == NULL || !str_isunum(header_timeout)) {
+            errlog(delog, "No header-timeout at server: %s, assuming '20'", serv->name);
+            header_timeout = "20";
+        }
+        info->header_timeout = strtoul(header_timeout, NULL, 10) * 1000;
+        const char* body_timeout = config_get(serv, "body-timeout");
+        if (body_timeout == NULL || !str_isunum(body_timeout)) {
+            errlog(delog, "No body-timeout at server: %s, assuming '60'", serv->name);
+            body_timeout = "60";
+        }
+        info->body_timeout = strtoul(body_timeout, NULL, 10) * 1000;
+
+        info->accept_mode = ACCEPT_MODE_THREAD;
+        info->reuseport_steering = REUSEPORT_STEERING_NONE;
+        info->worker_listeners = NULL;
+        const char* accept_mode = config_get(serv, "accept-mode");
+        if (accept_mode != NULL && str_eq_case(accept_mode, "reuseport")) {
+            info->accept_mode = ACCEPT_MODE_REUSEPORT;
+        } else if (accept_mode != NULL && !str_eq_case(accept_mode, "thread")) {
+            errlog(delog, "Invalid accept-mode at server: %s, assuming 'thread'", serv->name);
+        }
+        for (size_t j = 0; info->accept_mode == ACCEPT_MODE_REUSEPORT && j < info->bindings->count; ++j) {
+            struct server_binding* binding = info->bindings->data[j];
+            // the steering program and the worker sockets assume the group holds this server's sockets only
+            if (binding->reuseport_server != NULL) {
+                errlog(delog, "Binding %s is already used by server %s in 'reuseport' accept-mode, assuming 'thread' for server: %s", binding->name, binding->reuseport_server->id, serv->name);
+                info->accept_mode = ACCEPT_MODE_THREAD;
+            }
+        }
+        for (size_t j = 0; info->accept_mode == ACCEPT_MODE_REUSEPORT && j < info->bindings->count; ++j) {
+            ((struct server_binding*) info->bindings->data[j])->reuseport_server = info;
+        }
+        const char* steering = config_get(serv, "reuseport-steering");
+        if (steering != NULL && str_eq_case(steering, "cpu")) {
+            info->reuseport_steering = REUSEPORT_STEERING_CPU;
+        } else if (steering != NULL && !str_eq_case(steering, "none")) {
+            errlog(delog, "Invalid reuseport-steering at server: %s, assuming 'none'", serv->name);
+        }
+        info->dispatch_policy = DISPATCH_ROUND_ROBIN;
+        const char* dispatch = config_get(serv, "dispatch");
+        if (dispatch != NULL && str_eq_case(dispatch, "least-conn")) {
+            info->dispatch_policy = DISPATCH_LEAST_CONN;
+        } else if (dispatch != NULL && str_eq_case(dispatch, "p2c")) {
+            info->dispatch_policy = DISPATCH_P2C;
+        } else if (dispatch != NULL && str_eq_case(dispatch, "least-busy")) {
+            info->dispatch_policy = DISPATCH_LEAST_BUSY;
+        } else if (dispatch != NULL && !str_eq_case(dispatch, "round-robin")) {
+            errlog(delog, "Invalid dispatch at server: %s, assuming 'round-robin'", serv->name);
+        }
+        info->worker_cpus = NULL;
+        const char* cpu_affinity = config_get(serv, "cpu-affinity");
+        if (cpu_affinity != NULL && !str_eq_case(cpu_affinity, "none") && (info->worker_cpus = affinity_parse(cpu_affinity, info->pool)) == NULL) {
+            errlog(delog, "Invalid cpu-affinity at server: %s, assuming 'none'", serv->name);
+        }
+        info->io_backend = IO_BACKEND_EPOLL;
+        const char* io_backend = config_get(serv, "io-backend");
+        if (io_backend != NULL && str_eq_case(io_backend, "io_uring")) {
+            info->io_backend = IO_BACKEND_URING;
+        } else if (io_backend != NULL && !str_eq_case(io_backend, "epoll")) {
+            errlog(delog, "Invalid io-backend at server: %s, assuming 'epoll'", serv->name);
+        }
+        const char* read_budget = config_get(serv, "read-budget");
+        if (read_budget != NULL && !str_isunum(read_budget)) {
+            errlog(delog, "Invalid read-budget at server: %s, assuming '65536'", serv->name);
+            read_budget = NULL;
+        }
+        info->read_budget = read_budget == NULL ? 65536 : strtoul(read_budget, NULL, 10);
+        const char* busy_poll = config_get(serv, "busy-poll");
+        if (busy_poll != NULL && !str_isunum(busy_poll)) {
+            errlog(delog, "Invalid busy-poll at server: %s, assuming '0'", serv->name);
+            busy_poll = NULL;
+        }
+        info->busy_poll = busy_poll == NULL ? 0 : (uint32_t) strtoul(busy_poll, NULL, 10);
+        // must happen before dropping privileges, the sockets may be bound to privileged ports
+        if (info->accept_mode == ACCEPT_MODE_REUSEPORT && (info->worker_listeners = open_worker_listeners(info)) == NULL) {
+            errlog(delog, "Failed to open reuseport sockets for server: %s, falling back to 'thread' accept-mode", serv->name);
+            info->accept_mode = ACCEPT_MODE_THREAD;
+        }
 
         struct logsess* slog = pmalloc(info->pool, sizeof(struct logsess));
         slog->pi = 0;
@@ -631,56 +909,103 @@ int main(int argc, char* argv[]) {
         errlog(delog, "Failed to setuid! %s", strerror(errno));
     }
     acclog(delog, "Running as UID = %u, GID = %u, starting workers.", getuid(), getgid());
+    struct list* server_stats = list_new(server_infos->count, global_pool);
     for (size_t i = 0; i < server_infos->count; ++i) {
         struct server_info* server = server_infos->data[i];
-        for (size_t j = 0; j < server->bindings->count; ++j) {
-            struct accept_param* param = pmalloc(server->pool, sizeof(struct accept_param));
-            param->server = server;
-            param->binding = server->bindings->data[j];
-            pthread_t pt;
-            int pthread_err = pthread_create(&pt, NULL, (void*) run_accept, param);
-            if (pthread_err != 0) {
-                errlog(delog, "Error creating accept thread: pthread errno = %i.", pthread_err);
-                continue;
+        struct server_stats* stats = pmalloc(server->pool, sizeof(struct server_stats));
+        stats->server = server;
+        stats->accepts = list_new(server->bindings->count, server->pool);
+        list_append(server_stats, stats);
+        for (size_t j = 0; server->accept_mode == ACCEPT_MODE_REUSEPORT && j < server->worker_listeners->count; ++j) {
+            struct list* listeners = server->worker_listeners->data[j];
+            for (size_t k = 0; k < listeners->count; ++k) {
+                list_append(stats->accepts, listeners->data[k]);
             }
         }
 
         struct list* works = list_new(server->max_worker_count, server->pool);
+        stats->works = works;
 
         for (size_t j = 0; j < server->max_worker_count; ++j) {
-            struct work_param* param = pmalloc(server->pool, sizeof(struct work_param));
+            struct work_param* param = pcalloc(server->pool, sizeof(struct work_param));
             param->i = j;
             param->server = server;
+            param->listeners = server->accept_mode == ACCEPT_MODE_REUSEPORT ? server->worker_listeners->data[j] : NULL;
             param->epoll_fd = epoll_create1(0);
             if (param->epoll_fd < 0) {
                 errlog(param->server->logsess, "Failed to create epoll fd! %s", strerror(errno));
-                continue;
+                goto worker_failed;
+            }
+            if (handoff_init(&param->handoff, server->pool)) {
+                errlog(param->server->logsess, "Failed to create handoff eventfd! %s", strerror(errno));
+                goto worker_failed;
+            }
+            pthread_attr_t attr;
+            pthread_attr_init(&attr);
+            if (server->worker_cpus != NULL) {
+                // pinned from the start, so everything the worker touches first lands on its own node
+                size_t cpu = (size_t) server->worker_cpus->data[j % server->worker_cpus->count];
+                int pin_err = affinity_pin_attr(&attr, cpu);
+                if (pin_err != 0) {
+                    errlog(delog, "Failed to pin worker %lu of server %s to cpu %lu: %s", j, server->id, cpu, strerror(pin_err));
+                }
             }
             pthread_t pt;
-            int pthread_err = pthread_create(&pt, NULL, (void*) run_work, param);
+            int pthread_err = pthread_create(&pt, &attr, (void*) (server->io_backend == IO_BACKEND_URING ? run_work_uring : run_work), param);
+            pthread_attr_destroy(&attr);
             if (pthread_err != 0) {
                 errlog(delog, "Error creating work thread: pthread errno = %i.", pthread_err);
-                continue;
+                goto worker_failed;
             }
             list_append(works, param);
-        }
-
-        struct wake_thread_arg* wt_arg = pmalloc(server->pool, sizeof(struct wake_thread_arg));
-        wt_arg->work_params = works;
-        wt_arg->server = server;
-
-        pthread_t pt;
-        int pthread_err = pthread_create(&pt, NULL, (void*) wake_thread, wt_arg);
-        if (pthread_err != 0) {
-            errlog(delog, "Error creating work thread: pthread errno = %i.", pthread_err);
             continue;
+            worker_failed:;
+            if (server->accept_mode == ACCEPT_MODE_REUSEPORT) {
+                // its sockets are in the group already, the connections the kernel hands them would never be accepted
+                errlog(delog, "Worker %lu of server %s failed to start in 'reuseport' accept-mode, exiting.", j, server->id);
+                return 1;
+            }
         }
 
+        // started after the workers, so that every handoff ring they dispatch to exists
+        for (size_t j = 0; server->accept_mode == ACCEPT_MODE_THREAD && works->count > 0 && j < server->bindings->count; ++j) {
+            struct accept_param* param = pcalloc(server->pool, sizeof(struct accept_param));
+            param->server = server;
+            param->binding = server->bindings->data[j];
+            param->fd = param->binding->fd;
+            param->works = works;
+            pthread_attr_t attr;
+            pthread_attr_init(&attr);
+            if (server->worker_cpus != NULL) {
+                // on the workers' cpus too, rather than wherever the scheduler puts them
+                size_t cpu = (size_t) server->worker_cpus->data[j % server->worker_cpus->count];
+                int pin_err = affinity_pin_attr(&attr, cpu);
+                if (pin_err != 0) {
+                    errlog(delog, "Failed to pin accept thread for binding %s of server %s to cpu %lu: %s", param->binding->name, server->id, cpu, strerror(pin_err));
+                }
+            }
+            pthread_t pt;
+            int pthread_err = pthread_create(&pt, &attr, (void*) run_accept, param);
+            pthread_attr_destroy(&attr);
+            if (pthread_err != 0) {
+                errlog(delog, "Error creating accept thread: pthread errno = %i.", pthread_err);
+                continue;
+            }
+            list_append(stats->accepts, param);
+        }
     }
 #pragma clang diagnostic push
 #pragma clang diagnostic ignored "-Wmissing-noreturn"
-    while (1)
+    size_t ticks = 0;
+    while (1) {
         sleep(1);
+        if (stats_interval > 0 && ++ticks % stats_interval == 0) {
+            log_listen_overflows(delog);
+            for (size_t i = 0; i < server_stats->count; ++i) {
+                log_server_stats(server_stats->data[i]);
+            }
+        }
+    }
 #pragma clang diagnostic pop
     return 0;
 }
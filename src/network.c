@@ -5,7 +5,13 @@
  *      Author: root
  */
 
+#define _GNU_SOURCE // IOV_MAX
+
 #include "network.h"
+#include "accept.h"
+#include "stats.h"
+#include "affinity.h"
+#include "network_uring.h"
 #include "http_pipeline.h"
 #include <avuna/http_util.h>
 #include <avuna/vhost.h>
@@ -19,189 +25,606 @@
 #include <avuna/llist.h>
 #include <avuna/module.h>
 #include <errno.h>
+#include <limits.h>
+#include <unistd.h>
 #include <sys/epoll.h>
-#include <sys/ioctl.h>
+#include <sys/uio.h>
 #include <arpa/inet.h>
 
+// drops written bytes, and any empty entries, off the front of the write buffer
+void write_buffer_consume(struct sub_conn* sub_conn, size_t written) {
+    size_t pushed = sub_conn->write_offset + sub_conn->write_buffer.size;
+    sub_conn->write_offset += written;
+    sub_conn->write_buffer.size -= written;
+    for (struct llist_node* node = sub_conn->write_buffer.buffers->head; node != NULL; ) {
+        struct buffer_entry* entry = node->data;
+        if (written < entry->size) {
+            entry->data += written;
+            entry->size -= written;
+            break;
+        }
+        written -= entry->size;
+        pprefree_strict(sub_conn->write_buffer.pool, entry->data_root);
+        struct llist_node* next = node->next;
+        llist_del(sub_conn->write_buffer.buffers, node);
+        node = next;
+    }
+    sub_conn_write_pins_advance(sub_conn, pushed, NULL);
+}
+
+void write_pin_put(struct write_pin* pin) {
+    if (--pin->refs == 0) {
+        pfree(pin->pool);
+    }
+}
+
+void write_pins_closed(struct sub_conn* sub_conn) {
+    for (struct write_pin* pin = sub_conn->write_pins; pin != NULL; ) {
+        struct write_pin* next = pin->next;
+        write_pin_put(pin);
+        pin = next;
+    }
+    sub_conn->write_pins = NULL;
+    sub_conn->write_pins_tail = NULL;
+}
+
+struct mempool* sub_conn_write_pins(struct sub_conn* sub_conn) {
+    struct write_pin* tail = sub_conn->write_pins_tail;
+    if (tail != NULL && tail->end == SIZE_MAX) {
+        return tail->pool;
+    }
+    if (!sub_conn->write_pins_hooked) {
+        phook(sub_conn->pool, (void (*)(void*)) write_pins_closed, sub_conn);
+        sub_conn->write_pins_hooked = 1;
+    }
+    // not a child of the sub_conn's pool, a send chain in flight may outlive it
+    struct mempool* pool = mempool_new();
+    struct write_pin* pin = pcalloc(pool, sizeof(struct write_pin));
+    pin->pool = pool;
+    // entries already queued may be pointed into it as well
+    pin->start = sub_conn->write_offset;
+    pin->end = SIZE_MAX;
+    pin->refs = 1;
+    if (tail == NULL) {
+        sub_conn->write_pins = pin;
+    } else {
+        tail->next = pin;
+    }
+    sub_conn->write_pins_tail = pin;
+    return pool;
+}
+
+void sub_conn_write_pins_advance(struct sub_conn* sub_conn, size_t pushed, struct mempool* chain) {
+    if (sub_conn->write_pins_tail != NULL && sub_conn->write_pins_tail->end == SIZE_MAX) {
+        sub_conn->write_pins_tail->end = pushed;
+    }
+    for (struct write_pin* pin = sub_conn->write_pins; chain != NULL && pin != NULL && pin->start < sub_conn->write_offset; pin = pin->next) {
+        ++pin->refs;
+        phook(chain, (void (*)(void*)) write_pin_put, pin);
+    }
+    while (sub_conn->write_pins != NULL && sub_conn->write_pins->end <= sub_conn->write_offset) {
+        struct write_pin* pin = sub_conn->write_pins;
+        sub_conn->write_pins = pin->next;
+        if (sub_conn->write_pins == NULL) {
+            sub_conn->write_pins_tail = NULL;
+        }
+        write_pin_put(pin);
+    }
+}
+
+void write_unqueue(struct sub_conn* sub_conn) {
+    if (sub_conn->write_pprev == NULL) {
+        return;
+    }
+    *sub_conn->write_pprev = sub_conn->write_next;
+    if (sub_conn->write_next != NULL) {
+        sub_conn->write_next->write_pprev = sub_conn->write_pprev;
+    }
+    sub_conn->write_pprev = NULL;
+    sub_conn->write_next = NULL;
+}
+
+void ready_unqueue(struct sub_conn* sub_conn) {
+    if (sub_conn->ready_pprev == NULL) {
+        return;
+    }
+    *sub_conn->ready_pprev = sub_conn->ready_next;
+    if (sub_conn->ready_next != NULL) {
+        sub_conn->ready_next->ready_pprev = sub_conn->ready_pprev;
+    }
+    sub_conn->ready_pprev = NULL;
+    sub_conn->ready_next = NULL;
+}
+
+void unqueue_hook(struct sub_conn* sub_conn) {
+    write_unqueue(sub_conn);
+    ready_unqueue(sub_conn);
+}
+
+void queue_hook(struct sub_conn* sub_conn) {
+    if (!sub_conn->queue_hooked) {
+        phook(sub_conn->pool, (void (*)(void*)) unqueue_hook, sub_conn);
+        sub_conn->queue_hooked = 1;
+    }
+}
+
+void write_queue(struct connection_manager* manager, struct sub_conn* sub_conn) {
+    if (sub_conn->write_pprev != NULL) {
+        return;
+    }
+    queue_hook(sub_conn);
+    sub_conn->write_next = manager->pending_writes;
+    if (manager->pending_writes != NULL) {
+        manager->pending_writes->write_pprev = &sub_conn->write_next;
+    }
+    manager->pending_writes = sub_conn;
+    sub_conn->write_pprev = &manager->pending_writes;
+}
+
+void ready_queue(struct connection_manager* manager, struct sub_conn* sub_conn) {
+    if (sub_conn->ready_pprev != NULL) {
+        return;
+    }
+    queue_hook(sub_conn);
+    sub_conn->ready_next = manager->ready;
+    if (manager->ready != NULL) {
+        manager->ready->ready_pprev = &sub_conn->ready_next;
+    }
+    manager->ready = sub_conn;
+    sub_conn->ready_pprev = &manager->ready;
+}
+
+void sub_conn_keep(struct sub_conn* sub_conn, uint8_t* data, size_t size) {
+    if (size == 0) {
+        return;
+    }
+    uint8_t* copy = pmalloc(sub_conn->pool, size);
+    memcpy(copy, data, size);
+    buffer_push(&sub_conn->read_buffer, copy, size);
+}
+
+void sub_conn_resume(struct sub_conn* sub_conn) {
+    sub_conn->resume = 1;
+    ready_queue(sub_conn->conn->manager, sub_conn);
+}
+
+void work_uncork(struct connection_manager* manager) {
+    manager->corked = 0;
+    while (manager->pending_writes != NULL) {
+        struct sub_conn* sub_conn = manager->pending_writes;
+        write_unqueue(sub_conn);
+        trigger_write(sub_conn);
+    }
+}
+
 void trigger_write(struct sub_conn* sub_conn) {
-    if (sub_conn->write_available && sub_conn->write_buffer.size > 0) {
-        for (struct llist_node* node = sub_conn->write_buffer.buffers->head; node != NULL; ) {
-            struct buffer_entry* entry = node->data;
-            size_t written;
-            if (sub_conn->tls) {
-                ssize_t mtr = SSL_write(sub_conn->tls_session, entry->data, (int) entry->size);
-                if (mtr < 0) {
-                    int ssl_error = SSL_get_error(sub_conn->tls_session, (int) mtr);
-                    if (ssl_error == SSL_ERROR_SYSCALL && errno == EAGAIN) {
-                        sub_conn->write_available = 0;
-                        break;
-                    } else if (ssl_error != SSL_ERROR_WANT_WRITE && ssl_error != SSL_ERROR_WANT_READ) {
-                        sub_conn->safe_close = 1;
-                        return;
-                    }
+    struct connection_manager* manager = sub_conn->conn->manager;
+    if (manager != NULL && manager->corked) {
+        // everything written while the worker works through a batch of events leaves in one go at the end of it
+        write_queue(manager, sub_conn);
+        return;
+    }
+    if (sub_conn->uring != NULL) {
+        uring_flush(sub_conn->uring);
+        return;
+    }
+    while (sub_conn->write_available && sub_conn->write_buffer.size > 0) {
+        size_t written;
+        size_t entries = 0;
+        if (sub_conn->tls && !sub_conn->ktls_send) {
+            struct buffer_entry* first = sub_conn->write_buffer.buffers->head->data;
+            uint8_t* record = first->data;
+            size_t record_size = first->size;
+            if (record_size < WORK_WRITE_RECORD && manager != NULL) {
+                // small entries are gathered into full records. a retry after WANT_WRITE gathers the same prefix again, at least as long
+                record = manager->write_staging;
+                record_size = 0;
+                for (struct llist_node* node = sub_conn->write_buffer.buffers->head; node != NULL && record_size < WORK_WRITE_RECORD; node = node->next) {
+                    struct buffer_entry* entry = node->data;
+                    size_t size = entry->size < WORK_WRITE_RECORD - record_size ? entry->size : WORK_WRITE_RECORD - record_size;
+                    memcpy(record + record_size, entry->data, size);
+                    record_size += size;
+                    ++entries;
                 }
-                written = (size_t) mtr;
             } else {
-                ssize_t mtr = write(sub_conn->fd, entry->data, entry->size);
-                if (mtr < 0 && errno == EAGAIN) {
+                entries = 1;
+            }
+            int mtr = SSL_write(sub_conn->tls_session, record, (int) (record_size > INT_MAX ? INT_MAX : record_size));
+            if (mtr <= 0) {
+                int ssl_error = SSL_get_error(sub_conn->tls_session, mtr);
+                if ((ssl_error == SSL_ERROR_SYSCALL && errno == EAGAIN) || ssl_error == SSL_ERROR_WANT_WRITE || ssl_error == SSL_ERROR_WANT_READ) {
                     sub_conn->write_available = 0;
                     break;
-                } else if (mtr < 0) {
-                    sub_conn->safe_close = 1;
-                    break;
                 }
-                written = (size_t) mtr;
+                sub_conn->safe_close = 1;
+                return;
+            }
+            written = (size_t) mtr;
+        } else {
+            struct iovec iov[IOV_MAX];
+            size_t total = 0;
+            for (struct llist_node* node = sub_conn->write_buffer.buffers->head; node != NULL && entries < IOV_MAX; node = node->next) {
+                struct buffer_entry* entry = node->data;
+                iov[entries].iov_base = entry->data;
+                iov[entries].iov_len = entry->size;
+                total += entry->size;
+                ++entries;
             }
-            if (written < entry->size) {
-                entry->data += written;
-                entry->size -= written;
-                sub_conn->write_available = 1;
-                sub_conn->write_buffer.size -= written;
+            ssize_t mtr = writev(sub_conn->fd, iov, (int) entries);
+            if (mtr < 0 && errno == EAGAIN) {
+                sub_conn->write_available = 0;
                 break;
-            } else {
-                sub_conn->write_buffer.size -= written;
-                pprefree_strict(sub_conn->write_buffer.pool, entry->data_root);
-                struct llist_node* next = node->next;
-                llist_del(sub_conn->write_buffer.buffers, node);
-                node = next;
-                if (node == NULL) {
-                    sub_conn->write_available = 1;
+            } else if (mtr < 0) {
+                sub_conn->safe_close = 1;
+                return;
+            }
+            written = (size_t) mtr;
+            if (written < total) {
+                // the socket buffer is full, EPOLLOUT tells us when to carry on
+                sub_conn->write_available = 0;
+            }
+        }
+        if (manager != NULL) {
+            ++manager->write_calls;
+            manager->write_entries += entries;
+        }
+        write_buffer_consume(sub_conn, written);
+        if (sub_conn->write_buffer.size == 0 && sub_conn->on_written != NULL) {
+            sub_conn->on_written(sub_conn);
+        }
+    }
+}
+
+#define LOAD_WINDOW_NS 100000000
+
+void work_conn_closed_hook(struct work_param* param) {
+    __atomic_sub_fetch(&param->stats.live_conns, 1, __ATOMIC_RELAXED);
+}
+
+void work_track_conn(struct work_param* param, struct conn* conn) {
+    conn->manager = param->manager;
+    __atomic_add_fetch(&param->stats.live_conns, 1, __ATOMIC_RELAXED);
+    phook(conn->pool, (void (*)(void*)) work_conn_closed_hook, param);
+}
+
+static void watch_sub_conn(int epoll_fd, struct sub_conn* sub_conn) {
+    struct epoll_event event;
+    event.events = EPOLLIN | EPOLLOUT | EPOLLET;
+    event.data.ptr = sub_conn;
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, sub_conn->fd, &event)) {
+        errlog(sub_conn->conn->server->logsess, "Failed to add fd to epoll! %s", strerror(errno));
+    }
+}
+
+void work_watch_sub_conn(struct work_param* param, struct sub_conn* sub_conn) {
+    watch_sub_conn(param->epoll_fd, sub_conn);
+}
+
+void sub_conn_register(struct sub_conn* sub_conn) {
+    llist_append(sub_conn->conn->sub_conns, sub_conn);
+    // registered before the module returns, so a fast backend reply can't sit unwatched until an unrelated wakeup
+    watch_sub_conn(sub_conn->conn->manager->epoll_fd, sub_conn);
+}
+
+void work_register_conn(struct work_param* param, struct conn* conn) {
+    work_track_conn(param, conn);
+    ITER_LLIST(conn->sub_conns, value) {
+        work_watch_sub_conn(param, value);
+        ITER_LLIST_END();
+    }
+}
+
+void work_drain_handoff(struct work_param* param, void (*on_conn)(void* arg, struct conn* conn), void* arg) {
+    handoff_reset(&param->handoff);
+    struct conn* conn;
+    while ((conn = handoff_pop(&param->handoff)) != NULL) {
+        on_conn(arg, conn);
+    }
+}
+
+uint32_t work_load(struct work_param* param, uint64_t now) {
+    uint64_t updated = __atomic_load_n(&param->stats.busy_updated, __ATOMIC_RELAXED);
+    if (__atomic_load_n(&param->stats.polling, __ATOMIC_RELAXED) && now > updated + LOAD_WINDOW_NS) {
+        return 0;
+    }
+    return __atomic_load_n(&param->stats.busy_permille, __ATOMIC_RELAXED);
+}
+
+void work_account_busy(struct work_param* param, uint64_t now, uint64_t busy, uint64_t* window_start, uint64_t* window_busy) {
+    *window_busy += busy;
+    if (now - *window_start < LOAD_WINDOW_NS) {
+        return;
+    }
+    uint32_t load = (uint32_t) (*window_busy * 1000 / (now - *window_start));
+    if (load > 1000) {
+        load = 1000;
+    }
+    uint32_t ewma = (__atomic_load_n(&param->stats.busy_permille, __ATOMIC_RELAXED) * 3 + load) / 4;
+    __atomic_store_n(&param->stats.busy_permille, ewma, __ATOMIC_RELAXED);
+    __atomic_store_n(&param->stats.busy_updated, now, __ATOMIC_RELAXED);
+    *window_start = now;
+    *window_busy = 0;
+}
+
+// returns 0 once the session is established, 1 if the handshake needs more io, -1 if the sub_conn was closed
+int work_tls_handshake(struct work_param* param, struct sub_conn* sub_conn) {
+    uint64_t start = monotonic_ns();
+    int r = SSL_accept(sub_conn->tls_session);
+    uint64_t end = monotonic_ns();
+    param->stats.handshake_busy_total += end - start;
+    if (r != 1) {
+        int err = SSL_get_error(sub_conn->tls_session, r);
+        if (r < 0 && (err == SSL_ERROR_WANT_READ || err == SSL_ERROR_WANT_WRITE)) {
+            return 1;
+        }
+        ++param->stats.handshakes_failed;
+        sub_conn->on_closed(sub_conn);
+        return -1;
+    }
+    struct server_binding* binding = sub_conn->conn->incoming_binding;
+    if (binding->ssl_cert->isDummy && SSL_get_SSL_CTX(sub_conn->tls_session) == binding->ssl_cert->ctx) {
+        ++param->stats.handshakes_failed;
+        sub_conn->on_closed(sub_conn);
+        return -1;
+    }
+    sub_conn->tls_state = TLS_STATE_ESTABLISHED;
+#ifdef SSL_OP_ENABLE_KTLS
+    // SSL_read keeps handling receives either way, it needs to see alerts and post-handshake messages
+    sub_conn->ktls_send = BIO_get_ktls_send(SSL_get_wbio(sub_conn->tls_session)) > 0;
+    param->stats.ktls_send += sub_conn->ktls_send;
+    param->stats.ktls_recv += BIO_get_ktls_recv(SSL_get_rbio(sub_conn->tls_session)) > 0;
+#endif
+    uint64_t latency = end - ((uint64_t) sub_conn->tls_handshake_start.tv_sec * 1000000000 + (uint64_t) sub_conn->tls_handshake_start.tv_nsec);
+    ++param->stats.handshakes_completed;
+    param->stats.handshake_latency_total += latency;
+    if (latency > param->stats.handshake_latency_max) {
+        param->stats.handshake_latency_max = latency;
+    }
+    return 0;
+}
+
+int work_deliver(struct sub_conn* sub_conn, uint8_t* data, size_t size) {
+    // handlers consume from the worker's buffer and copy only what they leave, see sub_conn_keep
+    int p = sub_conn->read(sub_conn, data, size);
+    if (p == 1) {
+        sub_conn->on_closed(sub_conn);
+        return 1;
+    }
+    return p == -1 ? 1 : 0;
+}
+
+void work_handle_event(struct work_param* param, struct epoll_event* event) {
+    struct sub_conn* sub_conn = event->data.ptr;
+    if (sub_conn->safe_close) {
+        sub_conn->on_closed(sub_conn);
+        return;
+    }
+
+    if (event->events & EPOLLHUP) {
+        sub_conn->on_closed(sub_conn);
+        return;
+    }
+    if (event->events & EPOLLERR) {
+        sub_conn->on_closed(sub_conn);
+        return;
+    }
+
+    if (sub_conn->tls_state == TLS_STATE_HANDSHAKE) {
+        int handshake = work_tls_handshake(param, sub_conn);
+        if (handshake == 1 && sub_conn->refresh_timeout != NULL) {
+            sub_conn->refresh_timeout(sub_conn);
+        }
+        if (handshake != 0) {
+            return;
+        }
+        // the client may have sent application data along with its finished message, and edge triggering won't tell us again
+        event->events |= EPOLLIN | EPOLLOUT;
+    }
+
+    if (event->events & EPOLLOUT) {
+        sub_conn->write_available = 1;
+        if (sub_conn->write_buffer.size == 0 && sub_conn->on_written != NULL) {
+            // for a sender that writes around write_buffer, like http_send_file
+            sub_conn->on_written(sub_conn);
+        }
+        trigger_write(sub_conn);
+    }
+
+    if ((event->events & EPOLLIN) && !sub_conn->read_paused) {
+        uint8_t* read_buf = param->read_buffer;
+        size_t budget = param->server->read_budget;
+        size_t consumed = 0;
+        if (sub_conn->tls) {
+            int r;
+            while ((r = SSL_read(sub_conn->tls_session, read_buf, WORK_READ_SIZE)) > 0) {
+                if (work_deliver(sub_conn, read_buf, (size_t) r)) {
+                    return;
+                }
+                if (sub_conn->read_paused) {
+                    // picked up again by sub_conn_resume
+                    break;
+                }
+                consumed += r;
+                if (budget > 0 && consumed >= budget) {
+                    // edge triggering won't report what's left, so come back to it after everyone else had a turn
+                    ready_queue(param->manager, sub_conn);
                     break;
-                } else {
-                    continue;
                 }
             }
+            if (r == 0) {
+                sub_conn->on_closed(sub_conn);
+                return;
+            } else if (r < 0) { // > 0 once the budget is spent
+                int ssl_error = SSL_get_error(sub_conn->tls_session, r);
+                if (!(ssl_error == SSL_ERROR_SYSCALL && errno == EAGAIN) && ssl_error != SSL_ERROR_WANT_WRITE && ssl_error != SSL_ERROR_WANT_READ) {
+                    sub_conn->on_closed(sub_conn);
+                    return;
+                }
+            }
+        } else {
+            ssize_t r;
+            while ((r = read(sub_conn->fd, read_buf, WORK_READ_SIZE)) > 0) {
+                if (work_deliver(sub_conn, read_buf, (size_t) r)) {
+                    return;
+                }
+                if (r < WORK_READ_SIZE) {
+                    // drained, anything arriving later raises a new edge
+                    break;
+                }
+                if (sub_conn->read_paused) {
+                    break;
+                }
+                consumed += r;
+                if (budget > 0 && consumed >= budget) {
+                    ready_queue(param->manager, sub_conn);
+                    break;
+                }
+            }
+            if (r == 0 || (r < 0 && errno != EAGAIN)) {
+                sub_conn->on_closed(sub_conn);
+                return;
+            }
+        }
+    }
+    if (sub_conn->refresh_timeout != NULL) {
+        sub_conn->refresh_timeout(sub_conn);
+    }
+}
+
+void work_drain_ready(struct work_param* param) {
+    // sub_conns that run out of budget again queue up for the next pass rather than this one
+    struct sub_conn* ready = param->manager->ready;
+    param->manager->ready = NULL;
+    if (ready != NULL) {
+        ready->ready_pprev = &ready;
+    }
+    while (ready != NULL) {
+        struct sub_conn* sub_conn = ready;
+        ready_unqueue(sub_conn);
+        if (sub_conn->resume && !sub_conn->safe_close) {
+            sub_conn->resume = 0;
+            if (work_deliver(sub_conn, NULL, 0)) {
+                continue;
+            }
+        }
+        if (sub_conn->uring != NULL) {
+            // its receives are already armed on the ring, reading here could reorder them
+            if (sub_conn->safe_close) {
+                sub_conn->on_closed(sub_conn);
+            } else if (sub_conn->refresh_timeout != NULL) {
+                sub_conn->refresh_timeout(sub_conn);
+            }
+            continue;
         }
+        struct epoll_event event;
+        event.events = EPOLLIN;
+        event.data.ptr = sub_conn;
+        work_handle_event(param, &event);
+    }
+}
+
+int work_poll_timeout(struct work_param* param, uint64_t now, int timeout) {
+    if (timeout == 0) {
+        return 0;
+    }
+    if (now < param->spin_until) {
+        ++param->stats.spins;
+        return 0;
+    }
+    ++param->stats.sleeps;
+    return timeout;
+}
+
+void work_polled(struct work_param* param, uint64_t now, int timeout, int found_events) {
+    if (!found_events || param->server->busy_poll == 0) {
+        return;
+    }
+    if (timeout == 0 && now < param->spin_until) {
+        ++param->stats.spin_hits;
     }
+    param->spin_until = now + (uint64_t) param->server->busy_poll * 1000;
+}
+
+void work_init(struct work_param* param) {
+    if (param->server->worker_cpus != NULL && affinity_bind_memory_local()) {
+        errlog(param->server->logsess, "Failed to bind worker memory to the local node! %s", strerror(errno));
+    }
+    struct mempool* pool = mempool_new();
+    param->manager = pcalloc(pool, sizeof(struct connection_manager));
+    param->manager->epoll_fd = param->epoll_fd;
+    param->manager->timers = timer_wheel_new(pool, monotonic_ns());
+    param->read_buffer = pmalloc(pool, WORK_READ_SIZE);
+    param->manager->write_staging = pmalloc(pool, WORK_WRITE_RECORD);
 }
 
 #pragma clang diagnostic push
 #pragma clang diagnostic ignored "-Wmissing-noreturn"
 
 void run_work(struct work_param* param) {
-    struct mempool* pool = mempool_new();
-    param->manager = pcalloc(pool, sizeof(struct connection_manager));
-    param->manager->pending_sub_conns = llist_new(pool);
+    if (param->manager == NULL) {
+        work_init(param);
+    }
+    for (size_t i = 0; param->listeners != NULL && i < param->listeners->count; ++i) {
+        struct accept_param* listener = param->listeners->data[i];
+        struct epoll_event event;
+        // unix sockets can't be sharded, so every worker waits on the same fd
+        event.events = EPOLLIN | (listener->binding->binding_type == BINDING_UNIX ? EPOLLEXCLUSIVE : 0);
+        event.data.ptr = listener;
+        if (epoll_ctl(param->epoll_fd, EPOLL_CTL_ADD, listener->fd, &event)) {
+            errlog(param->server->logsess, "Failed to add listener to epoll! %s", strerror(errno));
+        }
+    }
+    if (param->listeners == NULL) {
+        struct epoll_event event;
+        event.events = EPOLLIN;
+        event.data.ptr = &param->handoff;
+        if (epoll_ctl(param->epoll_fd, EPOLL_CTL_ADD, param->handoff.event_fd, &event)) {
+            errlog(param->server->logsess, "Failed to add handoff eventfd to epoll! %s", strerror(errno));
+        }
+    }
     struct epoll_event events[128];
+    uint64_t window_start = monotonic_ns();
+    uint64_t window_busy = 0;
+    uint64_t busy_start = 0;
     while (1) {
-        for (struct llist_node* node = param->manager->pending_sub_conns->head; node != NULL; ) {
-            struct sub_conn* sub_conn = node->data;
-            llist_append(sub_conn->conn->sub_conns, sub_conn);
-            struct epoll_event event;
-            event.events = EPOLLIN | EPOLLOUT | EPOLLET;
-            event.data.ptr = sub_conn;
-            if (epoll_ctl(param->epoll_fd, EPOLL_CTL_ADD, sub_conn->fd, &event)) {
-                errlog(param->server->logsess, "Failed to add fd to epoll! %s", strerror(errno));
-            }
-            struct llist_node* next = node->next;
-            llist_del(param->manager->pending_sub_conns, node);
-            node = next;
+        if (busy_start > 0) {
+            uint64_t now = monotonic_ns();
+            work_account_busy(param, now, now - busy_start, &window_start, &window_busy);
         }
-        int epoll_status = epoll_wait(param->epoll_fd, events, 128, -1);
+        uint64_t now = monotonic_ns();
+        timer_wheel_advance(param->manager->timers, now);
+        int timeout = param->manager->ready != NULL ? 0 : work_poll_timeout(param, now, timer_wheel_timeout(param->manager->timers, now));
+        __atomic_store_n(&param->stats.polling, 1, __ATOMIC_RELAXED);
+        int epoll_status = epoll_wait(param->epoll_fd, events, 128, timeout);
+        __atomic_store_n(&param->stats.polling, 0, __ATOMIC_RELAXED);
+        busy_start = monotonic_ns();
+        work_polled(param, busy_start, timeout, epoll_status > 0);
         if (epoll_status < 0) {
             errlog(param->server->logsess, "Epoll error in worker thread! %s", strerror(errno));
-        } else if (epoll_status == 0) {
+        } else if (epoll_status == 0 && param->manager->ready == NULL) {
             continue;
         }
+        param->manager->corked = 1;
         for (int i = 0; i < epoll_status; ++i) {
             struct epoll_event* event = &events[i];
-            struct sub_conn* sub_conn = event->data.ptr;
             if (event->events == 0) continue;
-            if (sub_conn->safe_close) {
-                sub_conn->on_closed(sub_conn);
-                continue;
-            }
-
-            if (event->events & EPOLLHUP) {
-                sub_conn->on_closed(sub_conn);
-                continue;
-            }
-            if (event->events & EPOLLERR) {
-                sub_conn->on_closed(sub_conn);
+            if (event->data.ptr == &param->handoff) {
+                work_drain_handoff(param, (void (*)(void*, struct conn*)) work_register_conn, param);
                 continue;
             }
-
-            if (sub_conn->tls && !sub_conn->tls_handshaked) {
-                int r = SSL_accept(sub_conn->tls_session);
-                if (r == 1) {
-                    sub_conn->tls_handshaked = 1;
-                } else if (r == 2) {
-                    sub_conn->on_closed(sub_conn);
-                    continue;
-                } else {
-                    int err = SSL_get_error(sub_conn->tls_session, r);
-                    if (err != SSL_ERROR_WANT_READ && err != SSL_ERROR_WANT_WRITE) {
-                        sub_conn->on_closed(sub_conn);
-                        continue;
-                    }
-                }
-                continue;
-            }
-
-
-            if (event->events & EPOLLOUT) {
-                sub_conn->write_available = 1;
-                trigger_write(sub_conn);
-            }
-
-            if (event->events & EPOLLIN) {
-                void* read_buf = NULL;
-                size_t read_total = 0;
-                if (sub_conn->tls) {
-                    size_t read_capacity = (size_t) SSL_pending(sub_conn->tls_session);
-                    if (read_capacity == 0) {
-                        ioctl(sub_conn->fd, FIONREAD, &read_capacity);
-                        if (read_capacity < 64) {
-                            read_capacity = 1024;
-                        }
-                    }
-                    ++read_capacity;
-                    read_buf = pmalloc(sub_conn->pool, read_capacity);
-                    ssize_t r;
-                    while ((r = SSL_read(sub_conn->tls_session, read_buf + read_total, (int) (read_capacity - read_total))) > 0) {
-                        read_total += r;
-                        if (read_total == read_capacity) {
-                            read_capacity *= 2;
-                            read_buf = prealloc(sub_conn->pool, read_buf, read_capacity);
-                        }
-                    }
-                    if (r == 0) {
-                        sub_conn->on_closed(sub_conn);
-                        continue;
-                    } else { // < 0
-                        int ssl_error = SSL_get_error(sub_conn->tls_session, (int) r);
-                        if (!(ssl_error == SSL_ERROR_SYSCALL && errno == EAGAIN) && ssl_error != SSL_ERROR_WANT_WRITE && ssl_error != SSL_ERROR_WANT_READ) {
-                            sub_conn->on_closed(sub_conn);
-                            continue;
-                        }
-                    }
-                } else {
-                    size_t read_capacity = 0;
-                    ioctl(sub_conn->fd, FIONREAD, &read_capacity);
-                    ++read_capacity;
-                    read_buf = pmalloc(sub_conn->pool, read_capacity);
-                    ssize_t r;
-                    while ((r = read(sub_conn->fd, read_buf + read_total, read_capacity - read_total)) > 0) {
-                        read_total += r;
-                        if (read_total == read_capacity) {
-                            read_capacity *= 2;
-                            read_buf = prealloc(sub_conn->pool, read_buf, read_capacity);
-                        }
-                    }
-                    if (r == 0 || (r < 0 && errno != EAGAIN)) {
-                        sub_conn->on_closed(sub_conn);
-                        continue;
-                    }
-                }
-                int p = sub_conn->read(sub_conn, read_buf, read_total);
-                if (p == 1) {
-                    sub_conn->on_closed(sub_conn);
-                    continue;
-                } else if (p == -1) { // already closed
-                    continue;
+            int is_listener = 0;
+            for (size_t j = 0; param->listeners != NULL && j < param->listeners->count; ++j) {
+                if (event->data.ptr == param->listeners->data[j]) {
+                    accept_drain(event->data.ptr, (void (*)(void*, struct conn*)) work_register_conn, param);
+                    is_listener = 1;
+                    break;
                 }
             }
+            if (is_listener) continue;
+            work_handle_event(param, event);
         }
+        work_drain_ready(param);
+        work_uncork(param->manager);
     }
 }
 
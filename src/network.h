@@ -11,16 +11,80 @@
 #include <avuna/server.h>
 #include <avuna/connection.h>
 #include <avuna/queue.h>
+#include <avuna/list.h>
 #include <avuna/http.h>
 #include <stdlib.h>
+#include "handoff.h"
+#include <sys/epoll.h>
+
+#define WORK_READ_SIZE 16384 // one full TLS record
+#define WORK_WRITE_RECORD 16384 // small write buffer entries are coalesced into TLS records of this size
+
+struct work_stats {
+    uint64_t handshakes_completed;
+    uint64_t handshakes_failed;
+    uint64_t handshake_latency_total; // ns from accept to an established session
+    uint64_t handshake_latency_max;
+    uint64_t handshake_busy_total; // ns spent inside SSL_accept
+    uint64_t ktls_send; // handshakes after which the kernel took over encryption
+    uint64_t ktls_recv;
+    // the following are read by the accept threads, and must be accessed atomically
+    uint64_t dispatched;
+    uint64_t live_conns;
+    uint32_t busy_permille; // EWMA of the time spent outside of epoll_wait
+    uint64_t busy_updated;
+    int polling;
+    uint64_t spins; // non-blocking polls inside the busy-poll window
+    uint64_t spin_hits; // of those, polls that found events
+    uint64_t sleeps; // blocking polls
+};
 
 struct work_param {
     size_t i;
     struct server_info* server;
     int epoll_fd;
     struct connection_manager* manager;
+    struct list* listeners; // struct accept_param*, only in ACCEPT_MODE_REUSEPORT
+    struct work_stats stats;
+    struct handoff handoff; // conns from the accept threads, ACCEPT_MODE_THREAD only
+    uint8_t* read_buffer; // WORK_READ_SIZE, every plain read and SSL_read on this worker lands here first
+    uint64_t spin_until; // ns, see server_info.busy_poll
 };
 
+// assigns a conn to this worker's manager and live connection count, without touching epoll
+void work_track_conn(struct work_param* param, struct conn* conn);
+
+void work_watch_sub_conn(struct work_param* param, struct sub_conn* sub_conn);
+
+void work_register_conn(struct work_param* param, struct conn* conn);
+
+// pops everything the accept threads handed over, once handoff.event_fd is readable
+void work_drain_handoff(struct work_param* param, void (*on_conn)(void* arg, struct conn* conn), void* arg);
+
+void work_init(struct work_param* param);
+
+// the timeout for the next poll, 0 while inside the busy-poll window
+int work_poll_timeout(struct work_param* param, uint64_t now, int timeout);
+
+// after a poll with the timeout from work_poll_timeout, found_events if it returned any
+void work_polled(struct work_param* param, uint64_t now, int timeout, int found_events);
+
+// reads once more from each sub_conn whose read budget ran out, see server_info.read_budget
+void work_drain_ready(struct work_param* param);
+
+// flushes every sub_conn written to since manager->corked was set
+void work_uncork(struct connection_manager* manager);
+
+// data only needs to live for the call. returns 1 if the sub_conn was closed
+int work_deliver(struct sub_conn* sub_conn, uint8_t* data, size_t size);
+
+void work_handle_event(struct work_param* param, struct epoll_event* event);
+
+void work_account_busy(struct work_param* param, uint64_t now, uint64_t busy, uint64_t* window_start, uint64_t* window_busy);
+
+// busy_permille, or 0 if the worker has been idle in epoll_wait for longer than a load window
+uint32_t work_load(struct work_param* param, uint64_t now);
+
 void run_work(struct work_param* param);
 
 #endif /* WORK_H_ */
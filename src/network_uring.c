@@ -0,0 +1,452 @@
+#include "network_uring.h"
+#include "accept.h"
+#include "stats.h"
+#include <avuna/pmem.h>
+#include <avuna/pmem_hooks.h>
+#include <avuna/llist.h>
+#include <avuna/log.h>
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <poll.h>
+#include <sys/socket.h>
+
+// low bits of user_data, everything we point at is at least 8 byte aligned
+#define URING_TAG_UPDATE 0 // registered file update, points at a uring_conn
+#define URING_TAG_RECV 1
+#define URING_TAG_SEND 2
+#define URING_TAG_CANCEL 3
+#define URING_TAG_ACCEPT 4 // points at an accept_param
+#define URING_TAG_EPOLL 5 // the worker's epoll fd became readable
+#define URING_TAG_HANDOFF 6
+#define URING_TAG_MASK 7
+
+#define uring_tag(ptr, tag) ((uint64_t) (ptr) | (tag))
+
+struct uring_conn* uring_conn_new(struct uring_worker* worker) {
+    struct uring_conn* uc = worker->free_conns;
+    if (uc != NULL) {
+        worker->free_conns = uc->next_free;
+    } else {
+        uc = pmalloc(worker->pool, sizeof(struct uring_conn));
+    }
+    memset(uc, 0, sizeof(struct uring_conn));
+    uc->worker = worker;
+    return uc;
+}
+
+void uring_conn_put(struct uring_conn* uc) {
+    if (uc->sub_conn != NULL || uc->inflight > 0) {
+        return;
+    }
+    uc->next_free = uc->worker->free_conns;
+    uc->worker->free_conns = uc;
+}
+
+void uring_arm_recv(struct uring_conn* uc) {
+    struct io_uring_sqe* sqe = uring_get_sqe(&uc->worker->ring);
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = uc->slot;
+    sqe->flags = IOSQE_FIXED_FILE | IOSQE_BUFFER_SELECT;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->buf_group = 0;
+    sqe->user_data = uring_tag(uc, URING_TAG_RECV);
+    uc->recv_armed = 1;
+    ++uc->inflight;
+}
+
+void uring_update_slot(struct uring_conn* uc, int fd, int link) {
+    uc->slot_fd = fd;
+    struct io_uring_sqe* sqe = uring_get_sqe(&uc->worker->ring);
+    sqe->opcode = IORING_OP_FILES_UPDATE;
+    sqe->fd = -1;
+    sqe->addr = (uint64_t) &uc->slot_fd;
+    sqe->len = 1;
+    sqe->off = (uint64_t) uc->slot;
+    sqe->flags = link ? IOSQE_IO_LINK : 0;
+    sqe->user_data = uring_tag(uc, URING_TAG_UPDATE);
+    ++uc->inflight;
+}
+
+void uring_cancel(struct uring_conn* uc, int tag) {
+    struct io_uring_sqe* sqe = uring_get_sqe(&uc->worker->ring);
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->fd = -1;
+    sqe->addr = uring_tag(uc, tag);
+    sqe->cancel_flags = IORING_ASYNC_CANCEL_ALL;
+    sqe->user_data = uring_tag(uc, URING_TAG_CANCEL);
+    ++uc->inflight;
+}
+
+// pool hook of the sub_conn, its socket stays open through the registered slot until we clear it
+void uring_conn_release(struct uring_conn* uc) {
+    struct uring_worker* worker = uc->worker;
+    uc->sub_conn = NULL;
+    if (uc->recv_armed) {
+        uring_cancel(uc, URING_TAG_RECV);
+    }
+    if (uc->send_pending > 0) {
+        uring_cancel(uc, URING_TAG_SEND);
+    }
+    // the slot can be handed out again right away, a later update to it is applied after this one
+    uring_update_slot(uc, -1, 0);
+    worker->free_slots[worker->free_slot_count++] = uc->slot;
+    uring_conn_put(uc);
+}
+
+void uring_submit_chain(struct uring_conn* uc) {
+    struct uring* ring = &uc->worker->ring;
+    uring_reserve(ring, (unsigned) uc->send_count);
+    for (size_t i = 0; i < uc->send_count; ++i) {
+        int last = i + 1 == uc->send_count;
+        struct io_uring_sqe* sqe = uring_get_sqe(ring);
+        sqe->opcode = IORING_OP_SEND;
+        sqe->fd = uc->slot;
+        sqe->flags = IOSQE_FIXED_FILE | (last ? 0 : IOSQE_IO_LINK);
+        sqe->addr = (uint64_t) uc->sends[i].data;
+        sqe->len = (uint32_t) uc->sends[i].size;
+        // only the tail of the chain pushes out a partial segment
+        sqe->msg_flags = MSG_NOSIGNAL | MSG_WAITALL | (last ? 0 : MSG_MORE);
+        sqe->user_data = uring_tag(uc, URING_TAG_SEND);
+        ++uc->inflight;
+    }
+    uc->send_pending = uc->send_count;
+    uc->send_failed = 0;
+}
+
+void uring_flush(struct uring_conn* uc) {
+    struct sub_conn* sub_conn = uc->sub_conn;
+    // with a chain in flight, whatever was queued since goes out once it completes
+    if (sub_conn == NULL || uc->send_pool != NULL || sub_conn->write_buffer.size == 0) {
+        return;
+    }
+    uc->send_pool = mempool_new();
+    uc->send_count = 0;
+    size_t pushed = sub_conn->write_offset + sub_conn->write_buffer.size;
+    for (struct llist_node* node = sub_conn->write_buffer.buffers->head; node != NULL && uc->send_count < URING_MAX_CHAIN; ) {
+        struct buffer_entry* entry = node->data;
+        if (entry->size > 0) {
+            // the kernel reads the data after this returns, and the sub_conn may be gone by then
+            pxfer(sub_conn->write_buffer.pool, uc->send_pool, entry->data_root);
+            uc->sends[uc->send_count].data = (uint8_t*) entry->data;
+            uc->sends[uc->send_count].size = entry->size;
+            ++uc->send_count;
+        } else {
+            pprefree_strict(sub_conn->write_buffer.pool, entry->data_root);
+        }
+        sub_conn->write_buffer.size -= entry->size;
+        sub_conn->write_offset += entry->size;
+        struct llist_node* next = node->next;
+        llist_del(sub_conn->write_buffer.buffers, node);
+        node = next;
+    }
+    // pinned data of this chain stays until it completes, even if the sub_conn is closed before
+    sub_conn_write_pins_advance(sub_conn, pushed, uc->send_pool);
+    if (uc->send_count == 0) {
+        pfree(uc->send_pool);
+        uc->send_pool = NULL;
+        return;
+    }
+    uring_submit_chain(uc);
+}
+
+void uring_watch_conn(struct uring_worker* worker, struct conn* conn) {
+    ITER_LLIST(conn->sub_conns, value) {
+        struct sub_conn* sub_conn = value;
+        if (sub_conn->tls || worker->free_slot_count == 0) {
+            // SSL reads and writes the socket itself, those stay on epoll
+            work_watch_sub_conn(worker->param, sub_conn);
+        } else {
+            struct uring_conn* uc = uring_conn_new(worker);
+            uc->sub_conn = sub_conn;
+            uc->slot = worker->free_slots[--worker->free_slot_count];
+            uring_reserve(&worker->ring, 2);
+            // the recv must not be issued before its slot is populated
+            uring_update_slot(uc, sub_conn->fd, 1);
+            uring_arm_recv(uc);
+            sub_conn->uring = uc;
+            sub_conn->write_available = 1;
+            phook(sub_conn->pool, (void (*)(void*)) uring_conn_release, uc);
+            uring_flush(uc);
+            if (sub_conn->refresh_timeout != NULL) {
+                sub_conn->refresh_timeout(sub_conn);
+            }
+        }
+        ITER_LLIST_END();
+    }
+}
+
+void uring_arm_accept(struct uring_worker* worker, struct accept_param* listener) {
+    struct io_uring_sqe* sqe = uring_get_sqe(&worker->ring);
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = listener->fd;
+    // sockets that end up on epoll need O_NONBLOCK just as with accept_drain
+    sqe->accept_flags = SOCK_NONBLOCK | SOCK_CLOEXEC;
+    sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+    sqe->user_data = uring_tag(listener, URING_TAG_ACCEPT);
+}
+
+void uring_arm_epoll(struct uring_worker* worker) {
+    struct io_uring_sqe* sqe = uring_get_sqe(&worker->ring);
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = worker->param->epoll_fd;
+    sqe->poll32_events = POLLIN;
+    sqe->len = IORING_POLL_ADD_MULTI;
+    sqe->user_data = uring_tag(worker, URING_TAG_EPOLL);
+    worker->epoll_armed = 1;
+}
+
+void uring_arm_handoff(struct uring_worker* worker) {
+    struct io_uring_sqe* sqe = uring_get_sqe(&worker->ring);
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = worker->param->handoff.event_fd;
+    sqe->poll32_events = POLLIN;
+    sqe->len = IORING_POLL_ADD_MULTI;
+    sqe->user_data = uring_tag(worker, URING_TAG_HANDOFF);
+    worker->handoff_armed = 1;
+}
+
+void uring_complete_recv(struct uring_worker* worker, struct uring_conn* uc, struct io_uring_cqe* cqe) {
+    int more = (cqe->flags & IORING_CQE_F_MORE) != 0;
+    if (!more) {
+        uc->recv_armed = 0;
+        --uc->inflight;
+    }
+    int has_buffer = (cqe->flags & IORING_CQE_F_BUFFER) != 0;
+    uint16_t bid = (uint16_t) (cqe->flags >> IORING_CQE_BUFFER_SHIFT);
+    struct sub_conn* sub_conn = uc->sub_conn;
+    if (sub_conn == NULL || cqe->res <= 0 || sub_conn->safe_close) {
+        if (has_buffer) {
+            uring_recycle_buffer(&worker->ring, bid);
+        }
+        if (sub_conn == NULL) {
+            uring_conn_put(uc);
+        } else if (cqe->res == -ENOBUFS) {
+            // every buffer was in use, they have been recycled by now
+            if (!more) {
+                uring_arm_recv(uc);
+            }
+        } else {
+            sub_conn->on_closed(sub_conn);
+        }
+        return;
+    }
+    int closed = work_deliver(sub_conn, uring_buffer(&worker->ring, bid), (size_t) cqe->res);
+    uring_recycle_buffer(&worker->ring, bid);
+    if (closed) {
+        return;
+    }
+    if (!more) {
+        uring_arm_recv(uc);
+    }
+    if (sub_conn->refresh_timeout != NULL) {
+        sub_conn->refresh_timeout(sub_conn);
+    }
+}
+
+void uring_complete_send(struct uring_conn* uc, struct io_uring_cqe* cqe) {
+    --uc->inflight;
+    // links complete in order, and a broken link cancels the rest of the chain
+    struct uring_send* send = &uc->sends[uc->send_count - uc->send_pending];
+    --uc->send_pending;
+    if (cqe->res > 0) {
+        send->data += cqe->res;
+        send->size -= (size_t) cqe->res;
+    } else if (cqe->res != -ECANCELED) {
+        uc->send_failed = 1;
+    }
+    if (uc->send_pending > 0) {
+        return;
+    }
+    struct sub_conn* sub_conn = uc->sub_conn;
+    if (sub_conn == NULL || uc->send_failed) {
+        pfree(uc->send_pool);
+        uc->send_pool = NULL;
+        if (sub_conn != NULL) {
+            sub_conn->safe_close = 1;
+            sub_conn->on_closed(sub_conn);
+        } else {
+            uring_conn_put(uc);
+        }
+        return;
+    }
+    // a short send or a canceled link leaves a remainder, which has to go out before anything newer
+    size_t remaining = 0;
+    for (size_t i = 0; i < uc->send_count; ++i) {
+        if (uc->sends[i].size > 0) {
+            uc->sends[remaining++] = uc->sends[i];
+        }
+    }
+    if (remaining > 0) {
+        uc->send_count = remaining;
+        uring_submit_chain(uc);
+        return;
+    }
+    pfree(uc->send_pool);
+    uc->send_pool = NULL;
+    uc->send_count = 0;
+    if (sub_conn->write_buffer.size == 0 && sub_conn->on_written != NULL) {
+        sub_conn->on_written(sub_conn);
+    }
+    uring_flush(uc);
+}
+
+void uring_complete_accept(struct uring_worker* worker, struct accept_param* listener, struct io_uring_cqe* cqe) {
+    if (cqe->res >= 0) {
+        struct sockaddr_in6 addr;
+        socklen_t addr_len = sizeof(struct sockaddr_in6);
+        // a multishot accept has nowhere to put the peer address
+        if (getpeername(cqe->res, (struct sockaddr*) &addr, &addr_len)) {
+            memset(&addr, 0, sizeof(struct sockaddr_in6));
+        }
+        struct conn* conn = accept_admitted(listener, cqe->res, &addr);
+        if (conn != NULL) {
+            work_track_conn(worker->param, conn);
+            uring_watch_conn(worker, conn);
+        }
+    } else if (cqe->res != -ECONNABORTED && cqe->res != -EINTR) {
+        errlog(listener->server->logsess, "Error while accepting client: %s", strerror(-cqe->res));
+    }
+    if (!(cqe->flags & IORING_CQE_F_MORE)) {
+        uring_arm_accept(worker, listener);
+    }
+}
+
+void uring_complete_epoll(struct uring_worker* worker, struct io_uring_cqe* cqe) {
+    if (!(cqe->flags & IORING_CQE_F_MORE)) {
+        worker->epoll_armed = 0;
+    }
+    struct epoll_event events[128];
+    int epoll_status;
+    do {
+        epoll_status = epoll_wait(worker->param->epoll_fd, events, 128, 0);
+        for (int i = 0; i < epoll_status; ++i) {
+            if (events[i].events == 0) continue;
+            work_handle_event(worker->param, &events[i]);
+        }
+        // the poll only fires again on new readiness, so nothing may be left behind
+    } while (epoll_status == 128);
+}
+
+void uring_accept_handoff(struct uring_worker* worker, struct conn* conn) {
+    work_track_conn(worker->param, conn);
+    uring_watch_conn(worker, conn);
+}
+
+void uring_complete_handoff(struct uring_worker* worker, struct io_uring_cqe* cqe) {
+    if (!(cqe->flags & IORING_CQE_F_MORE)) {
+        worker->handoff_armed = 0;
+    }
+    work_drain_handoff(worker->param, (void (*)(void*, struct conn*)) uring_accept_handoff, worker);
+}
+
+void uring_complete(struct uring_worker* worker, struct io_uring_cqe* cqe) {
+    void* ptr = (void*) (cqe->user_data & ~(uint64_t) URING_TAG_MASK);
+    switch (cqe->user_data & URING_TAG_MASK) {
+        case URING_TAG_UPDATE:
+        case URING_TAG_CANCEL: {
+            struct uring_conn* uc = ptr;
+            --uc->inflight;
+            // a failed update takes its linked recv down with it, which closes the sub_conn
+            uring_conn_put(uc);
+            break;
+        }
+        case URING_TAG_RECV:
+            uring_complete_recv(worker, ptr, cqe);
+            break;
+        case URING_TAG_SEND:
+            uring_complete_send(ptr, cqe);
+            break;
+        case URING_TAG_ACCEPT:
+            uring_complete_accept(worker, ptr, cqe);
+            break;
+        case URING_TAG_EPOLL:
+            uring_complete_epoll(worker, cqe);
+            break;
+        case URING_TAG_HANDOFF:
+            uring_complete_handoff(worker, cqe);
+            break;
+    }
+}
+
+struct uring_worker* uring_worker_new(struct work_param* param) {
+    struct mempool* pool = mempool_new();
+    struct uring_worker* worker = pcalloc(pool, sizeof(struct uring_worker));
+    worker->param = param;
+    worker->pool = pool;
+    if (uring_init(&worker->ring, URING_ENTRIES)) {
+        pfree(pool);
+        return NULL;
+    }
+    if (uring_register_files_sparse(&worker->ring, URING_FILES) || uring_setup_buffers(&worker->ring, URING_BUFFERS, URING_BUFFER_SIZE)) {
+        goto error;
+    }
+    worker->free_slots = pmalloc(pool, URING_FILES * sizeof(int));
+    for (int i = URING_FILES - 1; i >= 0; --i) {
+        worker->free_slots[worker->free_slot_count++] = i;
+    }
+    return worker;
+    error:;
+    int saved_errno = errno;
+    uring_destroy(&worker->ring);
+    pfree(pool);
+    errno = saved_errno;
+    return NULL;
+}
+
+#pragma clang diagnostic push
+#pragma clang diagnostic ignored "-Wmissing-noreturn"
+
+void run_work_uring(struct work_param* param) {
+    work_init(param);
+    struct uring_worker* worker = uring_worker_new(param);
+    if (worker == NULL) {
+        errlog(param->server->logsess, "Failed to set up io_uring for worker %lu, falling back to epoll! %s", param->i, strerror(errno));
+        run_work(param);
+        return;
+    }
+    for (size_t i = 0; param->listeners != NULL && i < param->listeners->count; ++i) {
+        uring_arm_accept(worker, param->listeners->data[i]);
+    }
+    uint64_t window_start = monotonic_ns();
+    uint64_t window_busy = 0;
+    uint64_t busy_start = 0;
+    while (1) {
+        if (busy_start > 0) {
+            uint64_t now = monotonic_ns();
+            work_account_busy(param, now, now - busy_start, &window_start, &window_busy);
+        }
+        // backend sockets from modules, and tls sub_conns, are driven through epoll
+        if (!worker->epoll_armed) {
+            uring_arm_epoll(worker);
+        }
+        if (param->listeners == NULL && !worker->handoff_armed) {
+            uring_arm_handoff(worker);
+        }
+        uint64_t now = monotonic_ns();
+        timer_wheel_advance(param->manager->timers, now);
+        int timeout = param->manager->ready != NULL ? 0 : work_poll_timeout(param, now, timer_wheel_timeout(param->manager->timers, now));
+        __atomic_store_n(&param->stats.polling, 1, __ATOMIC_RELAXED);
+        int enter_status = uring_enter(&worker->ring, timeout);
+        __atomic_store_n(&param->stats.polling, 0, __ATOMIC_RELAXED);
+        busy_start = monotonic_ns();
+        work_polled(param, busy_start, timeout, uring_peek_cqe(&worker->ring) != NULL);
+        if (enter_status < 0) {
+            errlog(param->server->logsess, "io_uring error in worker thread! %s", strerror(errno));
+        }
+        struct io_uring_cqe* cqe;
+        // one send chain per sub_conn for everything written in this batch
+        param->manager->corked = 1;
+        while ((cqe = uring_peek_cqe(&worker->ring)) != NULL) {
+            // handlers queue new sqes, which may submit and reuse the slot
+            struct io_uring_cqe completion = *cqe;
+            uring_cqe_seen(&worker->ring);
+            uring_complete(worker, &completion);
+        }
+        work_drain_ready(param);
+        work_uncork(param->manager);
+    }
+}
+
+#pragma clang diagnostic pop
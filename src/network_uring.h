@@ -0,0 +1,54 @@
+#ifndef AVUNA_HTTPD_NETWORK_URING_H
+#define AVUNA_HTTPD_NETWORK_URING_H
+
+#include "network.h"
+#include "uring.h"
+#include <avuna/connection.h>
+
+#define URING_ENTRIES 1024
+#define URING_FILES 4096 // registered file slots, sockets past this stay on epoll
+#define URING_BUFFERS 256 // provided receive buffers, a power of 2
+#define URING_BUFFER_SIZE 16384
+#define URING_MAX_CHAIN 16 // linked sends in flight per sub_conn
+
+struct uring_worker;
+
+struct uring_send {
+    uint8_t* data;
+    size_t size;
+};
+
+// owned by the worker, outlives its sub_conn until every operation referencing it has completed
+struct uring_conn {
+    struct uring_worker* worker;
+    struct sub_conn* sub_conn; // NULL once the sub_conn's pool was freed
+    int slot; // registered file index
+    int slot_fd; // read by the kernel when (un)registering the slot
+    size_t inflight; // submitted operations without their final completion
+    int recv_armed;
+    struct mempool* send_pool; // owns the data of the chain in flight
+    struct uring_send sends[URING_MAX_CHAIN];
+    size_t send_count;
+    size_t send_pending; // completions still due for the chain in flight
+    int send_failed;
+    struct uring_conn* next_free;
+};
+
+struct uring_worker {
+    struct work_param* param;
+    struct mempool* pool;
+    struct uring ring;
+    int* free_slots;
+    size_t free_slot_count;
+    struct uring_conn* free_conns;
+    int epoll_armed;
+    int handoff_armed;
+};
+
+// queues the sub_conn's write_buffer as a linked send chain, see trigger_write
+void uring_flush(struct uring_conn* uc);
+
+// runs run_work instead if the ring can't be set up
+void run_work_uring(struct work_param* param);
+
+#endif //AVUNA_HTTPD_NETWORK_URING_H
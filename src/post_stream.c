@@ -0,0 +1,106 @@
+#include <avuna/post_stream.h>
+#include <avuna/pmem.h>
+#include <stdio.h>
+
+struct provision* post_stream_new(struct request_session* rs, ssize_t length, char* content_type) {
+    struct mempool* pool = mempool_new();
+    pchild(rs->pool, pool);
+    struct provision* body = pcalloc(pool, sizeof(struct provision));
+    body->pool = pool;
+    body->type = PROVISION_STREAM;
+    body->content_type = content_type;
+    body->data.stream.stream_fd = -1;
+    body->data.stream.known_length = length;
+    body->data.stream.read = post_stream_read;
+    struct post_stream* stream = body->data.stream.extra = pcalloc(pool, sizeof(struct post_stream));
+    stream->rs = rs;
+    stream->remaining = length < 0 ? 0 : (size_t) length;
+    buffer_init(&stream->pending, pool);
+    return body;
+}
+
+void post_stream_notify(struct provision* body) {
+    struct post_stream* stream = body->data.stream.extra;
+    // nonzero means the provider is done with the body, whatever else comes is only read from the client
+    if (body->data.stream.notify != NULL && body->data.stream.notify(stream->rs)) {
+        body->data.stream.notify = NULL;
+    }
+}
+
+int post_stream_push(struct provision* body, uint8_t* data, size_t size) {
+    struct post_stream* stream = body->data.stream.extra;
+    stream->remaining = stream->remaining > size ? stream->remaining - size : 0;
+    stream->received += size;
+    if (stream->limit > 0 && stream->received > stream->limit) {
+        pprefree(body->pool, data);
+        return -1;
+    }
+    if (body->data.stream.notify == NULL) {
+        // no provider reads it, so it's only drained from the client
+        pprefree(body->pool, data);
+        return 0;
+    }
+    buffer_push(&stream->pending, data, size);
+    post_stream_notify(body);
+    stream->paused = body->data.stream.notify != NULL && stream->pending.size >= POST_STREAM_WINDOW;
+    return stream->paused;
+}
+
+int post_stream_push_chunked(struct provision* body, struct buffer* in) {
+    struct post_stream* stream = body->data.stream.extra;
+    // without a provider reading it, it's decoded only to find its end
+    int keep = stream->buffered || body->data.stream.notify != NULL;
+    size_t before = stream->pending.size;
+    int status = chunked_decode(stream->chunked, in, keep ? &stream->pending : NULL);
+    if (status < 0) {
+        return -1;
+    }
+    stream->received += stream->pending.size - before;
+    if (stream->limit > 0 && stream->received > stream->limit) {
+        return -2;
+    }
+    if (stream->pending.size > before) {
+        post_stream_notify(body);
+    }
+    stream->paused = status == 0 && body->data.stream.notify != NULL && stream->pending.size >= POST_STREAM_WINDOW;
+    return stream->paused;
+}
+
+void post_stream_collect(struct provision* body) {
+    struct post_stream* stream = body->data.stream.extra;
+    struct headers* headers = stream->rs->request->headers;
+    size_t size = stream->pending.size;
+    uint8_t* data = pmalloc(body->pool, size);
+    buffer_pop(&stream->pending, size, data);
+    body->type = PROVISION_DATA;
+    body->data.data.data = data;
+    body->data.data.size = size;
+    char len_str[24];
+    sprintf(len_str, "%lu", size);
+    header_del(headers, "Transfer-Encoding");
+    header_setoradd(headers, "Content-Length", len_str);
+}
+
+void post_stream_finish(struct provision* body, int failed) {
+    struct post_stream* stream = body->data.stream.extra;
+    stream->finished = 1;
+    stream->failed = failed;
+    post_stream_notify(body);
+}
+
+ssize_t post_stream_read(struct provision* provision, struct provision_data* buffer) {
+    struct post_stream* stream = provision->data.stream.extra;
+    if (stream->pending.size == 0) {
+        return stream->failed ? -1 : (stream->finished ? 0 : -2);
+    }
+    buffer->size = stream->pending.size;
+    buffer->data = pmalloc(provision->pool, buffer->size);
+    buffer_pop(&stream->pending, buffer->size, buffer->data);
+    if (stream->paused) {
+        stream->paused = 0;
+        if (stream->on_drained != NULL) {
+            stream->on_drained(stream);
+        }
+    }
+    return (ssize_t) buffer->size;
+}
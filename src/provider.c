@@ -5,6 +5,10 @@
 #include <avuna/provider.h>
 #include <avuna/string.h>
 #include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/sendfile.h>
 
 ssize_t raw_stream_read(struct provision* provision, struct provision_data* buffer) {
     ssize_t length = provision->data.stream.known_length;
@@ -17,40 +21,110 @@ ssize_t raw_stream_read(struct provision* provision, struct provision_data* buff
 
 //TODO: subconns for raw_stream!
 
-ssize_t chunked_read(struct provision* provision, struct provision_data* buffer) {
-    struct chunked_stream_extra* extra = provision->extra;
-    buffer->size = extra->sub_conn->read_buffer.size + 128;
-    buffer->data = pmalloc(provision->pool, buffer->size);
-    size_t buffer_index = 0;
-    if (extra->sub_conn->read_buffer.size == 0) {
+ssize_t file_stream_read(struct provision* provision, struct provision_data* buffer) {
+    struct file_stream_extra* extra = provision->data.stream.extra;
+    struct http_range whole = {0, extra->size, NULL, 0};
+    struct http_range* ranges = extra->ranges == NULL ? &whole : extra->ranges->ranges;
+    size_t count = extra->ranges == NULL ? 1 : extra->ranges->count;
+    size_t trailer_length = extra->ranges == NULL ? 0 : extra->ranges->trailer_length;
+    if (extra->index >= count) {
+        return 0;
+    }
+    struct http_range* range = &ranges[extra->index];
+    size_t header_length = extra->offset == 0 ? range->part_header_length : 0;
+    size_t size = range->length - extra->offset;
+    if (size > FILE_STREAM_CHUNK) {
+        size = FILE_STREAM_CHUNK;
+    }
+    int last = extra->index + 1 == count && extra->offset + size == range->length;
+    buffer->data = pmalloc(provision->pool, header_length + size + (last ? trailer_length : 0));
+    if (header_length > 0) {
+        memcpy(buffer->data, range->part_header, header_length);
+    }
+    ssize_t r = pread(provision->data.stream.stream_fd, (uint8_t*) buffer->data + header_length, size, (off_t) (range->start + extra->offset));
+    if (r <= 0) {
+        // a file that shrank since it was opened can't make up the promised length
+        return -1;
+    }
+    buffer->size = header_length + (size_t) r;
+    extra->offset += (size_t) r;
+    if (extra->offset < range->length) {
+        return (ssize_t) buffer->size;
+    }
+    extra->index++;
+    extra->offset = 0;
+    if (extra->index < count) {
+        return (ssize_t) buffer->size;
+    }
+    if (trailer_length > 0) {
+        memcpy((uint8_t*) buffer->data + buffer->size, extra->ranges->trailer, trailer_length);
+        buffer->size += trailer_length;
+    }
+    return 0;
+}
+
+ssize_t file_stream_send(struct provision* provision, int out_fd, struct provision_data* buffer) {
+    struct file_stream_extra* extra = provision->data.stream.extra;
+    struct http_range whole = {0, extra->size, NULL, 0};
+    struct http_range* ranges = extra->ranges == NULL ? &whole : extra->ranges->ranges;
+    size_t count = extra->ranges == NULL ? 1 : extra->ranges->count;
+    buffer->data = NULL;
+    buffer->size = 0;
+    if (extra->index >= count) {
+        return 0;
+    }
+    struct http_range* range = &ranges[extra->index];
+    if (extra->offset == 0 && range->part_header_length > 0 && !extra->framed) {
+        extra->framed = 1;
+        buffer->data = (void*) range->part_header;
+        buffer->size = range->part_header_length;
+        return (ssize_t) buffer->size;
+    }
+    off_t offset = (off_t) (range->start + extra->offset);
+    ssize_t r = sendfile(out_fd, provision->data.stream.stream_fd, &offset, range->length - extra->offset);
+    if (r < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
         return -2;
+    } else if (r <= 0) {
+        // the socket failed, or a file that shrank since it was opened can't make up the promised length
+        return -1;
+    }
+    extra->offset += (size_t) r;
+    if (extra->offset < range->length) {
+        return r;
+    }
+    extra->index++;
+    extra->offset = 0;
+    extra->framed = 0;
+    if (extra->index < count) {
+        return r;
     }
-    while (extra->sub_conn->read_buffer.size > 0) {
-        ssize_t remaining = extra->remaining;
-        if (remaining == -1) {
-            char length[17];
-            buffer_peek(&extra->sub_conn->read_buffer, 16, (uint8_t*) length);
-            length[16] = 0;
-            char* post_length = NULL;
-            size_t length_int = strtoull(length, &post_length, 10);
-            if (post_length == NULL || !str_prefixes(post_length, "\r\n")) {
-                return -2; // stream_id blocked, not an error
-            }
-            size_t read_length = post_length - length + 2; // includes trailing \r\n
-            if (length_int == 0) {
-                return 0; // end of stream_id
-            }
-            buffer_skip(&extra->sub_conn->read_buffer, read_length);
-            extra->remaining = length_int;
-        }
-        if (extra->sub_conn->read_buffer.size >= remaining) {
-            buffer_index += buffer_pop(&extra->sub_conn->read_buffer, (size_t) remaining, buffer->data + buffer_index);
-            extra->remaining = -1;
-        } else {
-            size_t popped = buffer_pop(&extra->sub_conn->read_buffer, (size_t) remaining, buffer->data + buffer_index);
-            extra->remaining -= popped;
-            buffer_index += popped;
-        }
-    }
-    return buffer_index;
-}
\ No newline at end of file
+    if (extra->ranges != NULL && extra->ranges->trailer_length > 0) {
+        buffer->data = (void*) extra->ranges->trailer;
+        buffer->size = extra->ranges->trailer_length;
+    }
+    return 0;
+}
+
+ssize_t chunked_read(struct provision* provision, struct provision_data* buffer) {
+    struct chunked_stream_extra* extra = provision->data.stream.extra;
+    int status = chunked_decode(&extra->decoder, &extra->sub_conn->read_buffer, &extra->decoded);
+    if (status < 0) {
+        return -1;
+    }
+    if (extra->decoded.size == 0) {
+        return status == 1 ? 0 : -2; // stream blocked, not an error
+    }
+    struct buffer_entry* first = extra->decoded.buffers->head->data;
+    if (extra->decoded.buffers->head->next == NULL && first->data == first->data_root) {
+        // a single read of the backend that was all data, handed on without a copy
+        buffer->data = first->data;
+        buffer->size = first->size;
+        llist_del(extra->decoded.buffers, extra->decoded.buffers->head);
+        extra->decoded.size = 0;
+    } else {
+        buffer->size = extra->decoded.size;
+        buffer->data = pmalloc(provision->pool, buffer->size);
+        buffer_pop(&extra->decoded, buffer->size, buffer->data);
+    }
+    return status == 1 ? 0 : (ssize_t) buffer->size;
+}
@@ -0,0 +1,86 @@
+#include "stats.h"
+#include "network.h"
+#include "accept.h"
+#include <avuna/log.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+uint64_t monotonic_ns() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t) now.tv_sec * 1000000000 + (uint64_t) now.tv_nsec;
+}
+
+void log_server_stats(struct server_stats* stats) {
+    for (size_t i = 0; i < stats->accepts->count; ++i) {
+        struct accept_param* param = stats->accepts->data[i];
+        acclog(stats->server->logsess, "[stats] binding %s fd %i: %lu accepted, %lu rejected, %lu live", param->binding->name, param->fd, param->accepted, param->rejected,
+               __atomic_load_n(&param->binding->live_conns, __ATOMIC_RELAXED));
+    }
+    acclog(stats->server->logsess, "[stats] server %s: %lu live connections", stats->server->id, __atomic_load_n(&stats->server->live_conns, __ATOMIC_RELAXED));
+    uint64_t now = monotonic_ns();
+    for (size_t i = 0; i < stats->works->count; ++i) {
+        struct work_param* param = stats->works->data[i];
+        struct work_stats* work = &param->stats;
+        double handshake_avg = work->handshakes_completed == 0 ? 0. : (double) work->handshake_latency_total / work->handshakes_completed / 1000000.;
+        double handshake_busy = work->handshakes_completed == 0 ? 0. : (double) work->handshake_busy_total / work->handshakes_completed / 1000000.;
+        acclog(stats->server->logsess, "[stats] worker %lu: %lu live connections, %lu dispatched, %.1f%% busy",
+               param->i, __atomic_load_n(&work->live_conns, __ATOMIC_RELAXED), __atomic_load_n(&work->dispatched, __ATOMIC_RELAXED), work_load(param, now) / 10.);
+        if (param->manager != NULL) {
+            uint64_t* timeouts = param->manager->timeouts;
+            acclog(stats->server->logsess, "[stats] worker %lu: timed out %lu keep-alive, %lu header, %lu body", param->i,
+                   timeouts[TIMEOUT_KEEPALIVE], timeouts[TIMEOUT_HEADER], timeouts[TIMEOUT_BODY]);
+            acclog(stats->server->logsess, "[stats] worker %lu: %lu write calls for %lu buffer entries", param->i,
+                   param->manager->write_calls, param->manager->write_entries);
+        }
+        if (stats->server->busy_poll > 0) {
+            acclog(stats->server->logsess, "[stats] worker %lu: %lu busy polls, %lu found events, %lu sleeps", param->i, work->spins, work->spin_hits, work->sleeps);
+        }
+        acclog(stats->server->logsess, "[stats] worker %lu: %lu handshakes, %lu failed, latency avg %.3f ms max %.3f ms, cpu avg %.3f ms, %lu ktls tx, %lu ktls rx",
+               param->i, work->handshakes_completed, work->handshakes_failed, handshake_avg, (double) work->handshake_latency_max / 1000000., handshake_busy,
+               work->ktls_send, work->ktls_recv);
+    }
+}
+
+void log_listen_overflows(struct logsess* logsess) {
+    static uint64_t last_overflows = 0;
+    static uint64_t last_drops = 0;
+    FILE* netstat = fopen("/proc/net/netstat", "r");
+    if (netstat == NULL) {
+        return;
+    }
+    // a line of TcpExt: field names, followed by a line of TcpExt: values in the same order
+    char names[4096];
+    char values[4096];
+    int found = 0;
+    while (fgets(names, sizeof(names), netstat) != NULL && fgets(values, sizeof(values), netstat) != NULL) {
+        if (strncmp(names, "TcpExt:", 7) == 0) {
+            found = 1;
+            break;
+        }
+    }
+    fclose(netstat);
+    if (!found) {
+        return;
+    }
+    uint64_t overflows = 0;
+    uint64_t drops = 0;
+    char* name_save = NULL;
+    char* value_save = NULL;
+    char* name = strtok_r(names, " \n", &name_save);
+    char* value = strtok_r(values, " \n", &value_save);
+    while (name != NULL && value != NULL) {
+        if (strcmp(name, "ListenOverflows") == 0) {
+            overflows = strtoull(value, NULL, 10);
+        } else if (strcmp(name, "ListenDrops") == 0) {
+            drops = strtoull(value, NULL, 10);
+        }
+        name = strtok_r(NULL, " \n", &name_save);
+        value = strtok_r(NULL, " \n", &value_save);
+    }
+    acclog(logsess, "[stats] system: %lu accept queue overflows, %lu listen drops", overflows - last_overflows, drops - last_drops);
+    last_overflows = overflows;
+    last_drops = drops;
+}
@@ -0,0 +1,21 @@
+#ifndef AVUNA_HTTPD_STATS_H
+#define AVUNA_HTTPD_STATS_H
+
+#include <avuna/server.h>
+#include <avuna/list.h>
+#include <stdint.h>
+
+struct server_stats {
+    struct server_info* server;
+    struct list* works; // struct work_param*
+    struct list* accepts; // struct accept_param*
+};
+
+uint64_t monotonic_ns();
+
+void log_server_stats(struct server_stats* stats);
+
+// system wide accept queue overflows from /proc/net/netstat, since the last call
+void log_listen_overflows(struct logsess* logsess);
+
+#endif //AVUNA_HTTPD_STATS_H
@@ -0,0 +1,109 @@
+#include <avuna/timer.h>
+
+struct timer_wheel* timer_wheel_new(struct mempool* pool, uint64_t now_ns) {
+    struct timer_wheel* wheel = pcalloc(pool, sizeof(struct timer_wheel));
+    wheel->pool = pool;
+    wheel->start_ns = now_ns;
+    return wheel;
+}
+
+static void timer_insert(struct timer_wheel* wheel, struct timer* timer) {
+    uint64_t delta = timer->deadline > wheel->now ? timer->deadline - wheel->now : 0;
+    uint64_t slot_tick = timer->deadline > wheel->now ? timer->deadline : wheel->now;
+    size_t level = 0;
+    while (level < TIMER_WHEEL_LEVELS - 1 && delta >= (uint64_t) 1 << (TIMER_WHEEL_BITS * (level + 1))) {
+        ++level;
+    }
+    if (delta >= (uint64_t) 1 << (TIMER_WHEEL_BITS * TIMER_WHEEL_LEVELS)) {
+        // beyond the outermost level, park in its furthest slot and let cascading bring it back
+        slot_tick = wheel->now + ((uint64_t) 1 << (TIMER_WHEEL_BITS * TIMER_WHEEL_LEVELS)) - 1;
+    }
+    struct timer** slot = &wheel->slots[level][(slot_tick >> (TIMER_WHEEL_BITS * level)) & (TIMER_WHEEL_SLOTS - 1)];
+    timer->wheel = wheel;
+    timer->slot = slot;
+    timer->prev = NULL;
+    timer->next = *slot;
+    if (*slot != NULL) {
+        (*slot)->prev = timer;
+    }
+    *slot = timer;
+}
+
+static void timer_unlink(struct timer* timer) {
+    if (timer->prev != NULL) {
+        timer->prev->next = timer->next;
+    } else {
+        *timer->slot = timer->next;
+    }
+    if (timer->next != NULL) {
+        timer->next->prev = timer->prev;
+    }
+    timer->prev = NULL;
+    timer->next = NULL;
+    timer->slot = NULL;
+}
+
+void timer_arm(struct timer_wheel* wheel, struct timer* timer, uint64_t timeout_ms) {
+    if (timer->slot != NULL) {
+        timer_unlink(timer);
+        --timer->wheel->count;
+    }
+    uint64_t ticks = (timeout_ms * 1000000 + TIMER_WHEEL_TICK_NS - 1) / TIMER_WHEEL_TICK_NS;
+    timer->deadline = wheel->now + (ticks == 0 ? 1 : ticks);
+    timer_insert(wheel, timer);
+    ++wheel->count;
+}
+
+void timer_cancel(struct timer* timer) {
+    if (timer->slot == NULL) {
+        return;
+    }
+    timer_unlink(timer);
+    --timer->wheel->count;
+}
+
+void timer_wheel_advance(struct timer_wheel* wheel, uint64_t now_ns) {
+    uint64_t target = (now_ns - wheel->start_ns) / TIMER_WHEEL_TICK_NS;
+    while (wheel->now < target) {
+        if (wheel->count == 0) {
+            wheel->now = target;
+            break;
+        }
+        ++wheel->now;
+        // once a level wraps, the next slot of the level above is due within its span, so spread it out below
+        for (size_t level = 1; level < TIMER_WHEEL_LEVELS; ++level) {
+            if ((wheel->now & (((uint64_t) 1 << (TIMER_WHEEL_BITS * level)) - 1)) != 0) {
+                break;
+            }
+            struct timer** slot = &wheel->slots[level][(wheel->now >> (TIMER_WHEEL_BITS * level)) & (TIMER_WHEEL_SLOTS - 1)];
+            struct timer* timer = *slot;
+            *slot = NULL;
+            while (timer != NULL) {
+                struct timer* next = timer->next;
+                timer_insert(wheel, timer);
+                timer = next;
+            }
+        }
+        struct timer** slot = &wheel->slots[0][wheel->now & (TIMER_WHEEL_SLOTS - 1)];
+        // expiring may free or arm other timers, so always restart from the head
+        while (*slot != NULL) {
+            struct timer* timer = *slot;
+            timer_unlink(timer);
+            --wheel->count;
+            timer->expired(timer->arg);
+        }
+    }
+}
+
+int timer_wheel_timeout(struct timer_wheel* wheel, uint64_t now_ns) {
+    if (wheel->count == 0) {
+        return -1;
+    }
+    uint64_t tick = wheel->now + 1;
+    // stop at the next cascade, which may bring timers down into level 0
+    while ((tick & (TIMER_WHEEL_SLOTS - 1)) != 0 && wheel->slots[0][tick & (TIMER_WHEEL_SLOTS - 1)] == NULL) {
+        ++tick;
+    }
+    uint64_t due_ns = wheel->start_ns + tick * TIMER_WHEEL_TICK_NS;
+    return due_ns <= now_ns ? 0 : (int) ((due_ns - now_ns + 999999) / 1000000);
+}
@@ -0,0 +1,209 @@
+#include "uring.h"
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+int uring_init(struct uring* ring, unsigned entries) {
+    memset(ring, 0, sizeof(struct uring));
+    ring->fd = -1;
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(struct io_uring_params));
+    // only ever touched from the owning worker, so completions can wait until we ask for them
+    params.flags = IORING_SETUP_SINGLE_ISSUER | IORING_SETUP_DEFER_TASKRUN | IORING_SETUP_SUBMIT_ALL;
+    int fd = (int) syscall(__NR_io_uring_setup, entries, &params);
+    if (fd < 0 && errno == EINVAL) {
+        memset(&params, 0, sizeof(struct io_uring_params));
+        fd = (int) syscall(__NR_io_uring_setup, entries, &params);
+    }
+    if (fd < 0) {
+        return -1;
+    }
+    ring->fd = fd;
+    ring->features = params.features;
+    if (!(params.features & IORING_FEAT_EXT_ARG)) {
+        // too old to have multishot recv either
+        errno = ENOSYS;
+        goto error;
+    }
+    ring->sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    ring->cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        if (ring->cq_ring_size > ring->sq_ring_size) {
+            ring->sq_ring_size = ring->cq_ring_size;
+        }
+        ring->cq_ring_size = ring->sq_ring_size;
+    }
+    ring->sq_ring = mmap(NULL, ring->sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+    if (ring->sq_ring == MAP_FAILED) {
+        ring->sq_ring = NULL;
+        goto error;
+    }
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        ring->cq_ring = ring->sq_ring;
+    } else {
+        ring->cq_ring = mmap(NULL, ring->cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+        if (ring->cq_ring == MAP_FAILED) {
+            ring->cq_ring = NULL;
+            goto error;
+        }
+    }
+    ring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    ring->sqes = mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+    if (ring->sqes == MAP_FAILED) {
+        ring->sqes = NULL;
+        goto error;
+    }
+    ring->sq_entries = params.sq_entries;
+    ring->sq_head = ring->sq_ring + params.sq_off.head;
+    ring->sq_tail = ring->sq_ring + params.sq_off.tail;
+    ring->sq_mask = *(unsigned*) (ring->sq_ring + params.sq_off.ring_mask);
+    unsigned* sq_array = ring->sq_ring + params.sq_off.array;
+    for (unsigned i = 0; i < params.sq_entries; ++i) {
+        sq_array[i] = i;
+    }
+    ring->sqe_tail = *ring->sq_tail;
+    ring->cq_head = ring->cq_ring + params.cq_off.head;
+    ring->cq_tail = ring->cq_ring + params.cq_off.tail;
+    ring->cq_mask = *(unsigned*) (ring->cq_ring + params.cq_off.ring_mask);
+    ring->cqes = ring->cq_ring + params.cq_off.cqes;
+    return 0;
+    error:;
+    int saved_errno = errno;
+    uring_destroy(ring);
+    errno = saved_errno;
+    return -1;
+}
+
+void uring_destroy(struct uring* ring) {
+    if (ring->bufs != NULL) {
+        munmap(ring->bufs, ring->buf_entries * ring->buf_size);
+    }
+    if (ring->buf_ring != NULL) {
+        munmap(ring->buf_ring, ring->buf_ring_size);
+    }
+    if (ring->sqes != NULL) {
+        munmap(ring->sqes, ring->sqes_size);
+    }
+    if (ring->cq_ring != NULL && ring->cq_ring != ring->sq_ring) {
+        munmap(ring->cq_ring, ring->cq_ring_size);
+    }
+    if (ring->sq_ring != NULL) {
+        munmap(ring->sq_ring, ring->sq_ring_size);
+    }
+    if (ring->fd >= 0) {
+        close(ring->fd);
+    }
+    memset(ring, 0, sizeof(struct uring));
+    ring->fd = -1;
+}
+
+static int uring_submit(struct uring* ring, int get_events, unsigned wait_nr, int timeout_ms) {
+    __atomic_store_n(ring->sq_tail, ring->sqe_tail, __ATOMIC_RELEASE);
+    unsigned to_submit = ring->sqe_tail - __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+    // with deferred task running, completions are only posted when we ask for events, even without waiting
+    unsigned flags = get_events ? IORING_ENTER_GETEVENTS : 0;
+    struct __kernel_timespec timeout;
+    struct io_uring_getevents_arg arg;
+    memset(&arg, 0, sizeof(struct io_uring_getevents_arg));
+    if (wait_nr > 0 && timeout_ms >= 0) {
+        timeout.tv_sec = timeout_ms / 1000;
+        timeout.tv_nsec = (timeout_ms % 1000) * 1000000L;
+        arg.ts = (uint64_t) &timeout;
+    }
+    flags |= IORING_ENTER_EXT_ARG;
+    return (int) syscall(__NR_io_uring_enter, ring->fd, to_submit, wait_nr, flags, &arg, sizeof(struct io_uring_getevents_arg));
+}
+
+struct io_uring_sqe* uring_get_sqe(struct uring* ring) {
+    while (ring->sqe_tail - __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE) >= ring->sq_entries) {
+        uring_submit(ring, 0, 0, 0);
+    }
+    struct io_uring_sqe* sqe = &ring->sqes[ring->sqe_tail & ring->sq_mask];
+    ++ring->sqe_tail;
+    memset(sqe, 0, sizeof(struct io_uring_sqe));
+    return sqe;
+}
+
+void uring_reserve(struct uring* ring, unsigned count) {
+    while (ring->sq_entries - (ring->sqe_tail - __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE)) < count) {
+        uring_submit(ring, 0, 0, 0);
+    }
+}
+
+int uring_enter(struct uring* ring, int timeout_ms) {
+    int r = uring_submit(ring, 1, timeout_ms == 0 ? 0 : 1, timeout_ms);
+    if (r < 0 && (errno == ETIME || errno == EINTR || errno == EBUSY || errno == EAGAIN)) {
+        return 0;
+    }
+    return r;
+}
+
+struct io_uring_cqe* uring_peek_cqe(struct uring* ring) {
+    unsigned head = *ring->cq_head;
+    if (head == __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE)) {
+        return NULL;
+    }
+    return &ring->cqes[head & ring->cq_mask];
+}
+
+void uring_cqe_seen(struct uring* ring) {
+    __atomic_store_n(ring->cq_head, *ring->cq_head + 1, __ATOMIC_RELEASE);
+}
+
+int uring_register_files_sparse(struct uring* ring, unsigned count) {
+    int* fds = malloc(count * sizeof(int));
+    if (fds == NULL) {
+        return -1;
+    }
+    for (unsigned i = 0; i < count; ++i) {
+        fds[i] = -1;
+    }
+    int r = (int) syscall(__NR_io_uring_register, ring->fd, IORING_REGISTER_FILES, fds, count);
+    free(fds);
+    return r;
+}
+
+int uring_setup_buffers(struct uring* ring, unsigned entries, size_t buf_size) {
+    ring->buf_ring_size = entries * sizeof(struct io_uring_buf);
+    ring->buf_ring = mmap(NULL, ring->buf_ring_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (ring->buf_ring == MAP_FAILED) {
+        ring->buf_ring = NULL;
+        return -1;
+    }
+    ring->bufs = mmap(NULL, entries * buf_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (ring->bufs == MAP_FAILED) {
+        ring->bufs = NULL;
+        return -1;
+    }
+    ring->buf_entries = entries;
+    ring->buf_size = buf_size;
+    struct io_uring_buf_reg reg;
+    memset(&reg, 0, sizeof(struct io_uring_buf_reg));
+    reg.ring_addr = (uint64_t) ring->buf_ring;
+    reg.ring_entries = entries;
+    reg.bgid = 0;
+    if (syscall(__NR_io_uring_register, ring->fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0) {
+        return -1;
+    }
+    ring->buf_tail = 0;
+    for (unsigned i = 0; i < entries; ++i) {
+        uring_recycle_buffer(ring, (uint16_t) i);
+    }
+    return 0;
+}
+
+uint8_t* uring_buffer(struct uring* ring, uint16_t bid) {
+    return ring->bufs + bid * ring->buf_size;
+}
+
+void uring_recycle_buffer(struct uring* ring, uint16_t bid) {
+    struct io_uring_buf* buf = &ring->buf_ring->bufs[ring->buf_tail & (ring->buf_entries - 1)];
+    buf->addr = (uint64_t) uring_buffer(ring, bid);
+    buf->len = (uint32_t) ring->buf_size;
+    buf->bid = bid;
+    ++ring->buf_tail;
+    __atomic_store_n(&ring->buf_ring->tail, ring->buf_tail, __ATOMIC_RELEASE);
+}
@@ -0,0 +1,62 @@
+#ifndef AVUNA_HTTPD_URING_H
+#define AVUNA_HTTPD_URING_H
+
+#include <linux/io_uring.h>
+#include <stdint.h>
+#include <stddef.h>
+
+// a minimal io_uring over the raw syscalls, we don't depend on liburing
+struct uring {
+    int fd;
+    unsigned features;
+    unsigned sq_entries;
+    unsigned* sq_head;
+    unsigned* sq_tail;
+    unsigned sq_mask;
+    unsigned sqe_tail; // ours, published to sq_tail on enter
+    struct io_uring_sqe* sqes;
+    unsigned* cq_head;
+    unsigned* cq_tail;
+    unsigned cq_mask;
+    struct io_uring_cqe* cqes;
+    void* sq_ring;
+    size_t sq_ring_size;
+    void* cq_ring;
+    size_t cq_ring_size;
+    size_t sqes_size;
+    // provided buffer ring, group 0
+    struct io_uring_buf_ring* buf_ring;
+    size_t buf_ring_size;
+    unsigned buf_entries;
+    size_t buf_size;
+    uint8_t* bufs;
+    uint16_t buf_tail;
+};
+
+int uring_init(struct uring* ring, unsigned entries);
+
+void uring_destroy(struct uring* ring);
+
+// never NULL, submits to make room if the queue is full
+struct io_uring_sqe* uring_get_sqe(struct uring* ring);
+
+// submits until count sqes can be taken without an intermediate submit, so that a link chain isn't split
+void uring_reserve(struct uring* ring, unsigned count);
+
+// submits everything queued, then waits for at least one completion or timeout_ms (-1 for no timeout, 0 to not wait)
+int uring_enter(struct uring* ring, int timeout_ms);
+
+struct io_uring_cqe* uring_peek_cqe(struct uring* ring);
+
+void uring_cqe_seen(struct uring* ring);
+
+int uring_register_files_sparse(struct uring* ring, unsigned count);
+
+// registers buffer group 0 with entries (a power of 2) buffers of buf_size bytes each
+int uring_setup_buffers(struct uring* ring, unsigned entries, size_t buf_size);
+
+uint8_t* uring_buffer(struct uring* ring, uint16_t bid);
+
+void uring_recycle_buffer(struct uring* ring, uint16_t bid);
+
+#endif //AVUNA_HTTPD_URING_H
@@ -0,0 +1,89 @@
+#!/usr/bin/env python3
+# rebuilds the perfect hash table header_id looks well-known names up in, from header_names in src/headers.c.
+# --check only compares, for ctest. without it a name that collides gets the multipliers searched again and the file rewritten
+
+import re
+import sys
+
+TABLE_SIZE = 128
+EXPRESSION = re.compile(r"header_lower\(name\[1\]\) \* (\d+) \+ header_lower\(name\[length - 1\]\) \* (\d+)\) & 127")
+COMMENT = re.compile(r"name\[1\] \* (\d+) \+ name\[length - 1\] \* (\d+)\) & 127")
+
+
+def names_of(source):
+    body = re.search(r"header_names\[HEADER_WELL_KNOWN\] = \{(.*?)\};", source, re.S).group(1)
+    return [None] + re.findall(r'"([^"]*)"', body)
+
+
+def table_of(source):
+    body = re.search(r"header_table\[%d\] = \{(.*?)\};" % TABLE_SIZE, source, re.S).group(1)
+    return [int(n) for n in re.findall(r"\d+", body)]
+
+
+def slot(name, a, b):
+    n = name.encode()
+    return (len(n) * 16 + n[0] + n[1] * a + n[-1] * b) & (TABLE_SIZE - 1)
+
+
+def build(names, a, b):
+    table = [0] * TABLE_SIZE
+    for i, name in enumerate(names):
+        if name is None:
+            continue
+        s = slot(name, a, b)
+        if table[s] != 0:
+            return None
+        table[s] = i
+    return table
+
+
+def search(names):
+    for a in range(1, 256):
+        for b in range(1, 256):
+            table = build(names, a, b)
+            if table is not None:
+                return a, b, table
+    return None
+
+
+def format_table(table):
+    rows = []
+    for i in range(0, TABLE_SIZE, 16):
+        rows.append("    " + " ".join("%d," % n for n in table[i:i + 16]))
+    return "\n".join(rows)
+
+
+def main():
+    check = "--check" in sys.argv[1:]
+    paths = [arg for arg in sys.argv[1:] if arg != "--check"]
+    path = paths[0] if paths else "src/headers.c"
+    with open(path) as f:
+        source = f.read()
+    names = names_of(source)
+    a, b = (int(n) for n in EXPRESSION.search(source).groups())
+    table = build(names, a, b)
+    if check:
+        if table is None:
+            print("%s: the multipliers %d and %d collide for header_names, run %s without --check" % (path, a, b, sys.argv[0]))
+            return 1
+        if table != table_of(source):
+            print("%s: header_table doesn't match header_names, run %s without --check" % (path, sys.argv[0]))
+            return 1
+        return 0
+    if table is None:
+        found = search(names)
+        if found is None:
+            print("%s: no multipliers leave every name its own slot, header_table needs to grow" % path)
+            return 1
+        a, b, table = found
+        source = EXPRESSION.sub("header_lower(name[1]) * %d + header_lower(name[length - 1]) * %d) & 127" % (a, b), source)
+        source = COMMENT.sub("name[1] * %d + name[length - 1] * %d) & 127" % (a, b), source)
+    source = re.sub(r"(header_table\[%d\] = \{\n).*?(\n\};)" % TABLE_SIZE, lambda m: m.group(1) + format_table(table) + m.group(2),
+                    source, flags=re.S)
+    with open(path, "w") as f:
+        f.write(source)
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())